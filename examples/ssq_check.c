@@ -0,0 +1,93 @@
+/* Check driver for #hmpdf_fast_ssq (power.c).
+ *
+ * Computes the kappa one-point PDF and the power spectrum once with the
+ * adaptive sigma^2(M) integrals and once with the fixed quadrature on the
+ * shared wavenumber grid, and fails if the outputs differ by more than
+ * TOL relative to their maximum.
+ * Uses the internal LambdaCDM cosmology, so no CLASS .ini is needed.
+ *
+ * gcc -I../include -o ssq_check ssq_check.c -L.. -lhmpdf -lm
+ * ./ssq_check
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "hmpdf.h"
+
+#define TOL 1e-2
+
+static double
+maxreldiff(int N, const double *a, const double *b)
+{
+    double maxdiff = 0.0, maxval = 0.0;
+    for (int ii=0; ii<N; ii++)
+    {
+        maxdiff = fmax(maxdiff, fabs(a[ii] - b[ii]));
+        maxval = fmax(maxval, fabs(a[ii]));
+    }
+    return maxdiff / maxval;
+}
+
+static int
+run(int fast_ssq, int Nbins, double *binedges, double *op,
+    int Nell, double *elledges, double *Cell)
+{
+    double lcdm[] = { 0.7, 0.3, 0.046, 0.97, 0.81, };
+
+    hmpdf_obj *d = hmpdf_new();
+    if (!(d))
+        return -1;
+
+    if (hmpdf_init(d, NULL, hmpdf_kappa, 1.0/* source redshift */,
+                   hmpdf_lcdm_params, lcdm,
+                   hmpdf_fast_ssq, fast_ssq))
+        return -1;
+
+    if (hmpdf_get_op(d, Nbins, binedges, op, 1, 0))
+        return -1;
+
+    if (hmpdf_get_Cell(d, Nell, elledges, Cell, hmpdf_total))
+        return -1;
+
+    if (hmpdf_delete(d))
+        return -1;
+
+    return 0;
+}
+
+int main(void)
+{
+    int Nbins = 100; double kappamin = 0.0; double kappamax = 0.3;
+    double binedges[Nbins+1];
+    for (int ii=0; ii<=Nbins; ii++)
+        binedges[ii] = kappamin + (double)(ii)*(kappamax-kappamin)/(double)(Nbins);
+
+    int Nell = 50; double lnellmin = log(10.0); double lnellmax = log(2e4);
+    double elledges[Nell+1];
+    for (int ii=0; ii<=Nell; ii++)
+        elledges[ii] = exp(lnellmin + (double)(ii)*(lnellmax-lnellmin)/(double)(Nell));
+
+    double op[2][Nbins], Cell[2][Nell];
+    for (int fast_ssq=0; fast_ssq<2; fast_ssq++)
+    {
+        if (run(fast_ssq, Nbins, binedges, op[fast_ssq],
+                Nell, elledges, Cell[fast_ssq]))
+        {
+            fprintf(stderr, "failed\n");
+            return -1;
+        }
+    }
+
+    double diff_op = maxreldiff(Nbins, op[0], op[1]);
+    double diff_Cell = maxreldiff(Nell, Cell[0], Cell[1]);
+    printf("one-point PDF : max. relative difference %.2e\n", diff_op);
+    printf("power spectrum : max. relative difference %.2e\n", diff_Cell);
+
+    if (diff_op > TOL || diff_Cell > TOL)
+    {
+        fprintf(stderr, "fixed quadrature deviates by more than %.0e\n", TOL);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+/* Timing driver for the inner kernel of tp_segmentsum (twopoint.c).
+ *
+ * Compares the original branchy loop over (t1, t2) pairs with the band-limited
+ * kernel, on a synthetic segment of monotonically decreasing theta values.
+ * The band-limited kernels are those of the library (twopoint_kernels.h),
+ * the original loop is kept here for reference.
+ *
+ * gcc -I../include -O3 -ffast-math -fopenmp -o tp_kernel_bench tp_kernel_bench.c -lm
+ * ./tp_kernel_bench [N] [repetitions]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "twopoint_kernels.h"
+
+/* ---- before ---- */
+
+static inline double
+triang_A(double a, double b, double c)
+{
+    double s = 0.5 * (a + b + c);
+    return pow(s * (s-a) * (s-b) * (s-c), -0.5);
+}
+
+static void
+kernel_before(long N, const double *t, const double *dtsq, double tout,
+              double phi, double wc, double wu, double *outc, double *outu)
+{
+    for (long ii=0; ii<N; ii++)
+    {
+        double t1 = t[ii];
+        if (phi >= t1 + tout) { break; }
+
+        for (long jj=0; jj<N && jj<=ii; jj++)
+        {
+            double t2 = t[jj];
+            if (t1 >= t2 + phi) { break; }
+            if (t2 >= phi + t1) { continue; }
+            if (phi >= t1 + t2) { break; }
+
+            double temp = triang_A(phi, t1, t2) * dtsq[ii] * dtsq[jj];
+            outc[ii*N+jj] += temp * wc;
+            outu[ii*N+jj] += temp * wu;
+        }
+    }
+}
+
+/* ---- after ---- */
+
+static void
+kernel_after(long N, const double *t, const double *dtsq, double tout,
+             double phi, double wc, double wu, double *outc, double *outu)
+{
+    if (phi >= 2.0 * t[0]) { return; }
+
+    for (long ii=0; ii<N; ii++)
+    {
+        double t1 = t[ii];
+        if (phi >= t1 + tout) { break; }
+
+        long len2 = ii + 1;
+        long jlo = tp_band_lo(len2, t, t1, phi);
+        long jhi = tp_band_hi(len2, t, t1, phi);
+        if (jhi <= jlo) { continue; }
+
+        tp_band(jhi-jlo, phi, t1, wc * dtsq[ii], wu * dtsq[ii],
+                t+jlo, dtsq+jlo, outc+ii*N+jlo, outu+ii*N+jlo);
+    }
+}
+
+/* ---- driver ---- */
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    long N = (argc > 1) ? atol(argv[1]) : 1024;
+    int Nrep = (argc > 2) ? atoi(argv[2]) : 20;
+
+    /* theta(signal) of a cuspy profile, decreasing from tout */
+    double tout = 1.0;
+    double *t = malloc(N * sizeof(double));
+    double *dtsq = malloc(N * sizeof(double));
+    double *outc[2], *outu[2];
+    for (int ii=0; ii<2; ii++)
+    {
+        outc[ii] = calloc(N * N, sizeof(double));
+        outu[ii] = calloc(N * N, sizeof(double));
+    }
+    if (!t || !dtsq || !outc[0] || !outu[0] || !outc[1] || !outu[1])
+    {
+        fprintf(stderr, "allocation failed\n");
+        return -1;
+    }
+    for (long ii=0; ii<N; ii++)
+    {
+        double s = (double)(ii+1) / (double)N;
+        t[ii] = tout * exp(-4.0 * s);
+        dtsq[ii] = 8.0 * tout * tout * exp(-8.0 * s) / (double)N;
+    }
+
+    void (*kernels[])(long, const double *, const double *, double,
+                      double, double, double, double *, double *)
+        = { kernel_before, kernel_after, };
+    const char *names[] = { "before", "after", };
+    double times[2] = { 0.0, 0.0, };
+
+    /* a range of separations, as in the phi loop of create_cov */
+    int Nphi = 16;
+    for (int kk=0; kk<2; kk++)
+    {
+        double t0 = now();
+        for (int rep=0; rep<Nrep; rep++)
+        {
+            for (int pp=0; pp<Nphi; pp++)
+            {
+                double phi = 2.0 * tout * (double)(pp+1) / (double)(Nphi+1);
+                kernels[kk](N, t, dtsq, tout, phi, 0.3, 0.7, outc[kk], outu[kk]);
+            }
+        }
+        times[kk] = now() - t0;
+    }
+
+    double maxdiff = 0.0, maxval = 0.0;
+    for (long ii=0; ii<N*N; ii++)
+    {
+        maxdiff = fmax(maxdiff, fabs(outc[0][ii] - outc[1][ii]));
+        maxdiff = fmax(maxdiff, fabs(outu[0][ii] - outu[1][ii]));
+        maxval = fmax(maxval, fmax(fabs(outc[0][ii]), fabs(outu[0][ii])));
+    }
+
+    for (int kk=0; kk<2; kk++)
+    {
+        printf("%-6s : %8.3f ms per phi\n", names[kk],
+               1e3 * times[kk] / (double)(Nrep * Nphi));
+    }
+    printf("speedup : %.2f\n", times[0] / times[1]);
+    printf("max. relative difference : %.2e\n", maxdiff / maxval);
+
+    for (int ii=0; ii<2; ii++)
+    {
+        free(outc[ii]);
+        free(outu[ii]);
+    }
+    free(t);
+    free(dtsq);
+
+    return 0;
+}
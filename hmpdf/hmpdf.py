@@ -174,6 +174,12 @@ class HMPDF(object) :
                                       ndpointer(ct.c_double, flags='C_CONTIGUOUS', ndim=1),
                                       ndpointer(ct.c_double, flags='C_CONTIGUOUS', ndim=1),
                                       ndpointer(ct.c_double, flags='C_CONTIGUOUS', ndim=1), ]
+    __get_cov_shard = __libhmpdf.hmpdf_get_cov_shard
+    __get_cov_shard.restype = ct.c_int
+    __get_cov_shard.argtypes = [ct.c_void_p, ct.c_int, ct.c_int, ct.c_char_p, ]
+    __merge_cov_shards = __libhmpdf.hmpdf_merge_cov_shards
+    __merge_cov_shards.restype = ct.c_int
+    __merge_cov_shards.argtypes = [ct.c_void_p, ct.c_int, ct.POINTER(ct.c_char_p), ]
     
     # hmpdf_powerspectrum.h
     __get_Cell = __libhmpdf.hmpdf_get_Cell
@@ -353,6 +359,35 @@ class HMPDF(object) :
         return self.__ret(err, 'get_cov()', out)
     #}}}
 
+    def get_cov_shard(self,
+                      shard: int,
+                      Nshards: int,
+                      fname: str) -> None :
+        """! Compute part of the covariance matrix [calls hmpdf_get_cov_shard()]
+        
+        @param shard         index of this part, 0 <= shard < Nshards
+        @param Nshards       total number of parts
+        @param fname         file the partial result is written to
+        """
+    #{{{
+        err = HMPDF.__get_cov_shard(self.__d, shard, Nshards, _C()(fname))
+        return self.__ret(err, 'get_cov_shard()')
+    #}}}
+
+    def merge_cov_shards(self,
+                         fnames: Sequence[str]) -> None :
+        """! Combine the outputs of get_cov_shard() [calls hmpdf_merge_cov_shards()]
+        
+        Afterwards, get_cov() returns the merged covariance matrix.
+        
+        @param fnames        the files written by get_cov_shard()
+        """
+    #{{{
+        _fnames = (ct.c_char_p * len(fnames))(*[_C()(f).value for f in fnames])
+        err = HMPDF.__merge_cov_shards(self.__d, len(fnames), _fnames)
+        return self.__ret(err, 'merge_cov_shards()')
+    #}}}
+
     def get_Cell(self,
                  ell: Union[Sequence[float], np.ndarray],
                  mode: str='total') -> np.ndarray :
@@ -75,6 +75,7 @@ typedef struct//{{{
     // in the format [z_idx1, M_idx1, z_idx2, M_idx2, ...]
     int *profiles_indices;
 
+    int Nws;
     bcm_ws **ws; // one for each thread
                  // probably want to have these somewhat separate in memory to avoid false sharing
 }//}}}
@@ -1,14 +1,42 @@
 #ifndef CLASS_INTERFACE_H
 #define CLASS_INTERFACE_H
 
+#include <gsl/gsl_spline.h>
+
 #include "object.h"
 
 #include "hmpdf.h"
 
+typedef enum//{{{
+{
+    bg_H, // 1/Mpc
+    bg_comoving, // Mpc
+    bg_angular_diameter, // Mpc, physical
+    bg_D, // growth factor
+    bg_Om,
+    bg_end, // keep this last
+}//}}}
+bg_quantity_e;
+
 typedef struct//{{{
 {
     char *class_ini;
     char *class_pre;
+    char *class_cache;
+    double *lcdm_params; // if not NULL, don't use CLASS
+
+    // user-supplied tables, if tab_z is not NULL don't use CLASS
+    int tab_Nz;
+    double *tab_z;
+    double *tab_H;
+    double *tab_comoving;
+    double *tab_angular_diameter;
+    double *tab_Dsq;
+    double *tab_Om;
+    int tab_Nk;
+    double *tab_k;
+    double *tab_Pk;
+    double tab_Omega_b;
 
     void /*struct precision*/ *pr;
     void /*struct background*/ *ba;
@@ -21,11 +49,31 @@ typedef struct//{{{
     void /*struct lensing*/ *le;
     void /*struct distortions*/ *sd;
     void /*struct output*/ *op;
+
+    // the quantities we take from CLASS (or the analytic backend),
+    //     the CLASS structs are freed once these are filled.
+    //     Other modules only access these, through background_at_z
+    //     and the power spectrum tables
+    double h;
+    double H0; // 1/Mpc
+    double Omega0_m;
+    double Omega0_b;
+
+    int Nbg; // CLASSBG_NZ unless tables are user-supplied
+    double *bg_lnzp1; // [Nbg], uniform in log(1+z) unless user-supplied
+    double *bg[bg_end]; // [Nbg]
+    gsl_spline *bg_interp[bg_end];
+
+    int NPk; // PKINTERP_NK unless tables are user-supplied
+    double *Pk_lnk; // [NPk], uniform in log k unless user-supplied
+    double *Pk_lnPk; // [NPk], linear z=0 matter power spectrum
 }//}}}
 class_interface_t;
 
 int null_class_interface(hmpdf_obj *d);
 int reset_class_interface(hmpdf_obj *d);
+int class_inputs_hash(hmpdf_obj *d, uint64_t *h);
+int background_at_z(hmpdf_obj *d, double z, bg_quantity_e q, double *out);
 int init_class_interface(hmpdf_obj *d);
 
 #endif
@@ -9,17 +9,29 @@
 #define LOGK // if this macro is defined, integrals over k are evaluated on log grid
 #define LOGELL
 
-#define PKINTERP_NK 10000
+#define PKINTERP_NK 10000 // uniform in log k, up to the CLASS k_max
 #define PKINTERP_KMIN 1e-10
-#define PKINTERP_KMAX 1e2
 #define PKINTERP_TYPE interp_cspline
 
+#define CLASSBG_NZ 4000 // uniform in log(1+z)
+#define CLASSBG_ZMAX 1200.0 // maximum allowed source redshift
+#define CLASSBG_INTERP_TYPE interp_cspline
+#define CLASSBG_CHECK_TOL 1e-3 // relative deviation from CLASS between the nodes,
+                               //   the typical maximum is 1e-4 (distances at z -> 0)
+#define CLASS_CACHE_MAGIC "hmpdfcl1"
+
+#define LCDM_KMAX 1e3 // 1/Mpc, upper end of the analytic P(k) table
+#define LCDM_TCMB 2.7255 // K
+
 #define PKINTEGR_KMIN PKINTERP_KMIN
 #define PKINTEGR_LIMIT 10000
 #define PKINTEGR_KEY 6
 #define PKINTEGR_EPSABS 0.0
 #define PKINTEGR_EPSREL 1e-6
 
+#define SSQINTEGR_NK 16385 // odd, Simpson on uniform log k grid
+#define SSQINTEGR_CHECK_TOL 1e-3 // DEBUG comparison with adaptive integration
+
 #define MDEF_GLOBAL hmpdf_mdef_m // this should not be changed,
                                  //    since it's assumed in computation
                                  //    of the mass function
@@ -55,6 +67,8 @@
                       // -- verified that this gives sub-percent accuracy
 #define COVINTEGR_N 100 // this is slow but we want to be sure that we pick out
                         //   possible oscillatory behaviour
+                        // (TPINTEGR_N, COVINTEGR_N are only used if TPINTERP_TYPE
+                        //  is bicubic, bilinear is integrated exactly)
 
 #define BATTINTEGR_LIMIT 1000
 #define BATTINTEGR_KEY 6
@@ -63,6 +77,9 @@
 
 #define TP_PHI_EQ_TOL 1e-10
 
+#define TP_ZCOMPR_MAXRANK 16 // maximum number of basis matrices
+                             //   in the redshift compression of the clustered term
+
 #define PU_R2C_MODE FFTW_MEASURE
 #define PPDF_C2R_MODE FFTW_MEASURE
 #define PC_R2C_MODE FFTW_MEASURE
@@ -76,8 +93,18 @@
 #define PS_COVINTEGR_N 100
 
 #define COV_STATUS_PERIOD    100
+#define COV_NSTRIPES         64 // number of locks if covariance accumulation
+                                //   cannot use per-thread copies
+#define COV_CHECKPOINT_CHUNK 16 // phi values per thread between possible checkpoints
+#define COV_CHECKPOINT_MAGIC "hmpdfcv2"
+#define COV_TIMINGS_MAGIC    "hmpdftm1"
+#define COV_NOISE_MAXGROUPS  16 // maximum number of batched noise convolutions
 #define MAPNOZ_STATUS_PERIOD 400
 #define MAPWZ_STATUS_PERIOD  8
+#define MAPTILE_SIDE 256 // sidelength of the tiles locked in the tiled map painting
+#define MAPSTAMP_NSUB 8 // sub-pixel offsets per direction if the stamp cache is used
+#define MAPCONV_FFT_COST 3.0 // cost of the FFT painting per pixel per log2(pixels),
+                             //     in units of one pixel added in the scatter painting
 
 #define NOISE_ELLMIN 1e-2
 #define NOISE_ELLMAX 1e12
@@ -86,6 +113,18 @@
 #define NOISE_EPSREL 1e-3
 #define NOISE_KEY    6
 #define NOISE_ZETAINTERP_N 1000
+#define NOISE_PAD_NSIGMA 8.0 // noisy grids extend this many sigma beyond the signal range
+#define NOISE_KERNEL_TOL 1e-16 // relative to the peak, kernel truncated below this
+#define NOISE_DIRECT_MAXWIDTH 64 // wider kernels are applied with FFTs
+
+#define FFTLOG_XMIN_FACTOR 1e4 // log grid starts this far below first sample
+#define FFTLOG_PAD         2.0 // log grid extends to this multiple of xmax
+#define FFTLOG_SPACING     2.0 // log grid spacing in units of the input's log spacing at xmax,
+                               //   i.e. the log grid is twice as coarse as the input there
+#define FFTLOG_INTERP_TYPE interp_cspline
+#define FFTLOG_PLAN_MODE   FFTW_ESTIMATE
+#define FFTLOG_CHECK_PERIOD 64 // DEBUG comparison with gsl_dht on every this many calls
+#define FFTLOG_CHECK_TOL   1e-2 // relative to the maximum
 
 #define BCM_XI_SEARCH_TOL 1e-2 // choice in Max Lee's code
 
@@ -94,16 +133,19 @@
 #define BCM_BGINTEGR_EPSABS 1e-3 // in units of remaining baryonic mass
 #define BCM_BGINTEGR_EPSREL 1e-4
 
-#define DNDZ_INTEGR_LIMIT 1000
+#define DNDZ_NZ 4097 // fine grid for the lensing efficiency, uniform in z
+#define DNDZ_INTERP_TYPE interp_cspline
+#define DNDZ_INTEGR_LIMIT 1000 // DEBUG comparison with direct integration
 #define DNDZ_INTEGR_KEY 6
-#define DNDZ_INTEGR_EPSABS 0.0 // in units of the normalization
 #define DNDZ_INTEGR_EPSREL 1e-6
+#define DNDZ_CHECK_TOL 1e-5 // relative to the maximum
 //}}}
 
 struct DEFAULTS {int Ncores[3]; int verbosity; int warn_is_err;
                  char *class_pre;
                  int Npoints_z[3]; double z_min[3]; double z_max[3];
                  hmpdf_dndz_f dndz; void *dndz_params;
+                 int Ndndz; hmpdf_dndz_f *dndz_list; void **dndz_params_list; int dndz_index;
                  int Npoints_M[3]; double M_min[3]; double M_max[3];
                  long Npoints_signal[3]; double min_kappa[3]; double min_tsz[3]; double max_kappa[3]; double max_tsz[3];
                  int Npoints_theta[3]; double rout_scale[3]; hmpdf_mdef_e rout_rdef[3];
@@ -125,7 +167,16 @@ struct DEFAULTS {int Ncores[3]; int verbosity; int warn_is_err;
                  hmpdf_integr_mode_e Mintegr_type[3]; double Mintegr_alpha; double Mintegr_beta;
                  double *Duffy08_p; double *Tinker10_p; double *Battaglia12_p;
                  hmpdf_noise_pwr_f noise_pwr; void *noise_pwr_params;
-                 double fsky[3]; int pxlgrid[3]; int mappoisson; int mapseed; };
+                 double fsky[3]; int pxlgrid[3]; int mappoisson; int mapseed;
+                 double tp_zcompr_tol[3];
+                 char *cov_checkpoint; int cov_checkpoint_period[3];
+                 char *cov_timings; double cov_noise_zeta_tol[3];
+                 int fftlog; int fast_ssq; char *class_cache;
+                 double *lcdm_params;
+                 int tab_Nz; double *tab_z; double *tab_H; double *tab_comoving;
+                 double *tab_angular_diameter; double *tab_Dsq; double *tab_Om;
+                 int tab_Nk; double *tab_k; double *tab_Pk; double tab_Omega_b;
+                 int map_tiled; double map_stamp_cache; int map_zslices; };
 
 extern struct DEFAULTS def;
 
@@ -10,7 +10,8 @@ typedef struct//{{{
     double *hubble;
     double *comoving;
     double *angular_diameter;
-    double *invScrit;
+    int Nsrc; // number of source distributions
+    double *invScrit; // [Nsrc * Nz], one row per source distribution
     double *Dsq;
     // simple quantities
     double h;
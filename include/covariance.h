@@ -2,15 +2,44 @@
 #define COVARIANCE_H
 
 #include <time.h>
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
 
+#include "configs.h"
 #include "twopoint.h"
 #include "hmpdf.h"
 
 typedef struct//{{{
 {
+    char *checkpoint_fname;
+    int checkpoint_period;
+    char *timings_fname;
+    double noise_zeta_tol;
+
     double *Cov;
     double *Cov_noisy;
     double *corr_diagn;
+    char *phidone; // [ Nphi ]
+    double *phitime; // [ Nphi ], measured cost (0 if unknown)
+
+    // only phi indices with pp % Nshards == shard are computed
+    int shard;
+    int Nshards;
+
+    // per-thread accumulators [ Nws, N * N ], only during the computation
+    double **acc;
+    double **acc_noisy;
+    #ifdef _OPENMP
+    // used if there is not enough memory for per-thread accumulators
+    omp_lock_t stripe_locks[COV_NSTRIPES];
+    #endif
+
+    // batched noise convolutions, only during the computation
+    int Nnoise_groups;
+    int *noise_group; // [ Nphi ], -1 if convolved individually
+    double *noise_group_zeta; // [ Nnoise_groups ]
+    double **noise_group_acc; // [ Nnoise_groups, N * N ]
 
     int Nws;
     int created_tp_ws;
@@ -28,5 +57,7 @@ int reset_covariance(hmpdf_obj *d);
 int hmpdf_get_cov(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double cov[Nbins*Nbins], int noisy);
 int hmpdf_get_cov_diagnostics(hmpdf_obj *d, int *Nphi, double **phi,
                               double **phiweights, double **corr_diagn);
+int hmpdf_get_cov_shard(hmpdf_obj *d, int shard, int Nshards, char *fname);
+int hmpdf_merge_cov_shards(hmpdf_obj *d, int Nshards, char *fnames[Nshards]);
 
 #endif
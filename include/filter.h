@@ -32,6 +32,7 @@ typedef struct//{{{
 
     double pixelside;
     gsl_spline **quadraticpixel_interp;
+    int Nquadraticpixel_accel;
     gsl_interp_accel ***quadraticpixel_accel;
     double *quadraticpixel_ellmin;
     double *quadraticpixel_ellmax;
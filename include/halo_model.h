@@ -29,6 +29,7 @@ typedef struct//{{{
     double **bias;
 
     gsl_spline *c_interp;
+    int Nc_accel;
     gsl_interp_accel **c_accel;
 }//}}}
 halo_model_t;
@@ -0,0 +1,14 @@
+#ifndef HANKEL_H
+#define HANKEL_H
+
+// zeroth order Hankel transforms on the grids of gsl_dht,
+//     either with gsl_dht [O(N^2)] or with FFTLog [O(N log N)]
+
+typedef struct hankel_s hankel;
+int new_hankel(int N, double xmax, int fftlog, int Nthreads, hankel **out);
+void delete_hankel(hankel *h);
+double hankel_x_sample(hankel *h, int n);
+double hankel_k_sample(hankel *h, int n);
+int hankel_apply(hankel *h, double *in, double *out);
+
+#endif
@@ -70,7 +70,8 @@
  *         See #hmpdf_configs_e for optional inputs.
  *      3. get your output [hmpdf_get_op(), hmpdf_get_tp(), hmpdf_get_cov(),
  *                          hmpdf_get_Cell(), hmpdf_get_Cphi(),
- *                          hmpdf_get_map(), hmpdf_get_map_op()].
+ *                          hmpdf_get_map(), hmpdf_get_map_op(),
+ *                          hmpdf_get_map_ensemble()].
  *      4. go to (3.) if you require any other outputs;
  *         go to (2.) if you want to re-run the code with different options.
  *      5. free the memory associated with the #hmpdf_obj with hmpdf_delete().
@@ -84,6 +84,17 @@ typedef enum
  *  
  *  Less frequently used options:
  *      + verbosity: #hmpdf_verbosity
+ *      + avoid repeated CLASS runs: #hmpdf_class_cache
+ *      + analytic cosmology instead of CLASS: #hmpdf_lcdm_params
+ *      + tabulated cosmology instead of CLASS: #hmpdf_tab_Nz, #hmpdf_tab_z,
+ *                                              #hmpdf_tab_H, #hmpdf_tab_comoving,
+ *                                              #hmpdf_tab_angular_diameter,
+ *                                              #hmpdf_tab_Dsq, #hmpdf_tab_Om,
+ *                                              #hmpdf_tab_Nk, #hmpdf_tab_k, #hmpdf_tab_Pk,
+ *                                              #hmpdf_tab_Omega_b
+ *      + weak lensing source redshifts: #hmpdf_dndz (and #hmpdf_dndz_params),
+ *                                       tomographic: #hmpdf_N_dndz, #hmpdf_dndz_list,
+ *                                       #hmpdf_dndz_params_list, #hmpdf_dndz_index
  *      + behaviour when unusual states are encountered: #hmpdf_warn_is_err
  *      + halo model fit parameters: #hmpdf_Duffy08_conc_params,
  *                                   #hmpdf_Tinker10_hmf_params,
@@ -92,7 +103,10 @@ typedef enum
  *      + PDF internal sampling points: #hmpdf_N_signal, #hmpdf_signal_min, #hmpdf_signal_max
  *      + settings for simplified simulations: #hmpdf_map_fsky,
  *                                             #hmpdf_map_pixelgrid,
- *                                             #hmpdf_map_poisson
+ *                                             #hmpdf_map_poisson,
+ *                                             #hmpdf_map_tiled,
+ *                                             #hmpdf_map_stamp_cache,
+ *                                             #hmpdf_map_zslices
  *  
  *  Integration grids:
  *      + redshift integration: #hmpdf_N_z, #hmpdf_z_min, #hmpdf_z_max,
@@ -100,11 +114,14 @@ typedef enum
  *      + halo mass integration: #hmpdf_N_M, #hmpdf_M_min, #hmpdf_M_max,
  *                               #hmpdf_Mintegr_type, #hmpdf_Mintegr_alpha, #hmpdf_Mintegr_beta
  *      + halo profile angular integration: #hmpdf_N_theta, #hmpdf_rout_scale, #hmpdf_rout_rdef
+ *      + faster algorithms: #hmpdf_fftlog, #hmpdf_fast_ssq
  *
  *  Covariance matrix calculation:
  *      + useful to improve numerical stability: #hmpdf_N_phi
  *      + integration/summation grid: #hmpdf_phi_max, #hmpdf_pixelexact_max, #hmpdf_phi_jitter,
  *                                    #hmpdf_phi_pwr
+ *      + approximations for speed: #hmpdf_tp_zcompr_tol, #hmpdf_cov_noise_zeta_tol
+ *      + long runs: #hmpdf_cov_checkpoint, #hmpdf_cov_checkpoint_period, #hmpdf_cov_timings
  */
 typedef enum
 {
@@ -161,6 +178,32 @@ typedef enum
                         *   \par
                         *   Type: void *. Default: None.
                         */
+    hmpdf_N_dndz, /*!< number of tomographic source redshift distributions
+                   *   passed in #hmpdf_dndz_list.
+                   *   \par
+                   *   Type: int. Default: 0.
+                   */
+    hmpdf_dndz_list, /*!< source redshift distributions for #hmpdf_kappa,
+                      *   alternative to #hmpdf_dndz.
+                      *   The lensing efficiencies of all distributions are computed
+                      *   in a single pass and kept, #hmpdf_dndz_index selects the one
+                      *   the outputs refer to.
+                      *   \par
+                      *   Type: #hmpdf_dndz_f *. Default: None.
+                      *   \remark to loop over the tomographic bins, call hmpdf_init()
+                      *           repeatedly with only #hmpdf_dndz_index changed
+                      *           (and the same arrays).
+                      *           The cosmology is then kept, only the profiles are recomputed.
+                      */
+    hmpdf_dndz_params_list, /*!< additional parameters to pass to the functions
+                             *   in #hmpdf_dndz_list, one entry per distribution.
+                             *   \par
+                             *   Type: void **. Default: None.
+                             */
+    hmpdf_dndz_index, /*!< which of the distributions in #hmpdf_dndz_list to use.
+                       *   \par
+                       *   Type: int. Default: 0.
+                       */
     hmpdf_N_M, /*!< number of sample points in halo mass integration.
                 *   \par
                 *   Type: int. Default: 65.
@@ -491,6 +534,211 @@ typedef enum
                      *   \par
                      *   Type: int. Default: None.
                      */
+    hmpdf_tp_zcompr_tol, /*!< If positive, the clustered contribution to the two-point PDF
+                          *   is computed from a low-rank basis across redshift.
+                          *   The redshift contributions, weighted with their prefactors
+                          *   in the redshift integral, are represented to this relative
+                          *   accuracy in sum, and only the basis elements are Fourier
+                          *   transformed.
+                          *   This saves most of the large 2D FFTs in two-point PDF and
+                          *   covariance matrix computations.
+                          *   The rank is limited to log2(#hmpdf_N_signal),
+                          *   beyond which the projections would be more expensive
+                          *   than the FFTs they save.
+                          *   The rank actually used is printed for #hmpdf_verbosity > 0
+                          *   (covariance) or > 1 (two-point PDF).
+                          *   \par
+                          *   Type: double. Default: 0 (exact computation).
+                          *   \remark values around 1e-4 are a reasonable starting point,
+                          *           but you should check convergence for your application.
+                          */
+    hmpdf_cov_checkpoint, /*!< file to which the partial covariance matrix is periodically
+                           *   written.
+                           *   If this file exists when hmpdf_get_cov() is called and was written
+                           *   with the same settings, the computation resumes from it.
+                           *   A file written with different settings is ignored
+                           *   and overwritten.
+                           *   \par
+                           *   Type: char *. Default: None (no checkpointing).
+                           *   \remark the settings are compared through a hash of the option values
+                           *            (including the contents of arrays, e.g. tabulated functions),
+                           *            the CLASS inputs and the phi grid.
+                           *            Options that do not change the result (e.g. the number
+                           *            of threads) may change between runs.
+                           *   \remark if a user-supplied function is passed (e.g. #hmpdf_dndz,
+                           *            #hmpdf_custom_ell_filter), the settings cannot be compared
+                           *            and checkpointing is an error.
+                           */
+    hmpdf_cov_checkpoint_period, /*!< minimum time between writes of #hmpdf_cov_checkpoint.
+                                  *   \par
+                                  *   Type: int [seconds]. Default: 600.
+                                  */
+    hmpdf_cov_timings, /*!< file in which the measured cost of each pixel separation
+                        *   in the covariance matrix computation is recorded.
+                        *   If this file exists and was written with the same settings,
+                        *   the recorded timings are used to schedule the expensive
+                        *   pixel separations first, which reduces the time threads spend idle
+                        *   at the end of the computation.
+                        *   Otherwise, the scheduling is based on a simple cost model.
+                        *   \par
+                        *   Type: char *. Default: None.
+                        *   \remark with hmpdf_get_cov_shard(), the file name is suffixed
+                        *            with ".<shard>of<Nshards>", as for #hmpdf_cov_checkpoint.
+                        *   \remark failure to read or write this file is not an error.
+                        *            It is not used if a user-supplied function is passed
+                        *            (see #hmpdf_cov_checkpoint).
+                        */
+    hmpdf_cov_noise_zeta_tol, /*!< In the noisy covariance matrix computation,
+                               *   pixel separations whose noise correlation functions
+                               *   agree to within this tolerance (relative to the noise variance)
+                               *   share a single noise convolution.
+                               *   \par
+                               *   Type: double. Default: 0.
+                               *   \remark even for zero tolerance the pixel separations with
+                               *           vanishing noise correlation
+                               *           (those larger than #hmpdf_phi_max / 2) are batched,
+                               *           which is exact.
+                               */
+    hmpdf_fftlog, /*!< Compute the zeroth order Hankel transforms
+                   *   (profile Fourier transforms, correlation functions)
+                   *   with FFTLog instead of the default discrete Hankel transform.
+                   *   This scales as N log N instead of N^2 and pays off for
+                   *   large #hmpdf_N_theta.
+                   *   \par
+                   *   Type: int. Default: 0.
+                   *   \remark in DEBUG builds, some of the transforms are compared with
+                   *           the discrete Hankel transform and an error is returned
+                   *           if they differ by more than one per cent of the maximum.
+                   */
+    hmpdf_fast_ssq, /*!< Compute the variance of the linear density field for all masses
+                     *   with a fixed quadrature on a shared wavenumber grid
+                     *   instead of two adaptive integrations per mass.
+                     *   \par
+                     *   Type: int. Default: 0.
+                     *   \remark in DEBUG builds, the result is compared with the adaptive
+                     *           integration at every mass and an error is returned
+                     *           if they differ by more than 0.1 per cent.
+                     *           examples/ssq_check.c compares the outputs of both modes.
+                     */
+    hmpdf_class_cache, /*!< directory in which the CLASS output used by this code
+                        *   (background and linear matter power spectrum) is cached.
+                        *   The file name contains a hash of the contents of the CLASS .ini
+                        *   and precision files, so if these have not changed between calls
+                        *   to hmpdf_init(), CLASS does not need to be run again.
+                        *   A corrupted or unwritable cache file is not an error.
+                        *   \par
+                        *   Type: char *. Default: None.
+                        *   \remark independently of this option, the CLASS background is
+                        *            tabulated on 4000 points uniform in log(1+z).
+                        *            In DEBUG builds, the interpolation is compared
+                        *            with CLASS between the nodes.
+                        */
+    hmpdf_lcdm_params, /*!< If passed, CLASS is not run and the class_ini argument to
+                        *   hmpdf_init() is ignored (it may be NULL).
+                        *   Instead, a flat LambdaCDM cosmology without radiation or
+                        *   massive neutrinos is computed internally, with the
+                        *   Eisenstein & Hu (1998) no-wiggle linear matter power spectrum.
+                        *   Parameters are
+                        *   {h, Omega_m, Omega_b, n_s, sigma_8}.
+                        *   \par
+                        *   Type: double *. Default: None.
+                        *   \remark useful for quick exploration, but not accurate
+                        *           at the per cent level (no BAO wiggles).
+                        */
+    hmpdf_tab_Nz, /*!< Number of redshift samples in the user-supplied background tables.
+                   *   If #hmpdf_tab_z is passed, CLASS is not run and the class_ini
+                   *   argument to hmpdf_init() is ignored (it may be NULL).
+                   *   Instead, the background and linear matter power spectrum
+                   *   are interpolated from the user-supplied tables
+                   *   (all of #hmpdf_tab_Nz through #hmpdf_tab_Omega_b must then be passed).
+                   *   \par
+                   *   Type: int. Default: 0.
+                   */
+    hmpdf_tab_z, /*!< Redshift samples of the user-supplied background tables,
+                  *   starting at z = 0 and monotonically increasing.
+                  *   They need to cover the redshift integration range and the source
+                  *   redshift.
+                  *   \par
+                  *   Type: double *. Default: None.
+                  */
+    hmpdf_tab_H, /*!< Hubble parameter at #hmpdf_tab_z, in 1/Mpc.
+                  *   \par
+                  *   Type: double *. Default: None.
+                  */
+    hmpdf_tab_comoving, /*!< Comoving distance at #hmpdf_tab_z, in Mpc.
+                         *   \par
+                         *   Type: double *. Default: None.
+                         */
+    hmpdf_tab_angular_diameter, /*!< Physical angular diameter distance at #hmpdf_tab_z, in Mpc.
+                                 *   \par
+                                 *   Type: double *. Default: None.
+                                 */
+    hmpdf_tab_Dsq, /*!< Squared linear growth factor at #hmpdf_tab_z,
+                    *   normalized to unity at z = 0.
+                    *   \par
+                    *   Type: double *. Default: None.
+                    */
+    hmpdf_tab_Om, /*!< Matter density parameter at #hmpdf_tab_z.
+                   *   \par
+                   *   Type: double *. Default: None.
+                   */
+    hmpdf_tab_Nk, /*!< Number of wavenumber samples in the user-supplied
+                   *   linear matter power spectrum.
+                   *   \par
+                   *   Type: int. Default: 0.
+                   */
+    hmpdf_tab_k, /*!< Wavenumber samples of the user-supplied linear matter power spectrum,
+                  *   in 1/Mpc, monotonically increasing.
+                  *   Below the smallest wavenumber the power spectrum is extrapolated
+                  *   as a power law, above the largest one it is taken to vanish.
+                  *   \par
+                  *   Type: double *. Default: None.
+                  */
+    hmpdf_tab_Pk, /*!< Linear matter power spectrum at z = 0 at #hmpdf_tab_k, in Mpc^3.
+                   *   \par
+                   *   Type: double *. Default: None.
+                   */
+    hmpdf_tab_Omega_b, /*!< Baryon density parameter at z = 0,
+                        *   required with the user-supplied tables.
+                        *   \par
+                        *   Type: double. Default: None.
+                        */
+    hmpdf_map_tiled, /*!< If set to non-zero, the threads paint halos directly
+                      *   into the shared simplified simulation (map),
+                      *   locking only the tiles a halo overlaps.
+                      *   Each thread collects the halos around one tile in a small buffer
+                      *   before adding them under the lock.
+                      *   By default, each thread has its own copy of the full map
+                      *   and these are summed at the end,
+                      *   which is faster but requires #hmpdf_N_threads times the memory.
+                      *   \remark in this mode, bins with many halos are not painted
+                      *           by FFT convolution, since that requires two
+                      *           additional full-size maps.
+                      *   \par
+                      *   Type: int. Default: 0.
+                      */
+    hmpdf_map_stamp_cache, /*!< Memory budget (in GB) for a cache of the pixelized halo
+                            *   images used in the simplified simulations (maps).
+                            *   If positive, the halo centers are placed on a lattice of
+                            *   sub-pixel offsets, and the images for each redshift, mass
+                            *   and offset are kept for subsequent maps,
+                            *   evicting the least recently used ones if the budget is exceeded.
+                            *   \par
+                            *   Type: double. Default: 0.
+                            */
+    hmpdf_map_zslices, /*!< Maximum number of redshift slices of the simplified simulation (map)
+                        *   that are processed concurrently if there are z-dependent filters
+                        *   (e.g. #hmpdf_custom_k_filter).
+                        *   Each slice has its own buffer,
+                        *   requiring one additional copy of the map in memory.
+                        *   All threads paint into all slices (locking the buffers tile by tile),
+                        *   then the slices are Fourier transformed and filtered concurrently.
+                        *   If 1, the slices are processed one after another,
+                        *   with the halos in each slice painted in parallel.
+                        *   \par
+                        *   Type: int. Default: 1.
+                        *   \remark has no effect if #hmpdf_map_tiled is set.
+                        */
     hmpdf_end_configs, /*!< required last argument in hmpdf_init_fct(), the convenience macro
                         *   hmpdf_init() takes care of that.
                         */
@@ -66,4 +66,52 @@ int hmpdf_get_cov_diagnostics(hmpdf_obj *d,
                               double **phiweights,
                               double **corr_diagn);
 
+/*! Computes part of the covariance matrix and writes it to a file.
+ *  This allows to distribute a single covariance matrix computation
+ *  over independent processes, which are later combined with hmpdf_merge_cov_shards().
+ *
+ *  \param[in,out] d    hmpdf_init() must have been called on d
+ *  \param[in] shard    index of this part, 0 <= shard < Nshards
+ *  \param[in] Nshards  total number of parts
+ *  \param[in] fname    file the partial result is written to
+ *  \return error code
+ *
+ *  \remark all processes must have called hmpdf_init() with identical settings.
+ *  \remark not supported if a user-supplied function is passed
+ *          (e.g. #hmpdf_dndz), since the shards could not be matched to the settings.
+ *  \remark the pixel separations are assigned to the shards in the (deterministic)
+ *          internal order, so the shards have comparable cost.
+ *  \remark if you use #hmpdf_cov_checkpoint, the checkpoint file name is suffixed
+ *          with ".<shard>of<Nshards>", so the shards can share the setting.
+ */
+int hmpdf_get_cov_shard(hmpdf_obj *d,
+                        int shard,
+                        int Nshards,
+                        char *fname);
+
+/*! Combines the files written by hmpdf_get_cov_shard() into the full covariance matrix.
+ *  Subsequent calls to hmpdf_get_cov() and hmpdf_get_cov_diagnostics()
+ *  use the merged result.
+ *
+ *  \param[in,out] d    hmpdf_init() must have been called on d, with the same settings
+ *                      as for the shards
+ *  \param[in] Nshards  number of files
+ *  \param[in] fnames   the files written by hmpdf_get_cov_shard()
+ *  \return error code
+ *
+ *  \remark the files can be passed in any order.
+ *  \remark an error is returned if the files do not match the settings of d,
+ *          if they were not written for the same Nshards,
+ *          if a shard is contained in more than one file,
+ *          or if some pixel separations are missing.
+ *          The settings include the contents of arrays passed as options
+ *          (e.g. #hmpdf_lcdm_params or the tabulated cosmology).
+ *  \remark an error is returned if a user-supplied function is passed
+ *          (e.g. #hmpdf_dndz), since then the files cannot be matched to the settings.
+ *  \remark only the one-point PDF is computed, so this is cheap.
+ */
+int hmpdf_merge_cov_shards(hmpdf_obj *d,
+                           int Nshards,
+                           char *fnames[Nshards]);
+
 #endif
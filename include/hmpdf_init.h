@@ -10,6 +10,7 @@
  *
  *  \param[in,out] d        created with hmpdf_new()
  *  \param[in] class_ini    path to a CLASS .ini file
+ *                          (may be NULL if #hmpdf_lcdm_params or #hmpdf_tab_z is passed)
  *  \param[in] stype        signal type (either #hmpdf_kappa or #hmpdf_tsz)
  *  \param[in] ...          variadic argument list for optional arguments
  *  \return error code
@@ -44,6 +45,13 @@
  *             cumulative (i.e. d retains no internal state between them).
  *             Thus, you need to pass all configuration options in a single call
  *             to hmpdf_init().
+ *
+ *  \remark If d has been successfully initialized before,
+ *          only those parts of the computation whose inputs changed are redone.
+ *          For example, if only halo model parameters change, CLASS is not run again.
+ *          Options passed as pointers (arrays, functions and their parameters)
+ *          are treated as changed whenever they differ from the default,
+ *          since it cannot be known whether the memory they point to was modified.
  */
 #define hmpdf_init(...) hmpdf_init_fct(__VA_ARGS__, hmpdf_end_configs)
 
@@ -36,6 +36,53 @@ int hmpdf_get_map_ps(hmpdf_obj *d,
                      double ps[Nbins],
                      int new_map);
 
+/*! Returns mean and covariance of histogram and power spectrum
+ *  over an ensemble of simplified simulations (maps).
+ *
+ *  \param[in,out] d          hmpdf_init() must have been called on d
+ *  \param[in] Nrealizations  number of maps to generate
+ *  \param[in] Nbins_op       number of bins the histogram will be binned into
+ *                            (pass 0 to skip the histogram)
+ *  \param[in] binedges_op    monotonically increasing array of length Nbins_op+1
+ *  \param[out] op_mean       the ensemble mean of the normalized histogram
+ *  \param[out] op_cov        the covariance of the histogram
+ *                            (flattened array of dimensions Nbins_op x Nbins_op,
+ *                             may be NULL)
+ *  \param[in] Nbins_ps       number of bins the power spectrum will be binned into
+ *                            (pass 0 to skip the power spectrum)
+ *  \param[in] binedges_ps    monotonically increasing array of length Nbins_ps+1
+ *  \param[out] ps_mean       the ensemble mean of the binned, direction averaged
+ *                            power spectrum
+ *  \param[out] ps_cov        the covariance of the power spectrum
+ *                            (flattened array of dimensions Nbins_ps x Nbins_ps,
+ *                             may be NULL)
+ *  \return error code
+ *
+ *  \remark all buffers and FFT plans are reused, and the statistics are
+ *          accumulated on the fly, so memory usage does not grow with Nrealizations.
+ *          The covariances are the unbiased sample estimates
+ *          (requiring Nrealizations > 1).
+ *  \remark unless #hmpdf_map_tiled is set or there are z-dependent filters,
+ *          the threads paint one map each, in the memory they use anyway,
+ *          and their statistics are merged at the end.
+ *          These maps are painted by scattering every halo,
+ *          which for (z, M) bins containing many halos with large stamps
+ *          is much slower than the convolution hmpdf_get_map() uses for them.
+ *          If any bin is expected to be painted that way, the maps are
+ *          instead generated one after another, each with all threads.
+ *  \remark afterwards, d may hold the last map of the ensemble.
+ */
+int hmpdf_get_map_ensemble(hmpdf_obj *d,
+                           int Nrealizations,
+                           int Nbins_op,
+                           double binedges_op[Nbins_op+1],
+                           double op_mean[Nbins_op],
+                           double op_cov[Nbins_op*Nbins_op],
+                           int Nbins_ps,
+                           double binedges_ps[Nbins_ps+1],
+                           double ps_mean[Nbins_ps],
+                           double ps_cov[Nbins_ps*Nbins_ps]);
+
 /*! Returns a simplified simulation (map).
  *
  *  \param[in,out] d    hmpdf_init() must have been called on d
@@ -0,0 +1,22 @@
+#ifndef LCDM_H
+#define LCDM_H
+
+#include "hmpdf.h"
+
+// analytic flat LambdaCDM backend, alternative to CLASS:
+//     fills the same tables as the CLASS interface does
+
+typedef enum//{{{
+{
+    lcdm_h,
+    lcdm_Omega_m,
+    lcdm_Omega_b,
+    lcdm_n_s,
+    lcdm_sigma_8,
+    lcdm_end, // keep this last
+}//}}}
+lcdm_params_e;
+
+int lcdm_fill_tables(hmpdf_obj *d);
+
+#endif
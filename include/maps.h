@@ -2,6 +2,9 @@
 #define MAPS_H
 
 #include <complex.h>
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
 
 #include <fftw3.h>
 
@@ -23,10 +26,33 @@ typedef struct//{{{
                   //     (same shape as buf)
     double *buf;  // buffer for a single object
 
+    double *tilebuf; // [4*MAPTILE_SIDE*MAPTILE_SIDE], tiled mode only,
+                     //     the halos around one tile, flushed under its lock
+
     gsl_rng *rng;
 }//}}}
 map_ws;
 
+typedef struct//{{{
+{
+    double *map; // not malloced, the map painted into
+    long ldmap;
+    #ifdef _OPENMP
+    omp_lock_t *locks; // [Ntiles*Ntiles], not malloced
+    #endif
+}//}}}
+map_tgt;
+
+typedef struct map_stamp_s//{{{
+{
+    long key; // index into maps_t.stamp_index
+    long bufside;
+    double *buf; // [bufside*bufside]
+    struct map_stamp_s *prev; // more recently used
+    struct map_stamp_s *next; // less recently used
+}//}}}
+map_stamp;
+
 typedef struct//{{{
 {
     double area; // in physical units (rad^2)
@@ -56,6 +82,42 @@ typedef struct//{{{
     int Nws;
     int created_map_ws;
     map_ws **ws;
+
+    // halos are painted directly into shared maps, tile by tile
+    //     (in the tiled mode, and into the concurrent redshift slices)
+    int tiled;
+    map_tgt *tgts; // [Nzslices]
+    long Ntiles; // per side
+    #ifdef _OPENMP
+    long Ntile_locks;
+    omp_lock_t *tile_locks; // [Nzslices*Ntiles*Ntiles]
+    #endif
+
+    // redshift slices processed concurrently in the z-dependent loop,
+    //     the first Nzslices workspaces are used for FFTs
+    int zslices; // requested maximum
+    int Nzslices;
+
+    // cache of the pixelized objects, on a lattice of sub-pixel offsets
+    double stamp_cache_budget; // bytes
+    size_t stamp_cache_used; // bytes
+    map_stamp **stamp_index; // [Nz*NM*MAPSTAMP_NSUB*MAPSTAMP_NSUB], NULL if not cached
+    map_stamp *stamp_lru_head; // most recently used
+    map_stamp *stamp_lru_tail; // least recently used
+
+    // (z, M) bins that are painted by FFT convolution
+    //     because they contain many halos
+    int Nconv;
+    int *conv_bins; // [Nz*NM], z_index*NM+M_index
+    unsigned *conv_N; // [Nz*NM], number of halos
+    int created_conv_buffers;
+    double *conv_counts; // [Nside*(Nside+2)], halo centers, then painted halos
+    double complex *conv_counts_comp; // not malloced
+    double *conv_stamp; // [Nside*(Nside+2)], the halo stamp
+    double complex *conv_stamp_comp; // not malloced
+    fftw_plan *p_conv_counts_r2c;
+    fftw_plan *p_conv_counts_c2r;
+    fftw_plan *p_conv_stamp_r2c;
 }//}}}
 maps_t;
 
@@ -63,6 +125,11 @@ int null_maps(hmpdf_obj *d);
 int reset_maps(hmpdf_obj *d);
 int hmpdf_get_map_op(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double op[Nbins], int new_map);
 int hmpdf_get_map_ps(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double ps[Nbins], int new_map);
+int hmpdf_get_map_ensemble(hmpdf_obj *d, int Nrealizations,
+                           int Nbins_op, double binedges_op[Nbins_op+1],
+                           double op_mean[Nbins_op], double op_cov[Nbins_op*Nbins_op],
+                           int Nbins_ps, double binedges_ps[Nbins_ps+1],
+                           double ps_mean[Nbins_ps], double ps_cov[Nbins_ps*Nbins_ps]);
 int hmpdf_get_map(hmpdf_obj *d, double **map, long *Nside, int new_map);
 
 #endif
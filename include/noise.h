@@ -26,13 +26,16 @@ typedef struct
     int Nzeta_accel;
     gsl_interp_accel **zeta_accel;
 
+    int Nconv_buffers; // length of the following arrays
     double **conv_buffer_real; // [ (Nsignal_noisy+2) * Nsignal_noisy ]
     double complex **conv_buffer_comp; // not malloced
     fftw_plan **pconv_r2c; // conv_buffer_real -> conv_buffer_comp
     fftw_plan **pconv_c2r; // conv_buffer_comp -> conv_buffer_real
 
     long len_kernel;
-    double *toepl;
+    double *kernel; // [2*len_kernel+1], discrete Gaussian
+    long kernel_halfwidth; // beyond this the kernel is negligible
+    double complex *kernel_ft; // [Nsignal_noisy/2+1], NULL if direct convolution
 }//}}}
 noise_t;
 
@@ -43,6 +46,8 @@ int init_noise(hmpdf_obj *d);
 int create_noise_matr_conv(hmpdf_obj *d, int Nbuffers);
 
 int noise_vect(hmpdf_obj *d, double *in, double *out);
+int noise_zeta(hmpdf_obj *d, double phi, double *zeta);
+int noise_matr_zeta(hmpdf_obj *d, double *in, double *out, int is_buffered, double zeta);
 int noise_matr(hmpdf_obj *d, double *in, double *out, int is_buffered, double phi);
 
 #endif
@@ -17,6 +17,9 @@ typedef struct//{{{
 
     hmpdf_dndz_f dndz;
     void *dndz_params;
+    int Ndndz;
+    hmpdf_dndz_f *dndz_list;
+    void **dndz_params_list;
 
     int NM;
     double Mmin;
@@ -53,6 +56,8 @@ typedef struct//{{{
     hmpdf_integr_mode_e Mintegr_type;
     double Mintegr_alpha;
     double Mintegr_beta;
+
+    int fftlog;
     //
 
     double zsource;
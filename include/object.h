@@ -19,12 +19,35 @@
 
 #include "hmpdf.h"
 
+// the parts of the computation performed in hmpdf_init,
+//     in the order in which they are performed,
+//     plus the one-point PDF which is computed on demand.
+// Only those whose inputs changed are recomputed in subsequent calls.
+typedef enum//{{{
+{
+    stage_numerics,
+    stage_class_interface,
+    stage_cosmology,
+    stage_power,
+    stage_halo_model,
+    stage_filters,
+    stage_bcm,
+    stage_profiles,
+    stage_noise,
+    stage_onepoint,
+    stage_end, // keep this last
+}//}}}
+stage_e;
+
 struct hmpdf_obj_s
 {//{{{
     int Ncores;
     int verbosity;
     int warn_is_err;
     int inited;
+    uint64_t stage_hash[stage_end]; // hash of the inputs to each stage
+    uint64_t settings_hash; // hash of the inputs, reproducible across processes
+    const char *settings_unhashable; // option that prevents settings_hash, NULL if none
 
     numerics_t *n;
     class_interface_t *cls;
@@ -43,6 +66,7 @@ struct hmpdf_obj_s
 };//}}}
 
 hmpdf_obj *hmpdf_new(void);
+int reset_stages(hmpdf_obj *d, int *dirty);
 int reset_obj(hmpdf_obj *d);
 int hmpdf_delete(hmpdf_obj *d);
 
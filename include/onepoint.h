@@ -3,6 +3,8 @@
 
 #include <complex.h>
 
+#include <fftw3.h>
+
 #include "hmpdf.h"
 
 typedef struct
@@ -17,6 +19,12 @@ typedef struct
 
     double signalmeanu;
     double signalmeanc;
+
+    // work space for the redshift integral, kept until the next reset
+    int Nzint_ws; // number of threads the buffers were allocated for
+    double **zint_u; // [Nzint_ws][Nsignal+2]
+    double **zint_c; // [Nzint_ws][Nsignal+2]
+    fftw_plan *p_zint_r2c; // in-place, executed on all buffers
 }//}}}
 onepoint_t;
 
@@ -11,6 +11,15 @@ typedef struct//{{{
 {
     int inited_power;
 
+    double Pk_lnkmin;
+    double Pk_lnkmax;
+    double Pk_lowlnPk; // log P at lnkmin
+    double Pk_lowslope; // d log P / d log k at lnkmin, for extrapolation
+    gsl_spline *Pk_interp; // log P(log k) on uniform log k grid
+    int NPk_accel;
+    gsl_interp_accel **Pk_accel;
+
+    int fast_ssq;
     double **ssq;
     double autocorr;
 
@@ -2,9 +2,26 @@
 #define PROFILES_H
 
 #include <gsl/gsl_interp.h>
-#include <gsl/gsl_dht.h>
 
 #include "hmpdf.h"
+#include "hankel.h"
+
+typedef enum
+{//{{{
+    dtsq_of_s,
+    t_of_s,
+}//}}}
+inv_profile_e;
+
+typedef struct
+{//{{{
+    long start; // the start index in the signal grid
+    long len;   // length of this batch
+    int incr;     // +-1 --> loop over signal grid such that
+                  //    theta is always decreasing
+    double *data; // either t_of_s or dtsq_of_s, of length len
+}//}}}
+batch_t;
 
 typedef struct//{{{
 {
@@ -17,12 +34,14 @@ typedef struct//{{{
     double rout_scale;
     int rout_def;
     int Ntheta;
+    int dndz_index; // which row of d->c->invScrit is used
     double *decr_tgrid;
     double *incr_tgrid;
     double *decr_tsqgrid;
     double *incr_tsqgrid;
     double *reci_tgrid; // reciprocal space grid
 
+    int Nincr_tgrid_accel;
     gsl_interp_accel **incr_tgrid_accel;
     gsl_interp_accel *reci_tgrid_accel;
 
@@ -37,7 +56,12 @@ typedef struct//{{{
     int created_segments;
     int ***segment_boundaries;
 
-    gsl_dht *dht_ws;
+    int created_inv_profiles;
+    double *inv_arena; // contiguous storage for all inverted profiles
+    batch_t ***inv_dtsq; // [ z_index, M_index, segment ], data points into inv_arena
+    batch_t ***inv_t; // [ z_index, M_index, segment ], data points into inv_arena
+
+    hankel *hankel_ws;
 
     hmpdf_mass_resc_f mass_resc;
     void *mass_resc_params;
@@ -54,23 +78,6 @@ typedef struct//{{{
 }//}}}
 profiles_t;
 
-typedef enum
-{//{{{
-    dtsq_of_s,
-    t_of_s,
-}//}}}
-inv_profile_e;
-
-typedef struct
-{//{{{
-    long start; // the start index in the signal grid
-    long len;   // length of this batch
-    int incr;     // +-1 --> loop over signal grid such that
-                  //    theta is always decreasing
-    double *data; // either t_of_s or dtsq_of_s, of length len
-}//}}}
-batch_t;
-
 typedef struct
 {//{{{
     int Nbatches;
@@ -78,18 +85,17 @@ typedef struct
 }//}}}
 batch_container_t;
 
-void delete_batch(batch_t *b);
-
 int null_profiles(hmpdf_obj *d);
 int reset_profiles(hmpdf_obj *d);
 int init_profiles(hmpdf_obj *d);
 int create_conj_profiles(hmpdf_obj *d);
 int create_filtered_profiles(hmpdf_obj *d);
 int create_segments(hmpdf_obj *d);
+int create_inv_profiles(hmpdf_obj *d);
 
 int s_of_t(hmpdf_obj *d, int z_index, int M_index, long Nt, double *t, double *s);
 int s_of_ell(hmpdf_obj *d, int z_index, int M_index, int Nell, double *ell, double *s);
 int inv_profile(hmpdf_obj *d, int z_index, int M_index, int segment,
-                inv_profile_e mode, batch_t *b);
+                inv_profile_e mode, batch_t *b, double *dest);
 
 #endif
@@ -5,6 +5,7 @@
 
 #include <fftw3.h>
 
+#include "configs.h"
 #include "profiles.h"
 #include "hmpdf.h"
 
@@ -23,15 +24,22 @@ typedef struct//{{{
     double *tempc_real; // [ Nsignal * Nsignal+2 ]
     double complex *tempc_comp; // not malloced
     fftw_plan pc_r2c; // tempc_real -> tempc_comp
+
+    // for the low-rank redshift compression of the clustering term
+    int zcompr_rank; // rank used in the last call
+    double *zcompr_basis[TP_ZCOMPR_MAXRANK]; // [ Nsignal * Nsignal+2 ] each, allocated with fftw_malloc
+    double *zcompr_coeff; // [ z_index, basis index ]
+    int *zcompr_deferred; // [ z_index ]
 }//}}}
 twopoint_workspace;
 
 typedef struct//{{{
 {
+    double zcompr_tol;
+
     // phi-independent quantities, to compute only once
+    //     (the inverted profiles are owned by the profiles module)
     int created_phi_indep;
-    batch_t ***dtsq; // [ z_index, M_index, segment ]
-    batch_t ***t; // [ z_index, M_index, segment ]
     double complex **ac; // [ z_index, lambda_index ]
     double complex *au; // [ lambda_index ] // allocated with fftw_malloc
     
@@ -46,6 +54,7 @@ typedef struct//{{{
 twopoint_t;
 
 int new_tp_ws(long N, twopoint_workspace **out);
+void delete_tp_ws(twopoint_workspace *ws);
 
 int null_twopoint(hmpdf_obj *d);
 int reset_twopoint(hmpdf_obj *d);
@@ -0,0 +1,83 @@
+#ifndef TWOPOINT_KERNELS_H
+#define TWOPOINT_KERNELS_H
+
+// inner kernels of tp_segmentsum (twopoint.c),
+//     in a header of their own so examples/tp_kernel_bench.c
+//     times the same code as the library
+
+#include <math.h>
+
+static inline long
+tp_band_lo(long len, const double *t2, double t1, double phi)
+// first index jj such that a triangle (phi, t1, t2[jj]) is not excluded
+//     by t2 being too large
+// t2 is monotonically decreasing
+{//{{{
+    long lo = 0, hi = len;
+    while (lo < hi)
+    {
+        long mid = (lo + hi) / 2;
+        if (t2[mid] >= phi + t1) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    return lo;
+}//}}}
+
+static inline long
+tp_band_hi(long len, const double *t2, double t1, double phi)
+// first index jj such that no triangle (phi, t1, t2[kk]) can be formed
+//     for any kk >= jj, because t2 is too small
+// t2 is monotonically decreasing
+{//{{{
+    long lo = 0, hi = len;
+    while (lo < hi)
+    {
+        long mid = (lo + hi) / 2;
+        if ((t1 >= t2[mid] + phi) || (phi >= t1 + t2[mid])) { hi = mid; }
+        else { lo = mid + 1; }
+    }
+    return lo;
+}//}}}
+
+static inline void
+tp_band(long len, double phi, double t1, double wc, double wu,
+        const double *restrict t2, const double *restrict dtsq2,
+        double *restrict outc, double *restrict outu)
+// adds the contributions from the contiguous band of valid triangles,
+//     outc, outu are laid out in the same order as t2, dtsq2
+// the inverse triangle area is computed by Heron's formula
+{//{{{
+    #ifdef _OPENMP
+    #   pragma omp simd
+    #endif
+    for (long jj=0; jj<len; jj++)
+    {
+        double s = 0.5 * (phi + t1 + t2[jj]);
+        double Delta = 1.0 / sqrt(s * (s-phi) * (s-t1) * (s-t2[jj]));
+        double temp = Delta * dtsq2[jj];
+        outc[jj] += temp * wc;
+        outu[jj] += temp * wu;
+    }
+}//}}}
+
+static inline void
+tp_band_reversed(long len, double phi, double t1, double wc, double wu,
+                 const double *restrict t2, const double *restrict dtsq2,
+                 double *restrict outc, double *restrict outu)
+// same as tp_band, but outc, outu are laid out in reversed order
+//     (they point to the element corresponding to t2[0])
+{//{{{
+    #ifdef _OPENMP
+    #   pragma omp simd
+    #endif
+    for (long jj=0; jj<len; jj++)
+    {
+        double s = 0.5 * (phi + t1 + t2[jj]);
+        double Delta = 1.0 / sqrt(s * (s-phi) * (s-t1) * (s-t2[jj]));
+        double temp = Delta * dtsq2[jj];
+        outc[-jj] += temp * wc;
+        outu[-jj] += temp * wu;
+    }
+}//}}}
+
+#endif
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <complex.h>
@@ -374,6 +375,19 @@ new_gsl_error_handler(const char *reason, const char *file,
 #endif
 //}}}
 
+//RETURN_IF_ERR -- no semicolon!{{{
+// to be used after parallel regions containing CONTINUE_IF_ERR
+#ifdef DEBUG
+#   define RETURN_IF_ERR            \
+        if (UNLIKELY(hmpdf_status)) \
+        {                           \
+            return hmpdf_status;    \
+        }
+#else
+#   define RETURN_IF_ERR
+#endif
+//}}}
+
 // UNUSED{{{
 #ifdef __GNUC__
 #   define UNUSED(x) x##_UNUSED __attribute__((unused))
@@ -444,6 +458,11 @@ void reverse(int N, double *in, double *out);
 int not_monotonic(int N, double *x, int sgn);
 int all_zero(int N, double *x, double threshold);
 
+#define HASH_INIT     0xcbf29ce484222325ULL
+#define HASH_DBL_BITS 40
+uint64_t hash_bytes(uint64_t h, size_t len, const void *data);
+uint64_t hash_doubles(uint64_t h, long N, const double *x);
+
 #define WAVENR(N, grid, idx) \
     (idx <= N/2) ? grid[idx] : -grid[N-idx]
 
@@ -484,6 +503,7 @@ const gsl_interp_type *interp1d_type(interp_mode m);
 int new_interp1d(int N, double *x, double *y,
                  double ylo, double yhi,
                  interp_mode m, gsl_interp_accel *a, interp1d **out);
+int interp1d_reinit(interp1d *interp, double ylo, double yhi);
 void delete_interp1d(interp1d *interp);
 int interp1d_eval(interp1d *interp, double x, double *out);
 int interp1d_eval1(interp1d *interp, double x, int *inrange, double *out);
@@ -49,7 +49,7 @@ reset_bcm(hmpdf_obj *d)
     if (d->bcm->radii != NULL) { free(d->bcm->radii); }
     if (d->bcm->ws != NULL)
     {
-        for (int ii=0; ii<d->Ncores; ii++)
+        for (int ii=0; ii<d->bcm->Nws; ii++)
         {
             bcm_delete_ws(d->bcm->ws[ii]);
             free(d->bcm->ws[ii]);
@@ -89,8 +89,9 @@ init_bcm(hmpdf_obj *d)
     for (d->bcm->R200c_idx=0; d->bcm->radii[d->bcm->R200c_idx]<1.0; d->bcm->R200c_idx++);
 
     // allocate the workspaces
-    SAFEALLOC(d->bcm->ws, malloc(d->Ncores * sizeof(bcm_ws *)));
-    for (int ii=0; ii<d->Ncores; ii++)
+    d->bcm->Nws = d->Ncores;
+    SAFEALLOC(d->bcm->ws, malloc(d->bcm->Nws * sizeof(bcm_ws *)));
+    for (int ii=0; ii<d->bcm->Nws; ii++)
     {
         SAFEALLOC(d->bcm->ws[ii], malloc(sizeof(bcm_ws)));
         SAFEHMPDF(bcm_new_ws(d, d->bcm->ws[ii]));
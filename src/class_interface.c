@@ -1,12 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <class.h>
 
+#include <gsl/gsl_spline.h>
+
+#include "configs.h"
 #include "utils.h"
 #include "object.h"
 #include "class_interface.h"
+#include "lcdm.h"
 
 #include "hmpdf.h"
 
@@ -30,6 +35,26 @@ alloc_class(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
+static int
+null_class_structs(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    d->cls->pr = NULL;
+    d->cls->ba = NULL;
+    d->cls->th = NULL;
+    d->cls->pt = NULL;
+    d->cls->pm = NULL;
+    d->cls->nl = NULL;
+    d->cls->sp = NULL;
+    d->cls->le = NULL;
+    d->cls->tr = NULL;
+    d->cls->sd = NULL;
+    d->cls->op = NULL;
+
+    ENDFCT
+}//}}}
+
 static int
 run_class(hmpdf_obj *d)
 {//{{{
@@ -82,74 +107,158 @@ run_class(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
-int
-init_class_interface(hmpdf_obj *d)
+static int
+alloc_tables(hmpdf_obj *d)
 {//{{{
     STARTFCT
 
-    HMPDFPRINT(2, "\tinit_class_interface\n");
-
-    char **argv;
-    SAFEALLOC(argv, malloc(3 * sizeof(char *)));
-    argv[1] = d->cls->class_ini;
-    argv[2] = d->cls->class_pre;
+    SAFEALLOC(d->cls->bg_lnzp1, malloc(d->cls->Nbg * sizeof(double)));
+    for (int qq=0; qq<bg_end; qq++)
+    {
+        SAFEALLOC(d->cls->bg[qq], malloc(d->cls->Nbg * sizeof(double)));
+    }
+    SAFEALLOC(d->cls->Pk_lnk,  malloc(d->cls->NPk * sizeof(double)));
+    SAFEALLOC(d->cls->Pk_lnPk, malloc(d->cls->NPk * sizeof(double)));
 
-    int argc = (strcmp(argv[2], "none")) ? 3 : 2;
+    ENDFCT
+}//}}}
 
-    SAFEHMPDF(alloc_class(d));
+static int
+class_bg_at_z(hmpdf_obj *d, double z, int *index, double *pvecback, double out[bg_end])
+// evaluates CLASS, pvecback is a buffer of length ba->bg_size
+{//{{{
+    STARTFCT
 
-    struct precision *pr = (struct precision *)d->cls->pr;
     struct background *ba = (struct background *)d->cls->ba;
-    struct thermodynamics *th = (struct thermodynamics *)d->cls->th;
-    struct perturbations *pt = (struct perturbations *)d->cls->pt;
-    struct primordial *pm = (struct primordial *)d->cls->pm;
-    struct fourier *nl = (struct fourier *)d->cls->nl;
-    struct harmonic *sp = (struct harmonic *)d->cls->sp;
-    struct lensing *le = (struct lensing *)d->cls->le;
-    struct output *op = (struct output *)d->cls->op;
-    struct transfer *tr = (struct transfer *)d->cls->tr;
-    struct distortions *sd = (struct distortions *)d->cls->sd;
 
-    ErrorMsg errmsg;
-    SAFECLASS(input_init(argc, argv, pr, ba, th,
-                         pt, tr, pm, sp,
-                         nl, le, sd, op ,errmsg),
-              errmsg);
+    double tau; // conformal time in Mpc
+    SAFECLASS(background_tau_of_z(ba, z, &tau),
+              ba->error_message);
+    SAFECLASS(background_at_tau(ba, tau, long_info,
+                                inter_normal, index, pvecback),
+              ba->error_message);
+    out[bg_H] = pvecback[ba->index_bg_H];
+    out[bg_comoving] = pvecback[ba->index_bg_conf_distance];
+    out[bg_angular_diameter] = pvecback[ba->index_bg_ang_distance];
+    out[bg_D] = pvecback[ba->index_bg_D];
+    out[bg_Om] = pvecback[ba->index_bg_Omega_m];
 
-    SAFEHMPDF(run_class(d));
+    ENDFCT
+}//}}}
 
-    free(argv);
+#ifdef DEBUG
+static int
+check_bg_tables(hmpdf_obj *d, double *pvecback)
+// compares the interpolated background with CLASS half-way between the nodes,
+//     where the interpolation error is largest
+{//{{{
+    STARTFCT
+
+    gsl_spline *s[bg_end];
+    SETARRNULL(s, bg_end);
+    for (int qq=0; qq<bg_end; qq++)
+    {
+        SAFEALLOC(s[qq], gsl_spline_alloc(interp1d_type(CLASSBG_INTERP_TYPE), d->cls->Nbg));
+        SAFEGSL(gsl_spline_init(s[qq], d->cls->bg_lnzp1, d->cls->bg[qq], d->cls->Nbg));
+    }
+
+    int index = 0;
+    double maxdiff = 0.0, zmaxdiff = 0.0;
+    for (int ii=0; ii<d->cls->Nbg-1; ii++)
+    {
+        double lnzp1 = 0.5 * (d->cls->bg_lnzp1[ii] + d->cls->bg_lnzp1[ii+1]);
+        double exact[bg_end];
+        SAFEHMPDF(class_bg_at_z(d, expm1(lnzp1), &index, pvecback, exact));
+        for (int qq=0; qq<bg_end; qq++)
+        {
+            double interp;
+            SAFEGSL(gsl_spline_eval_e(s[qq], lnzp1, NULL, &interp));
+            double diff = fabs(interp/exact[qq] - 1.0);
+            if (diff > maxdiff)
+            {
+                maxdiff = diff;
+                zmaxdiff = expm1(lnzp1);
+            }
+        }
+    }
+
+    for (int qq=0; qq<bg_end; qq++)
+    {
+        gsl_spline_free(s[qq]);
+    }
+
+    HMPDFPRINT(3, "\t\tbackground interpolation accurate to %.1e\n", maxdiff);
+    if (maxdiff > CLASSBG_CHECK_TOL)
+    {
+        HMPDFWARN("interpolated background deviates from CLASS by %.1e at z = %g.",
+                  maxdiff, zmaxdiff);
+    }
 
     ENDFCT
 }//}}}
+#endif
 
-int
-null_class_interface(hmpdf_obj *d)
+static int
+fill_tables(hmpdf_obj *d)
+// extracts the quantities we need from the CLASS structs
 {//{{{
     STARTFCT
 
-    d->cls->pr = NULL;
-    d->cls->ba = NULL;
-    d->cls->th = NULL;
-    d->cls->pt = NULL;
-    d->cls->pm = NULL;
-    d->cls->nl = NULL;
-    d->cls->sp = NULL;
-    d->cls->le = NULL;
-    d->cls->tr = NULL;
-    d->cls->sd = NULL;
-    d->cls->op = NULL;
+    HMPDFPRINT(2, "\tfill_class_tables\n");
+
+    struct background *ba = (struct background *)d->cls->ba;
+    struct primordial *pm = (struct primordial *)d->cls->pm;
+    struct fourier *nl = (struct fourier *)d->cls->nl;
+
+    d->cls->h = ba->h;
+    d->cls->H0 = ba->H0;
+    d->cls->Omega0_m = ba->Omega0_m;
+    d->cls->Omega0_b = ba->Omega0_b;
+
+    double *pvecback;
+    SAFEALLOC(pvecback, malloc(ba->bg_size * sizeof(double)));
+    int index = 0; // some internal CLASS thing
+    linspace(d->cls->Nbg, 0.0, log1p(CLASSBG_ZMAX), d->cls->bg_lnzp1);
+    for (int ii=0; ii<d->cls->Nbg; ii++)
+    {
+        double out[bg_end];
+        SAFEHMPDF(class_bg_at_z(d, expm1(d->cls->bg_lnzp1[ii]), &index, pvecback, out));
+        for (int qq=0; qq<bg_end; qq++)
+        {
+            d->cls->bg[qq][ii] = out[qq];
+        }
+    }
+
+    // the tables replace CLASS in all later computations
+    #ifdef DEBUG
+    SAFEHMPDF(check_bg_tables(d, pvecback));
+    #endif
+    free(pvecback);
+
+    // the upper end is where the CLASS interpolator ends
+    linspace(d->cls->NPk, log(PKINTERP_KMIN), nl->ln_k[nl->k_size-1],
+             d->cls->Pk_lnk);
+    for (int ii=0; ii<d->cls->NPk; ii++)
+    {
+        double Pk;
+        SAFECLASS(fourier_pk_at_k_and_z(ba, pm, nl,
+                                        pk_linear, exp(d->cls->Pk_lnk[ii]), 0.0,
+                                        nl->index_pk_total,
+                                        &Pk, NULL),
+                  nl->error_message);
+        HMPDFCHECK(Pk <= 0.0, "non-positive linear power spectrum at k = %g.",
+                   exp(d->cls->Pk_lnk[ii]));
+        d->cls->Pk_lnPk[ii] = log(Pk);
+    }
 
     ENDFCT
 }//}}}
 
-int
-reset_class_interface(hmpdf_obj *d)
+static int
+free_class(hmpdf_obj *d)
 {//{{{
     STARTFCT
 
-    HMPDFPRINT(2, "\treset_class_interface\n");
-
     struct fourier *nl;
     struct perturbations *pt;
     struct primordial *pm;
@@ -197,5 +306,369 @@ reset_class_interface(hmpdf_obj *d)
         free(d->cls->ba); }
     if (d->cls->pr != NULL) { free(d->cls->pr); }
 
+    SAFEHMPDF(null_class_structs(d));
+
+    ENDFCT
+}//}}}
+
+static int
+hash_file(char *fname, uint64_t *h)
+{//{{{
+    STARTFCT
+
+    FILE *f = fopen(fname, "rb");
+    HMPDFCHECK(f == NULL, "could not open %s.", fname);
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof buf, f)) > 0)
+    {
+        *h = hash_bytes(*h, len, buf);
+    }
+    fclose(f);
+
+    ENDFCT
+}//}}}
+
+int
+class_inputs_hash(hmpdf_obj *d, uint64_t *h)
+// hashes the contents of the CLASS .ini and precision files
+{//{{{
+    STARTFCT
+
+    // the other backends' inputs are hashed as normal options
+    if (d->cls->lcdm_params != NULL || d->cls->tab_z != NULL)
+    {
+        return 0;
+    }
+
+    SAFEHMPDF(hash_file(d->cls->class_ini, h));
+    if (strcmp(d->cls->class_pre, "none"))
+    {
+        SAFEHMPDF(hash_file(d->cls->class_pre, h));
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+class_cache_fname(hmpdf_obj *d, char **fname)
+// the cache file name contains the hash of the CLASS inputs
+//     and the table layout
+{//{{{
+    STARTFCT
+
+    uint64_t h = HASH_INIT;
+    SAFEHMPDF(class_inputs_hash(d, &h));
+    int N[] = { d->cls->Nbg, d->cls->NPk, };
+    double x[] = { CLASSBG_ZMAX, PKINTERP_KMIN, };
+    h = hash_bytes(h, sizeof N, N);
+    h = hash_doubles(h, sizeof x / sizeof(double), x);
+
+    SAFEALLOC(*fname, malloc(strlen(d->cls->class_cache) + 64));
+    sprintf(*fname, "%s/hmpdf_class_%016llx.bin",
+            d->cls->class_cache, (unsigned long long)h);
+
+    ENDFCT
+}//}}}
+
+static int
+read_class_cache(hmpdf_obj *d, char *fname, int *ok)
+// ok = 1 if tables were filled from the cache file
+{//{{{
+    STARTFCT
+
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL)
+    {
+        *ok = 0;
+        return 0;
+    }
+
+    char magic[sizeof CLASS_CACHE_MAGIC];
+    *ok = fread(magic, 1, sizeof magic, f) == sizeof magic
+          && memcmp(magic, CLASS_CACHE_MAGIC, sizeof magic) == 0
+          && fread(&d->cls->h, sizeof(double), 1, f) == 1
+          && fread(&d->cls->H0, sizeof(double), 1, f) == 1
+          && fread(&d->cls->Omega0_m, sizeof(double), 1, f) == 1
+          && fread(&d->cls->Omega0_b, sizeof(double), 1, f) == 1
+          && fread(d->cls->bg_lnzp1, sizeof(double), d->cls->Nbg, f) == (size_t)d->cls->Nbg;
+    for (int qq=0; qq<bg_end; qq++)
+    {
+        *ok = *ok
+              && fread(d->cls->bg[qq], sizeof(double), d->cls->Nbg, f) == (size_t)d->cls->Nbg;
+    }
+    *ok = *ok
+          && fread(d->cls->Pk_lnk, sizeof(double), d->cls->NPk, f) == (size_t)d->cls->NPk
+          && fread(d->cls->Pk_lnPk, sizeof(double), d->cls->NPk, f) == (size_t)d->cls->NPk;
+    fclose(f);
+
+    if (!*ok)
+    {
+        HMPDFPRINT(1, "\tCLASS cache file %s is corrupted, ignoring it\n", fname);
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+write_class_cache(hmpdf_obj *d, char *fname)
+{//{{{
+    STARTFCT
+
+    char *tmp_fname;
+    SAFEALLOC(tmp_fname, malloc(strlen(fname) + 5));
+    sprintf(tmp_fname, "%s.tmp", fname);
+
+    int ok = 0;
+    FILE *f = fopen(tmp_fname, "wb");
+    if (f != NULL)
+    {
+        ok = fwrite(CLASS_CACHE_MAGIC, 1, sizeof CLASS_CACHE_MAGIC, f)
+             == sizeof CLASS_CACHE_MAGIC
+             && fwrite(&d->cls->h, sizeof(double), 1, f) == 1
+             && fwrite(&d->cls->H0, sizeof(double), 1, f) == 1
+             && fwrite(&d->cls->Omega0_m, sizeof(double), 1, f) == 1
+             && fwrite(&d->cls->Omega0_b, sizeof(double), 1, f) == 1
+             && fwrite(d->cls->bg_lnzp1, sizeof(double), d->cls->Nbg, f) == (size_t)d->cls->Nbg;
+        for (int qq=0; qq<bg_end; qq++)
+        {
+            ok = ok
+                 && fwrite(d->cls->bg[qq], sizeof(double), d->cls->Nbg, f) == (size_t)d->cls->Nbg;
+        }
+        ok = ok
+             && fwrite(d->cls->Pk_lnk, sizeof(double), d->cls->NPk, f) == (size_t)d->cls->NPk
+             && fwrite(d->cls->Pk_lnPk, sizeof(double), d->cls->NPk, f) == (size_t)d->cls->NPk;
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && (rename(tmp_fname, fname) == 0);
+    }
+
+    // failure to write the cache should not abort the computation
+    if (!ok)
+    {
+        HMPDFPRINT(1, "\tcould not write CLASS cache file %s\n", fname);
+    }
+    free(tmp_fname);
+
+    ENDFCT
+}//}}}
+
+static int
+copy_user_tables(hmpdf_obj *d)
+// fills the tables from the user-supplied arrays
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(2, "\tcopy_user_tables\n");
+
+    HMPDFCHECK(d->cls->tab_z[0] != 0.0,
+               "hmpdf_tab_z must start at z = 0.");
+    HMPDFCHECK(not_monotonic(d->cls->tab_Nz, d->cls->tab_z, 1),
+               "hmpdf_tab_z must be monotonically increasing.");
+    HMPDFCHECK(not_monotonic(d->cls->tab_Nk, d->cls->tab_k, 1),
+               "hmpdf_tab_k must be monotonically increasing.");
+
+    for (int ii=0; ii<d->cls->Nbg; ii++)
+    {
+        d->cls->bg_lnzp1[ii] = log1p(d->cls->tab_z[ii]);
+        HMPDFCHECK(d->cls->tab_Dsq[ii] <= 0.0,
+                   "non-positive growth factor at z = %g.", d->cls->tab_z[ii]);
+        d->cls->bg[bg_D][ii] = sqrt(d->cls->tab_Dsq[ii]);
+    }
+    memcpy(d->cls->bg[bg_H], d->cls->tab_H, d->cls->Nbg * sizeof(double));
+    memcpy(d->cls->bg[bg_comoving], d->cls->tab_comoving,
+           d->cls->Nbg * sizeof(double));
+    memcpy(d->cls->bg[bg_angular_diameter], d->cls->tab_angular_diameter,
+           d->cls->Nbg * sizeof(double));
+    memcpy(d->cls->bg[bg_Om], d->cls->tab_Om, d->cls->Nbg * sizeof(double));
+
+    for (int ii=0; ii<d->cls->NPk; ii++)
+    {
+        HMPDFCHECK(d->cls->tab_Pk[ii] <= 0.0,
+                   "non-positive linear power spectrum at k = %g.", d->cls->tab_k[ii]);
+        d->cls->Pk_lnk[ii] = log(d->cls->tab_k[ii]);
+        d->cls->Pk_lnPk[ii] = log(d->cls->tab_Pk[ii]);
+    }
+
+    // z=0 numbers
+    d->cls->H0 = d->cls->tab_H[0];
+    d->cls->h = d->cls->H0 * SPEEDOFLIGHT;
+    d->cls->Omega0_m = d->cls->tab_Om[0];
+    d->cls->Omega0_b = d->cls->tab_Omega_b;
+
+    ENDFCT
+}//}}}
+
+static int
+create_bg_interp(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    for (int qq=0; qq<bg_end; qq++)
+    {
+        SAFEALLOC(d->cls->bg_interp[qq],
+                  gsl_spline_alloc(interp1d_type(CLASSBG_INTERP_TYPE), d->cls->Nbg));
+        SAFEGSL(gsl_spline_init(d->cls->bg_interp[qq], d->cls->bg_lnzp1,
+                                d->cls->bg[qq], d->cls->Nbg));
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+run_class_full(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    char **argv;
+    SAFEALLOC(argv, malloc(3 * sizeof(char *)));
+    argv[1] = d->cls->class_ini;
+    argv[2] = d->cls->class_pre;
+
+    int argc = (strcmp(argv[2], "none")) ? 3 : 2;
+
+    SAFEHMPDF(alloc_class(d));
+
+    struct precision *pr = (struct precision *)d->cls->pr;
+    struct background *ba = (struct background *)d->cls->ba;
+    struct thermodynamics *th = (struct thermodynamics *)d->cls->th;
+    struct perturbations *pt = (struct perturbations *)d->cls->pt;
+    struct primordial *pm = (struct primordial *)d->cls->pm;
+    struct fourier *nl = (struct fourier *)d->cls->nl;
+    struct harmonic *sp = (struct harmonic *)d->cls->sp;
+    struct lensing *le = (struct lensing *)d->cls->le;
+    struct output *op = (struct output *)d->cls->op;
+    struct transfer *tr = (struct transfer *)d->cls->tr;
+    struct distortions *sd = (struct distortions *)d->cls->sd;
+
+    ErrorMsg errmsg;
+    SAFECLASS(input_init(argc, argv, pr, ba, th,
+                         pt, tr, pm, sp,
+                         nl, le, sd, op ,errmsg),
+              errmsg);
+
+    SAFEHMPDF(run_class(d));
+
+    free(argv);
+
+    SAFEHMPDF(fill_tables(d));
+
+    // we don't need CLASS anymore
+    SAFEHMPDF(free_class(d));
+
+    ENDFCT
+}//}}}
+
+int
+background_at_z(hmpdf_obj *d, double z, bg_quantity_e q, double *out)
+{//{{{
+    STARTFCT
+
+    HMPDFCHECK(z < 0.0 || z > expm1(d->cls->bg_lnzp1[d->cls->Nbg-1]),
+               "z = %g out of background interpolation range.", z);
+
+    // not using an accelerator, so this is thread safe
+    SAFEGSL(gsl_spline_eval_e(d->cls->bg_interp[q], log1p(z), NULL, out));
+
+    ENDFCT
+}//}}}
+
+int
+init_class_interface(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(2, "\tinit_class_interface\n");
+
+    if (d->cls->tab_z != NULL)
+    {
+        d->cls->Nbg = d->cls->tab_Nz;
+        d->cls->NPk = d->cls->tab_Nk;
+    }
+    else
+    {
+        d->cls->Nbg = CLASSBG_NZ;
+        d->cls->NPk = PKINTERP_NK;
+    }
+
+    SAFEHMPDF(alloc_tables(d));
+
+    if (d->cls->tab_z != NULL)
+    {
+        SAFEHMPDF(copy_user_tables(d));
+        SAFEHMPDF(create_bg_interp(d));
+        return 0;
+    }
+
+    if (d->cls->lcdm_params != NULL)
+    {
+        SAFEHMPDF(lcdm_fill_tables(d));
+        SAFEHMPDF(create_bg_interp(d));
+        return 0;
+    }
+
+    int from_cache = 0;
+    char *cache_fname = NULL;
+    if (strcmp(d->cls->class_cache, "none"))
+    {
+        SAFEHMPDF(class_cache_fname(d, &cache_fname));
+        SAFEHMPDF(read_class_cache(d, cache_fname, &from_cache));
+        if (from_cache)
+        {
+            HMPDFPRINT(2, "\t\tloaded CLASS output from %s\n", cache_fname);
+        }
+    }
+
+    if (!from_cache)
+    {
+        SAFEHMPDF(run_class_full(d));
+        if (cache_fname != NULL)
+        {
+            HMPDFPRINT(2, "\t\twriting CLASS output to %s\n", cache_fname);
+            SAFEHMPDF(write_class_cache(d, cache_fname));
+        }
+    }
+
+    if (cache_fname != NULL) { free(cache_fname); }
+
+    SAFEHMPDF(create_bg_interp(d));
+
+    ENDFCT
+}//}}}
+
+int
+null_class_interface(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    SAFEHMPDF(null_class_structs(d));
+
+    d->cls->bg_lnzp1 = NULL;
+    SETARRNULL(d->cls->bg, bg_end);
+    SETARRNULL(d->cls->bg_interp, bg_end);
+    d->cls->Pk_lnk = NULL;
+    d->cls->Pk_lnPk = NULL;
+
+    ENDFCT
+}//}}}
+
+int
+reset_class_interface(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(2, "\treset_class_interface\n");
+
+    // only non-trivial if an error occurred during the CLASS run
+    SAFEHMPDF(free_class(d));
+
+    if (d->cls->bg_lnzp1 != NULL) { free(d->cls->bg_lnzp1); }
+    for (int qq=0; qq<bg_end; qq++)
+    {
+        if (d->cls->bg[qq] != NULL) { free(d->cls->bg[qq]); }
+        if (d->cls->bg_interp[qq] != NULL) { gsl_spline_free(d->cls->bg_interp[qq]); }
+    }
+    if (d->cls->Pk_lnk != NULL) { free(d->cls->Pk_lnk); }
+    if (d->cls->Pk_lnPk != NULL) { free(d->cls->Pk_lnPk); }
+
     ENDFCT
 }//}}}
@@ -28,6 +28,7 @@ struct DEFAULTS def = { .Ncores={1,1,1000}, .verbosity=0, .warn_is_err=1,
                         .class_pre="none",
                         .Npoints_z={65,10,1000}, .z_min={0.0,0.0,6.0}, .z_max={6.0,0.1,10.0},
                         .dndz=NULL, .dndz_params=NULL,
+                        .Ndndz=0, .dndz_list=NULL, .dndz_params_list=NULL, .dndz_index=0,
                         .Npoints_M={65,10,1000}, .M_min={1e11,1e7,1e14}, .M_max={1e16,1e13,1e19},
                         .Npoints_signal={1024UL,32UL,10000UL},
                         .min_kappa={0.0,-10.0,0.0}, .min_tsz={0.0, -1e-2, 0.0},
@@ -61,7 +62,16 @@ struct DEFAULTS def = { .Ncores={1,1,1000}, .verbosity=0, .warn_is_err=1,
                         .Tinker10_p=def_Tinker10_hmf_params,
                         .Battaglia12_p=def_Battaglia12_tsz_params,
                         .noise_pwr=NULL, .noise_pwr_params=NULL,
-                        .fsky={-1.0,0.0,1.0}, .pxlgrid={3,1,20}, .mappoisson=1, .mapseed=INT_MAX};
+                        .fsky={-1.0,0.0,1.0}, .pxlgrid={3,1,20}, .mappoisson=1, .mapseed=INT_MAX,
+                        .tp_zcompr_tol={0.0,0.0,1e-1},
+                        .cov_checkpoint="none", .cov_checkpoint_period={600,0,1000000},
+                        .cov_timings="none", .cov_noise_zeta_tol={0.0,0.0,1.0},
+                        .fftlog=0, .fast_ssq=0, .class_cache="none",
+                        .lcdm_params=NULL,
+                        .tab_Nz=0, .tab_z=NULL, .tab_H=NULL, .tab_comoving=NULL,
+                        .tab_angular_diameter=NULL, .tab_Dsq=NULL, .tab_Om=NULL,
+                        .tab_Nk=0, .tab_k=NULL, .tab_Pk=NULL, .tab_Omega_b=-1.0,
+                        .map_tiled=0, .map_stamp_cache=0.0, .map_zslices=1};
 
 // The following is only needed for more reliable interaction
 //     with the python wrapper
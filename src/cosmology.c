@@ -2,10 +2,10 @@
 #include <stdlib.h>
 #include <math.h>
 
-#include <class.h>
-
 #include <gsl/gsl_math.h>
-#include <gsl/gsl_integration.h>
+#ifdef DEBUG
+#   include <gsl/gsl_integration.h>
+#endif
 
 #include "utils.h"
 #include "object.h"
@@ -22,6 +22,7 @@ null_cosmology(hmpdf_obj *d)
     d->c->hubble = NULL;
     d->c->comoving = NULL;
     d->c->angular_diameter = NULL;
+    d->c->Nsrc = 0;
     d->c->invScrit = NULL;
     d->c->Dsq = NULL;
     d->c->rho_m = NULL;
@@ -67,54 +68,169 @@ alloc_cosmo(hmpdf_obj *d)
 
     if (d->p->stype == hmpdf_kappa)
     {
-        SAFEALLOC(d->c->invScrit, malloc(d->n->Nz * sizeof(double)));
+        d->c->Nsrc = (d->n->Ndndz > 0) ? d->n->Ndndz : 1;
+        SAFEALLOC(d->c->invScrit, malloc(d->c->Nsrc * d->n->Nz * sizeof(double)));
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+lensing_efficiency(hmpdf_obj *d, int Nsrc,
+                   hmpdf_dndz_f *dndz, void **dndz_params, double *out)
+// out[ss*Nz+z_index] = \int_z^zsource dz' (1 - chi(z)/chi(z')) n_ss(z')
+//                      / \int_0^zsource dz' n_ss(z') ,
+// for Nsrc source distributions at once (dndz_params may be NULL).
+// Writing the integral as A(z) - chi(z) B(z), with
+//     A(z) = \int_z^zsource dz' n(z') and B(z) = \int_z^zsource dz' n(z')/chi(z') ,
+// both are accumulated in a single reverse pass on a fine grid
+// (Simpson on each interval), the result is interpolated onto the z-grid.
+// The comoving distances on the fine grid are shared by all distributions.
+{//{{{
+    STARTFCT
+
+    int N = DNDZ_NZ;
+    double dz = d->n->zsource / (double)(N-1);
+
+    // fine grid including interval midpoints
+    double *z, *chi, *n;
+    SAFEALLOC(z,   malloc((2*N-1) * sizeof(double)));
+    SAFEALLOC(chi, malloc((2*N-1) * sizeof(double)));
+    SAFEALLOC(n,   malloc(Nsrc * (2*N-1) * sizeof(double)));
+    for (int ii=0; ii<2*N-1; ii++)
+    {
+        z[ii] = 0.5 * dz * (double)(ii);
+        SAFEHMPDF(background_at_z(d, z[ii], bg_comoving, chi+ii));
+        for (int ss=0; ss<Nsrc; ss++)
+        {
+            n[ss*(2*N-1)+ii] = dndz[ss](z[ii], (dndz_params==NULL) ? NULL : dndz_params[ss]);
+        }
+    }
+
+    double *zfine, *eff, *A, *B;
+    SAFEALLOC(zfine, malloc(N * sizeof(double)));
+    SAFEALLOC(eff,   malloc(Nsrc * N * sizeof(double)));
+    SAFEALLOC(A,     calloc(Nsrc, sizeof(double)));
+    SAFEALLOC(B,     calloc(Nsrc, sizeof(double)));
+    for (int ii=0; ii<N; ii++)
+    {
+        zfine[ii] = z[2*ii];
+    }
+
+    // chi = 0 at z = 0, but there B is multiplied by zero anyways
+    #define NOVERCHI(ii) ((chi[ii] > 0.0) ? this_n[ii]/chi[ii] : 0.0)
+    for (int ss=0; ss<Nsrc; ss++)
+    {
+        eff[ss*N+N-1] = 0.0;
+    }
+    for (int ii=N-2; ii>=0; ii--)
+    {
+        for (int ss=0; ss<Nsrc; ss++)
+        {
+            double *this_n = n + ss*(2*N-1);
+            A[ss] += dz / 6.0 * (this_n[2*ii] + 4.0*this_n[2*ii+1] + this_n[2*ii+2]);
+            B[ss] += dz / 6.0 * (NOVERCHI(2*ii) + 4.0*NOVERCHI(2*ii+1) + NOVERCHI(2*ii+2));
+            eff[ss*N+ii] = A[ss] - chi[2*ii] * B[ss];
+        }
+    }
+    #undef NOVERCHI
+
+    for (int ss=0; ss<Nsrc; ss++)
+    {
+        HMPDFCHECK(A[ss] <= 0.0,
+                   "source distribution %d has non-positive normalization.", ss);
+
+        interp1d *interp;
+        SAFEHMPDF(new_interp1d(N, zfine, eff+ss*N, eff[ss*N], 0.0,
+                               DNDZ_INTERP_TYPE, NULL, &interp));
+        for (int z_index=0; z_index<d->n->Nz; z_index++)
+        {
+            double *this_out = out + ss*d->n->Nz + z_index;
+            SAFEHMPDF(interp1d_eval(interp, d->n->zgrid[z_index], this_out));
+            *this_out /= A[ss];
+        }
+        delete_interp1d(interp);
     }
 
+    free(z);
+    free(chi);
+    free(n);
+    free(zfine);
+    free(eff);
+    free(A);
+    free(B);
+
     ENDFCT
 }//}}}
 
+#ifdef DEBUG
 typedef struct
 {
-    // CLASS stuff
-    double *pvecback;
-    struct background *ba;
-    int index;
-
+    hmpdf_obj *d;
     hmpdf_dndz_f dndz;
     void *dndz_params;
-
     double chi_z;
-
     int status;
 } dndz_integr_params;
 
-static inline int
-dndz_integr_kernel(double z, dndz_integr_params *p, double *out)
-{
+static double
+dndz_integr_f(double z, void *params)
+{//{{{
+    dndz_integr_params *p = (dndz_integr_params *)params;
+    hmpdf_obj *d = p->d;
+
+    double chi_this_z = 0.0; // to avoid maybe-uninitialized
+    p->status = background_at_z(d, z, bg_comoving, &chi_this_z);
+    return (1.0 - p->chi_z/chi_this_z) * p->dndz(z, p->dndz_params);
+}//}}}
+
+static int
+check_lensing_efficiency(hmpdf_obj *d, hmpdf_dndz_f dndz, void *dndz_params,
+                         double *eff)
+// compares with one adaptive integration per redshift
+{//{{{
     STARTFCT
 
-    double tau;
-    SAFECLASS(background_tau_of_z(p->ba, z, &tau),
-              p->ba->error_message);
-    SAFECLASS(background_at_tau(p->ba, tau, long_info, inter_normal, &p->index, p->pvecback),
-              p->ba->error_message);
+    gsl_integration_workspace *ws;
+    SAFEALLOC(ws, gsl_integration_workspace_alloc(DNDZ_INTEGR_LIMIT));
+    gsl_function F;
 
-    double chi_this_z = p->pvecback[p->ba->index_bg_conf_distance];
+    double norm, err;
+    F.function = dndz;
+    F.params = dndz_params;
+    SAFEGSL(gsl_integration_qag(&F, 0.0, d->n->zsource,
+                                0.0, DNDZ_INTEGR_EPSREL,
+                                DNDZ_INTEGR_LIMIT, DNDZ_INTEGR_KEY, ws,
+                                &norm, &err));
 
-    *out = (1.0 - p->chi_z/chi_this_z) * p->dndz(z, p->dndz_params);
+    dndz_integr_params p = { .d=d, .dndz=dndz, .dndz_params=dndz_params, .status=0 };
+    F.function = dndz_integr_f;
+    F.params = &p;
 
-    ENDFCT
-}
+    double maxdiff = 0.0, maxval = 0.0;
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        p.chi_z = d->c->comoving[z_index];
+        double ref;
+        SAFEGSL(gsl_integration_qag(&F, d->n->zgrid[z_index], d->n->zsource,
+                                    0.0, DNDZ_INTEGR_EPSREL,
+                                    DNDZ_INTEGR_LIMIT, DNDZ_INTEGR_KEY, ws,
+                                    &ref, &err));
+        HMPDFCHECK(p.status, "error encountered during integration");
+        ref /= norm;
+        maxdiff = GSL_MAX(maxdiff, fabs(eff[z_index] - ref));
+        maxval = GSL_MAX(maxval, fabs(ref));
+    }
 
-static double
-dndz_integr_f(double z, void *params)
-{
-    dndz_integr_params *p = (dndz_integr_params *)params;
+    gsl_integration_workspace_free(ws);
 
-    double out = 0.0; // to avoid maybe-uninitialized
-    p->status = dndz_integr_kernel(z, p, &out);
-    return out;
-}
+    HMPDFCHECK(maxdiff > DNDZ_CHECK_TOL * maxval,
+               "lensing efficiency deviates from direct integration by %.2e "
+               "(relative to maximum).", maxdiff / maxval);
+
+    ENDFCT
+}//}}}
+#endif
 
 static int
 fill_background(hmpdf_obj *d)
@@ -123,37 +239,26 @@ fill_background(hmpdf_obj *d)
 
     HMPDFPRINT(2, "\tfill_background\n");
 
-    double tau; // conformal time in Mpc
-    int index = 0; // some internal CLASS thing
-
-    struct background *ba = (struct background *)d->cls->ba;
-
-    double *pvecback;
-    SAFEALLOC(pvecback, malloc(ba->bg_size * sizeof(double)));
     // get z=0 numbers
-    d->c->h = ba->h;
+    d->c->h = d->cls->h;
     d->c->rho_c_0 = 3.0 * gsl_pow_2(SPEEDOFLIGHT) / 8.0 / M_PI / GNEWTON
-                    * gsl_pow_2(ba->H0);
-    d->c->Om_0 = ba->Omega0_m;
+                    * gsl_pow_2(d->cls->H0);
+    d->c->Om_0 = d->cls->Omega0_m;
     d->c->rho_m_0 = d->c->Om_0 * d->c->rho_c_0;
-    d->c->Ob_0 = ba->Omega0_b;
+    d->c->Ob_0 = d->cls->Omega0_b;
 
     // get background
     for (int z_index=0; z_index<d->n->Nz; z_index++)
     {
-        // get conformal time at given redshift
-        SAFECLASS(background_tau_of_z(ba, d->n->zgrid[z_index], &tau),
-                  ba->error_message);
-        // write interpolated background quantities into pvecback
-        SAFECLASS(background_at_tau(ba, tau, long_info,
-                                    inter_normal, &index, pvecback),
-                  ba->error_message);
-
-        d->c->hubble[z_index] = pvecback[ba->index_bg_H]; // 1/Mpc
-        d->c->comoving[z_index] = pvecback[ba->index_bg_conf_distance]; // Mpc
-        d->c->angular_diameter[z_index] = pvecback[ba->index_bg_ang_distance]; // Mpc, physical
-        d->c->Dsq[z_index] = gsl_pow_2(pvecback[ba->index_bg_D]); // squared growth factor
-        d->c->Om[z_index] = pvecback[ba->index_bg_Omega_m];
+        double z = d->n->zgrid[z_index];
+        double D;
+        SAFEHMPDF(background_at_z(d, z, bg_H, d->c->hubble+z_index));
+        SAFEHMPDF(background_at_z(d, z, bg_comoving, d->c->comoving+z_index));
+        SAFEHMPDF(background_at_z(d, z, bg_angular_diameter,
+                                   d->c->angular_diameter+z_index));
+        SAFEHMPDF(background_at_z(d, z, bg_D, &D));
+        SAFEHMPDF(background_at_z(d, z, bg_Om, d->c->Om+z_index));
+        d->c->Dsq[z_index] = gsl_pow_2(D); // squared growth factor
         d->c->rho_c[z_index] = 3.0 * gsl_pow_2(SPEEDOFLIGHT) / 8.0 / M_PI / GNEWTON
                                * gsl_pow_2(d->c->hubble[z_index]);
         d->c->rho_m[z_index] = d->c->Om[z_index] * d->c->rho_c[z_index];
@@ -161,61 +266,38 @@ fill_background(hmpdf_obj *d)
 
     if (d->p->stype == hmpdf_kappa) // need to compute critical surface density
     {
-        if (d->n->dndz != NULL)
-        // non-trivial source distribution
+        if (d->n->dndz != NULL || d->n->Ndndz > 0)
+        // non-trivial source distribution(s)
         {
-            // allocate some integration resources
-            gsl_integration_workspace *ws;
-            SAFEALLOC(ws, gsl_integration_workspace_alloc(DNDZ_INTEGR_LIMIT));
-            gsl_function F;
-
-            // first figure out the normalization
-            double norm, err;
-            F.function = d->n->dndz;
-            F.params = d->n->dndz_params;
-            SAFEGSL(gsl_integration_qag(&F, 0.0, d->n->zsource,
-                                        0.0, DNDZ_INTEGR_EPSREL,
-                                        DNDZ_INTEGR_LIMIT, DNDZ_INTEGR_KEY, ws,
-                                        &norm, &err));
-
-            // prepare our integration struct
-            dndz_integr_params p = { .ba=ba, .pvecback=pvecback, .index=0,
-                                     .dndz=d->n->dndz, .dndz_params=d->n->dndz_params,
-                                     .status=0 };
-            F.function = dndz_integr_f;
-            F.params = &p;
-
-            // now compute the critical surface densities
-            for (int z_index=0; z_index<d->n->Nz; z_index++)
+            hmpdf_dndz_f *dndz = (d->n->Ndndz > 0) ? d->n->dndz_list : &(d->n->dndz);
+            void **dndz_params = (d->n->Ndndz > 0) ? d->n->dndz_params_list
+                                 : &(d->n->dndz_params);
+            SAFEHMPDF(lensing_efficiency(d, d->c->Nsrc, dndz, dndz_params,
+                                         d->c->invScrit));
+
+            for (int ss=0; ss<d->c->Nsrc; ss++)
             {
-                p.chi_z = d->c->comoving[z_index];
-                double out;
-                SAFEGSL(gsl_integration_qag(&F, d->n->zgrid[z_index], d->n->zsource,
-                                            DNDZ_INTEGR_EPSABS*norm, DNDZ_INTEGR_EPSREL,
-                                            DNDZ_INTEGR_LIMIT, DNDZ_INTEGR_KEY, ws,
-                                            &out, &err));
-
-                HMPDFCHECK(p.status, "error encountered during integration");
-
-                d->c->invScrit[z_index] = 4.0*M_PI*GNEWTON*p.chi_z
-                                          /gsl_pow_2(SPEEDOFLIGHT)/(1.0 + d->n->zgrid[z_index])
-                                          * out / norm;
+                double *invScrit = d->c->invScrit + ss*d->n->Nz;
+                #ifdef DEBUG
+                SAFEHMPDF(check_lensing_efficiency(d, dndz[ss],
+                                                   (dndz_params==NULL) ? NULL : dndz_params[ss],
+                                                   invScrit));
+                #endif
+
+                for (int z_index=0; z_index<d->n->Nz; z_index++)
+                {
+                    invScrit[z_index] *= 4.0*M_PI*GNEWTON*d->c->comoving[z_index]
+                                         /gsl_pow_2(SPEEDOFLIGHT)/(1.0 + d->n->zgrid[z_index]);
+                }
             }
-            
-            // clean up
-            gsl_integration_workspace_free(ws);
         }
         else
         // Dirac delta source distribution
         {
             // find distances to source position
-            SAFECLASS(background_tau_of_z(ba, d->n->zsource, &tau),
-                      ba->error_message);
-            SAFECLASS(background_at_tau(ba, tau, long_info,
-                                        inter_normal, &index, pvecback),
-                      ba->error_message);
-            double chi_s = pvecback[ba->index_bg_conf_distance];
-            double dA_s = pvecback[ba->index_bg_ang_distance];
+            double chi_s, dA_s;
+            SAFEHMPDF(background_at_z(d, d->n->zsource, bg_comoving, &chi_s));
+            SAFEHMPDF(background_at_z(d, d->n->zsource, bg_angular_diameter, &dA_s));
             // fill the Scrit grid
             for (int z_index=0; z_index<d->n->Nz; z_index++)
             {
@@ -226,8 +308,6 @@ fill_background(hmpdf_obj *d)
         }
     } // if kappa
 
-    free(pvecback);
-
     ENDFCT
 }//}}}
 
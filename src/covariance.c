@@ -8,8 +8,6 @@
 #endif
 
 #include <gsl/gsl_math.h>
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
 #include <gsl/gsl_integration.h>
 
 #include "utils.h"
@@ -30,9 +28,22 @@ null_covariance(hmpdf_obj *d)
     STARTFCT
 
     d->cov->ws = NULL;
+    // these belong to the covariance module since it creates them
+    d->n->phigrid = NULL;
+    d->n->phiweights = NULL;
     d->cov->Cov = NULL;
     d->cov->Cov_noisy = NULL;
     d->cov->corr_diagn = NULL;
+    d->cov->phidone = NULL;
+    d->cov->phitime = NULL;
+    d->cov->shard = 0;
+    d->cov->Nshards = 1;
+    d->cov->acc = NULL;
+    d->cov->acc_noisy = NULL;
+    d->cov->Nnoise_groups = 0;
+    d->cov->noise_group = NULL;
+    d->cov->noise_group_zeta = NULL;
+    d->cov->noise_group_acc = NULL;
     d->cov->created_tp_ws = 0;
     d->cov->created_phigrid = 0;
     d->cov->created_cov = 0;
@@ -41,6 +52,60 @@ null_covariance(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
+static int
+free_cov_acc(hmpdf_obj *d, double ***acc)
+{//{{{
+    STARTFCT
+
+    if (*acc != NULL)
+    {
+        for (int ii=0; ii<d->cov->Nws; ii++)
+        {
+            if ((*acc)[ii] != NULL) { free((*acc)[ii]); }
+        }
+        free(*acc);
+        *acc = NULL;
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+free_cov(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    if (d->cov->Cov != NULL) { free(d->cov->Cov); d->cov->Cov = NULL; }
+    if (d->cov->Cov_noisy != NULL) { free(d->cov->Cov_noisy); d->cov->Cov_noisy = NULL; }
+    if (d->cov->corr_diagn != NULL) { free(d->cov->corr_diagn); d->cov->corr_diagn = NULL; }
+    if (d->cov->phidone != NULL) { free(d->cov->phidone); d->cov->phidone = NULL; }
+    if (d->cov->phitime != NULL) { free(d->cov->phitime); d->cov->phitime = NULL; }
+    d->cov->created_cov = 0;
+
+    ENDFCT
+}//}}}
+
+static int
+free_noise_groups(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    if (d->cov->noise_group_acc != NULL)
+    {
+        for (int gg=0; gg<d->cov->Nnoise_groups; gg++)
+        {
+            if (d->cov->noise_group_acc[gg] != NULL) { free(d->cov->noise_group_acc[gg]); }
+        }
+        free(d->cov->noise_group_acc);
+        d->cov->noise_group_acc = NULL;
+    }
+    if (d->cov->noise_group != NULL) { free(d->cov->noise_group); d->cov->noise_group = NULL; }
+    if (d->cov->noise_group_zeta != NULL) { free(d->cov->noise_group_zeta); d->cov->noise_group_zeta = NULL; }
+    d->cov->Nnoise_groups = 0;
+
+    ENDFCT
+}//}}}
+
 int
 reset_covariance(hmpdf_obj *d)
 {//{{{
@@ -48,23 +113,17 @@ reset_covariance(hmpdf_obj *d)
 
     HMPDFPRINT(2, "\treset_covariance\n");
 
-    if (d->cov->Cov != NULL) { free(d->cov->Cov); }
-    if (d->cov->Cov_noisy != NULL) { free(d->cov->Cov_noisy); }
-    if (d->cov->corr_diagn != NULL) { free(d->cov->corr_diagn); }
+    if (d->n->phigrid != NULL) { free(d->n->phigrid); }
+    if (d->n->phiweights != NULL) { free(d->n->phiweights); }
+    SAFEHMPDF(free_cov(d));
+    SAFEHMPDF(free_noise_groups(d));
+    SAFEHMPDF(free_cov_acc(d, &d->cov->acc));
+    SAFEHMPDF(free_cov_acc(d, &d->cov->acc_noisy));
     if (d->cov->ws != NULL)
     {
         for (int ii=0; ii<d->cov->Nws; ii++)
         {
-            if (d->cov->ws[ii] != NULL)
-            {
-                fftw_free(d->cov->ws[ii]->pdf_real);
-                free(d->cov->ws[ii]->bc);
-                fftw_free(d->cov->ws[ii]->tempc_real);
-                fftw_destroy_plan(d->cov->ws[ii]->pu_r2c);
-                fftw_destroy_plan(d->cov->ws[ii]->pc_r2c);
-                fftw_destroy_plan(d->cov->ws[ii]->ppdf_c2r);
-                free(d->cov->ws[ii]);
-            }
+            if (d->cov->ws[ii] != NULL) { delete_tp_ws(d->cov->ws[ii]); }
         }
         free(d->cov->ws);
     }
@@ -276,31 +335,78 @@ phigrid_approx_part(hmpdf_obj *d, int Nexact, double **grid, double **weights, i
     ENDFCT
 }//}}}
 
+typedef struct//{{{
+{
+    double cost;
+    int idx;
+}//}}}
+phicost_t;
+
+static int
+comp_phicost(const void *a, const void *b)
+// to qsort by descending cost, ties are broken by the index
+{//{{{
+    const phicost_t *pa = (const phicost_t *)a;
+    const phicost_t *pb = (const phicost_t *)b;
+    if (pa->cost > pb->cost)
+    {
+        return -1;
+    }
+    else if (pa->cost < pb->cost)
+    {
+        return 1;
+    }
+    else
+    {
+        return (pa->idx > pb->idx) - (pa->idx < pb->idx);
+    }
+}//}}}
+
+static double
+phi_cost_model(hmpdf_obj *d, double phi)
+// estimated cost of the two-point PDF at separation phi.
+// tp_segmentsum only works on halos with 2 theta_out > phi,
+//     and for those the fraction of the signal rows not skipped
+//     decreases roughly linearly with phi.
+{//{{{
+    double out = 0.0;
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        for (int M_index=0; M_index<d->n->NM; M_index++)
+        {
+            double tout = d->p->profiles[z_index][M_index][0];
+            out += GSL_MAX(0.0, 1.0 - 0.5 * phi / tout);
+        }
+    }
+    return out;
+}//}}}
+
 static int
-phigrid_shuffle_and_copy(hmpdf_obj *d, double *grid, double *weights)
+phigrid_sort_and_copy(hmpdf_obj *d, double *grid, double *weights)
+// the phi values are ordered by descending estimated cost,
+//     so that the dynamic schedule in create_cov processes them longest-first
+//     and shards with round-robin assignment have comparable cost
 {//{{{
     STARTFCT
 
-    int *indices;
-    SAFEALLOC(indices, malloc(d->n->Nphi * sizeof(int)));
+    phicost_t *c;
+    SAFEALLOC(c, malloc(d->n->Nphi * sizeof(phicost_t)));
 
     for (int ii=0; ii<d->n->Nphi; ii++)
     {
-        indices[ii] = ii;
+        c[ii].cost = phi_cost_model(d, grid[ii]);
+        c[ii].idx = ii;
     }
 
-    gsl_rng *r = gsl_rng_alloc(gsl_rng_default);
-    gsl_rng_set(r, time(NULL));
-    gsl_ran_shuffle(r, indices, d->n->Nphi, sizeof(int));
-    gsl_rng_free(r);
-    
+    qsort(c, d->n->Nphi, sizeof(phicost_t), comp_phicost);
+
     for (int ii=0; ii<d->n->Nphi; ii++)
     {
-        d->n->phigrid[ii]    = grid[indices[ii]];
-        d->n->phiweights[ii] = weights[indices[ii]];
+        d->n->phigrid[ii]    = grid[c[ii].idx];
+        d->n->phiweights[ii] = weights[c[ii].idx];
     }
 
-    free(indices);
+    free(c);
 
     ENDFCT
 }//}}}
@@ -358,11 +464,11 @@ create_phigrid(hmpdf_obj *d)
     HMPDFPRINT(4, "\t\t\tNphi = %d, Nexact = %d\n", d->n->Nphi, Nexact);
 
     // now copy into the main grids
-    // including shuffling to make parallel execution more efficient
+    // including sorting to make parallel execution more efficient
     SAFEALLOC(d->n->phigrid,    malloc(d->n->Nphi * sizeof(double)));
     SAFEALLOC(d->n->phiweights, malloc(d->n->Nphi * sizeof(double)));
 
-    SAFEHMPDF(phigrid_shuffle_and_copy(d, _phigrid, _phiweights));
+    SAFEHMPDF(phigrid_sort_and_copy(d, _phigrid, _phiweights));
 
     free(_phigrid);
     free(_phiweights);
@@ -465,202 +571,989 @@ rescale_to_fsky1(hmpdf_obj *d, int N, double *cov)
 }//}}}
 
 static int
-add_tp_to_cov(hmpdf_obj *d, int phiindex)
+alloc_cov_acc(hmpdf_obj *d, long N, double ***acc)
+// tries to allocate one accumulator of N*N per workspace,
+//     if this fails *acc is NULL on output and the striped scheme is used
 {//{{{
     STARTFCT
 
-    for (long ii=0; ii<d->n->Nsignal; ii++)
+    SAFEALLOC(*acc, malloc(d->cov->Nws * sizeof(double *)));
+    SETARRNULL(*acc, d->cov->Nws);
+    for (int ii=0; ii<d->cov->Nws; ii++)
     {
-        for (long jj=0; jj<d->n->Nsignal; jj++)
+        (*acc)[ii] = malloc(N * N * sizeof(double));
+        if ((*acc)[ii] == NULL)
+        // failure to allocate is not a critical error
+        {
+            HMPDFPRINT(1, "Not enough memory for per-thread covariance accumulators, "
+                          "falling back to striped accumulation.\n");
+            SAFEHMPDF(free_cov_acc(d, acc));
+            break;
+        }
+        zero_real(N * N, (*acc)[ii]);
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+add_to_cov_acc(hmpdf_obj *d, long N, long ldsrc, const double *src, double weight,
+               double **acc, double *cov)
+// adds weight * src[N, ldsrc] to the accumulator of this thread,
+//     or, if there are no per-thread accumulators, to cov[N, N]
+//     in stripes protected by locks
+{//{{{
+    STARTFCT
+
+    if (acc != NULL)
+    {
+        double *target = acc[THIS_THREAD];
+        for (long ii=0; ii<N; ii++)
+        {
+            for (long jj=0; jj<N; jj++)
+            {
+                target[ii*N+jj] += weight * src[ii*ldsrc+jj];
+            }
+        }
+    }
+    else
+    {
+        // start at different stripes in the different threads to avoid contention
+        int start = (THIS_THREAD * COV_NSTRIPES) / d->cov->Nws;
+        for (int ss=0; ss<COV_NSTRIPES; ss++)
         {
+            int stripe = (start + ss) % COV_NSTRIPES;
+            long lo = (stripe * N) / COV_NSTRIPES;
+            long hi = ((stripe+1) * N) / COV_NSTRIPES;
             #ifdef _OPENMP
-            // make sure no two threads add to the same element simultaneously
-            #   pragma omp atomic
+            omp_set_lock(d->cov->stripe_locks+stripe);
+            #endif
+            for (long ii=lo; ii<hi; ii++)
+            {
+                for (long jj=0; jj<N; jj++)
+                {
+                    cov[ii*N+jj] += weight * src[ii*ldsrc+jj];
+                }
+            }
+            #ifdef _OPENMP
+            omp_unset_lock(d->cov->stripe_locks+stripe);
             #endif
-            d->cov->Cov[ii*d->n->Nsignal+jj]
-                += d->n->phiweights[phiindex]
-                   * d->cov->ws[THIS_THREAD]->pdf_real[ii*(d->n->Nsignal+2)+jj];
         }
     }
 
-    if (d->ns->have_noise)
+    ENDFCT
+}//}}}
+
+static int
+reduce_cov_acc(hmpdf_obj *d, long N, double **acc, double *cov)
+// pairwise tree reduction of the per-thread accumulators,
+//     the result is added to cov[N, N] and the accumulators are zeroed.
+// The order of summation is fixed, so the result is deterministic.
+{//{{{
+    STARTFCT
+
+    if (acc == NULL) { return 0; }
+
+    for (int stride=1; stride<d->cov->Nws; stride*=2)
     {
-        // add to noisy covariance matrix
-        for (long ii=0; ii<d->n->Nsignal_noisy; ii++)
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+        #endif
+        for (long ii=0; ii<N; ii++)
         {
-            for (long jj=0; jj<d->n->Nsignal_noisy; jj++)
+            for (int tt=0; tt+stride<d->cov->Nws; tt+=2*stride)
             {
-                #ifdef _OPENMP
-                // make sure no two threads add to the same element simultaneously
-                #   pragma omp atomic
-                #endif
-                d->cov->Cov_noisy[ii*d->n->Nsignal_noisy+jj]
-                    += d->n->phiweights[phiindex]
-                       * d->ns->conv_buffer_real[THIS_THREAD][ii*(d->n->Nsignal_noisy+2)+jj];
+                for (long jj=0; jj<N; jj++)
+                {
+                    acc[tt][ii*N+jj] += acc[tt+stride][ii*N+jj];
+                }
             }
         }
     }
 
+    for (long ii=0; ii<N*N; ii++)
+    {
+        cov[ii] += acc[0][ii];
+    }
+
+    for (int tt=0; tt<d->cov->Nws; tt++)
+    {
+        zero_real(N * N, acc[tt]);
+    }
+
     ENDFCT
 }//}}}
 
+typedef struct//{{{
+{
+    long key;
+    int idx;
+}//}}}
+phikey_t;
+
 static int
-subtract_op_from_cov(hmpdf_obj *d)
+comp_phikey(const void *a, const void *b)
+// to qsort by key, ties are broken by the index
+{//{{{
+    const phikey_t *pa = (const phikey_t *)a;
+    const phikey_t *pb = (const phikey_t *)b;
+    if (pa->key != pb->key)
+    {
+        return (pa->key > pb->key) - (pa->key < pb->key);
+    }
+    return (pa->idx > pb->idx) - (pa->idx < pb->idx);
+}//}}}
+
+typedef struct//{{{
+{
+    long key;
+    int start;
+    int len;
+}//}}}
+phirun_t;
+
+static int
+comp_phirun(const void *a, const void *b)
+// to qsort by descending length, ties are broken by the start
+{//{{{
+    const phirun_t *pa = (const phirun_t *)a;
+    const phirun_t *pb = (const phirun_t *)b;
+    if (pa->len != pb->len)
+    {
+        return (pa->len < pb->len) - (pa->len > pb->len);
+    }
+    return (pa->start > pb->start) - (pa->start < pb->start);
+}//}}}
+
+static int
+create_noise_groups(hmpdf_obj *d)
+// The noise convolution is linear, and its kernel depends on phi only through
+//     the noise correlation zeta(phi).
+//     Thus, phi values with (nearly) equal zeta can be summed first
+//     and convolved once.
+//     For phi > phimax/2, zeta = 0 exactly, so this is exact for them
+//     even with zero tolerance.
 {//{{{
     STARTFCT
 
-    double weight_sum = 1.0; // includes the zero-separation contribution here
+    SAFEALLOC(d->cov->noise_group, malloc(d->n->Nphi * sizeof(int)));
     for (int pp=0; pp<d->n->Nphi; pp++)
     {
-        weight_sum += d->n->phiweights[pp];
+        d->cov->noise_group[pp] = -1;
     }
+    d->cov->Nnoise_groups = 0;
 
-    for (long ii=0; ii<d->n->Nsignal; ii++)
+    if (!d->ns->have_noise) { return 0; }
+
+    // quantize zeta
+    double unit = d->cov->noise_zeta_tol * d->ns->sigmasq;
+    phikey_t *keys;
+    SAFEALLOC(keys, malloc(d->n->Nphi * sizeof(phikey_t)));
+    int Nkeys = 0;
+    for (int pp=0; pp<d->n->Nphi; pp++)
     {
-        for (long jj=0; jj<d->n->Nsignal; jj++)
+        if (d->cov->phidone[pp] || (pp % d->cov->Nshards != d->cov->shard))
         {
-            d->cov->Cov[ii*d->n->Nsignal+jj]
-                -= weight_sum * d->op->PDFc[ii] * d->op->PDFc[jj];
+            continue;
+        }
+
+        double zeta;
+        SAFEHMPDF(noise_zeta(d, d->n->phigrid[pp], &zeta));
+        if (unit > 0.0)
+        {
+            keys[Nkeys].key = lround(zeta / unit);
+        }
+        else if (zeta == 0.0)
+        {
+            keys[Nkeys].key = 0;
+        }
+        else
+        {
+            continue;
         }
+        keys[Nkeys].idx = pp;
+        ++Nkeys;
     }
 
-    if (d->ns->have_noise)
+    qsort(keys, Nkeys, sizeof(phikey_t), comp_phikey);
+
+    // find the runs of equal keys that are worth batching
+    phirun_t *runs;
+    SAFEALLOC(runs, malloc((Nkeys+1) * sizeof(phirun_t)));
+    int Nruns = 0;
+    for (int start=0, ii=1; ii<=Nkeys; ii++)
     {
-        for (long ii=0; ii<d->n->Nsignal_noisy; ii++)
+        if (ii == Nkeys || keys[ii].key != keys[start].key)
         {
-            for (long jj=0; jj<d->n->Nsignal_noisy; jj++)
+            if (ii - start > 1)
             {
-                d->cov->Cov_noisy[ii*d->n->Nsignal_noisy+jj]
-                    -= weight_sum * d->op->PDFc_noisy[ii] * d->op->PDFc_noisy[jj];
+                runs[Nruns].key = keys[start].key;
+                runs[Nruns].start = start;
+                runs[Nruns].len = ii - start;
+                ++Nruns;
             }
+            start = ii;
+        }
+    }
+
+    qsort(runs, Nruns, sizeof(phirun_t), comp_phirun);
+    Nruns = GSL_MIN(Nruns, COV_NOISE_MAXGROUPS);
+
+    SAFEALLOC(d->cov->noise_group_zeta, malloc(GSL_MAX(1, Nruns) * sizeof(double)));
+    SAFEALLOC(d->cov->noise_group_acc, malloc(GSL_MAX(1, Nruns) * sizeof(double *)));
+    SETARRNULL(d->cov->noise_group_acc, GSL_MAX(1, Nruns));
+
+    int Nbatched = 0;
+    for (int gg=0; gg<Nruns; gg++)
+    {
+        double *acc = malloc(d->n->Nsignal * d->n->Nsignal * sizeof(double));
+        if (acc == NULL)
+        // failure to allocate is not a critical error
+        {
+            HMPDFPRINT(1, "Not enough memory for more than %d batched noise convolutions.\n",
+                          gg);
+            break;
+        }
+        zero_real(d->n->Nsignal * d->n->Nsignal, acc);
+        d->cov->noise_group_acc[gg] = acc;
+        d->cov->noise_group_zeta[gg] = (double)runs[gg].key * unit;
+        for (int ii=runs[gg].start; ii<runs[gg].start+runs[gg].len; ii++)
+        {
+            d->cov->noise_group[keys[ii].idx] = gg;
         }
+        Nbatched += runs[gg].len;
+        ++d->cov->Nnoise_groups;
     }
 
+    HMPDFPRINT(1, "\t\t%d noise convolutions batched into %d\n",
+                  Nbatched, d->cov->Nnoise_groups);
+
+    free(keys);
+    free(runs);
+
     ENDFCT
 }//}}}
 
 static int
-create_cov(hmpdf_obj *d)
+flush_noise_groups(hmpdf_obj *d)
+// convolves the summed two-point PDFs of each group with the noise kernel,
+//     adds them to the noisy covariance matrix and zeroes the sums
 {//{{{
     STARTFCT
 
-    if (d->cov->created_cov) { return 0; }
-
-    HMPDFPRINT(2, "\tcreate_cov\n");
-
-    // allocate storage
-    SAFEALLOC(d->cov->Cov, malloc(d->n->Nsignal
-                                  * d->n->Nsignal
-                                  * sizeof(double)));
-    if (d->ns->have_noise)
-    {
-        SAFEALLOC(d->cov->Cov_noisy, malloc(d->n->Nsignal_noisy
-                                            * d->n->Nsignal_noisy
-                                            * sizeof(double)));
-    }
-    SAFEALLOC(d->cov->corr_diagn, malloc(d->n->Nphi * sizeof(double)));
-
-    // zero covariance
-    zero_real(d->n->Nsignal * d->n->Nsignal, d->cov->Cov);
-    if (d->ns->have_noise)
-    {
-        zero_real(d->n->Nsignal_noisy * d->n->Nsignal_noisy,
-                  d->cov->Cov_noisy);
-    }
-
-    // status
-    int Nstatus = 0;
-    time_t start_time = time(NULL);
-    
-    // loop over phi values
     #ifdef _OPENMP
     #   pragma omp parallel for num_threads(d->cov->Nws) schedule(dynamic)
     #endif
-    for (int pp=0; pp<d->n->Nphi; pp++)
+    for (int gg=0; gg<d->cov->Nnoise_groups; gg++)
     {
         CONTINUE_IF_ERR
 
-        // create twopoint at this phi
-        SAFEHMPDF_NORETURN(create_tp(d, d->n->phigrid[pp],
-                                     d->cov->ws[THIS_THREAD]));
-        CONTINUE_IF_ERR
-
-        // compute noisy two-point PDF if necessary
-        if (d->ns->have_noise)
+        if (all_zero(d->n->Nsignal * d->n->Nsignal, d->cov->noise_group_acc[gg], 0.0))
         {
-            SAFEHMPDF_NORETURN(noise_matr(d, d->cov->ws[THIS_THREAD]->pdf_real,
-                                          NULL/*no separate output allocated*/,
-                                          1/*is buffered*/, d->n->phigrid[pp]));
+            continue;
         }
-        CONTINUE_IF_ERR
-        
-        // compute the correlation function
-        SAFEHMPDF_NORETURN(corr_diagn(d, d->cov->ws[THIS_THREAD],
-                                      d->cov->corr_diagn+pp));
-        CONTINUE_IF_ERR
 
-        // status update
-        #ifdef _OPENMP
-        #   pragma omp critical(StatusCov)
-        #endif
-        {
-            ++Nstatus;
-            if ((Nstatus%COV_STATUS_PERIOD == 0) && (d->verbosity > 0))
-            {
-                TIMEREMAIN(Nstatus, d->n->Nphi, "create_cov");
-            }
-        }
+        SAFEHMPDF_NORETURN(noise_matr_zeta(d, d->cov->noise_group_acc[gg], NULL,
+                                           0/*not buffered*/, d->cov->noise_group_zeta[gg]));
         CONTINUE_IF_ERR
 
-        // This is a pretty dirty hack but it should be ok for the low separations
-        // where we have a large number of sample points and a few mess up sometimes
-        // Always need to check the diagnostics that only a very small number of points
-        // is messed up!!!
-        if (d->cov->corr_diagn[pp] < 0.0 || d->cov->corr_diagn[pp] > 1e-3)
-            continue;
-        
-        // add to covariance
-        SAFEHMPDF_NORETURN(add_tp_to_cov(d, pp));
+        SAFEHMPDF_NORETURN(add_to_cov_acc(d, d->n->Nsignal_noisy, d->n->Nsignal_noisy+2,
+                                          d->ns->conv_buffer_real[THIS_THREAD], 1.0,
+                                          d->cov->acc_noisy, d->cov->Cov_noisy));
         CONTINUE_IF_ERR
-    }
 
-    // subtract the one-point outer product
-    SAFEHMPDF(subtract_op_from_cov(d));
+        zero_real(d->n->Nsignal * d->n->Nsignal, d->cov->noise_group_acc[gg]);
+    }
 
-    d->cov->created_cov = 1;
+    RETURN_IF_ERR
 
     ENDFCT
 }//}}}
 
 static int
-prepare_cov(hmpdf_obj *d)
+add_tp_to_cov(hmpdf_obj *d, int phiindex)
 {//{{{
     STARTFCT
 
-    HMPDFPRINT(1, "prepare_cov\n");
+    SAFEHMPDF(add_to_cov_acc(d, d->n->Nsignal, d->n->Nsignal+2,
+                             d->cov->ws[THIS_THREAD]->pdf_real,
+                             d->n->phiweights[phiindex],
+                             d->cov->acc, d->cov->Cov));
 
-    // run necessary code from other modules
-    if (d->f->Nfilters > 0)
+    if (d->ns->have_noise && d->cov->noise_group[phiindex] >= 0)
+    // convolved later, together with the other members of the group
     {
-        SAFEHMPDF(create_conj_profiles(d));
-        SAFEHMPDF(create_filtered_profiles(d));
+        SAFEHMPDF(add_to_cov_acc(d, d->n->Nsignal, d->n->Nsignal+2,
+                                 d->cov->ws[THIS_THREAD]->pdf_real,
+                                 d->n->phiweights[phiindex],
+                                 NULL, d->cov->noise_group_acc[d->cov->noise_group[phiindex]]));
+    }
+    else if (d->ns->have_noise)
+    // add to noisy covariance matrix
+    {
+        SAFEHMPDF(add_to_cov_acc(d, d->n->Nsignal_noisy, d->n->Nsignal_noisy+2,
+                                 d->ns->conv_buffer_real[THIS_THREAD],
+                                 d->n->phiweights[phiindex],
+                                 d->cov->acc_noisy, d->cov->Cov_noisy));
     }
 
-    SAFEHMPDF(create_segments(d));
+    ENDFCT
+}//}}}
 
-    SAFEHMPDF(create_op(d));
+static int
+subtract_op_from_cov(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    double weight_sum = 1.0; // includes the zero-separation contribution here
+    for (int pp=0; pp<d->n->Nphi; pp++)
+    {
+        weight_sum += d->n->phiweights[pp];
+    }
+
+    for (long ii=0; ii<d->n->Nsignal; ii++)
+    {
+        for (long jj=0; jj<d->n->Nsignal; jj++)
+        {
+            d->cov->Cov[ii*d->n->Nsignal+jj]
+                -= weight_sum * d->op->PDFc[ii] * d->op->PDFc[jj];
+        }
+    }
 
     if (d->ns->have_noise)
     {
-        SAFEHMPDF(create_noisy_op(d));
-        SAFEHMPDF(create_noise_matr_conv(d, d->Ncores));
+        for (long ii=0; ii<d->n->Nsignal_noisy; ii++)
+        {
+            for (long jj=0; jj<d->n->Nsignal_noisy; jj++)
+            {
+                d->cov->Cov_noisy[ii*d->n->Nsignal_noisy+jj]
+                    -= weight_sum * d->op->PDFc_noisy[ii] * d->op->PDFc_noisy[jj];
+            }
+        }
     }
 
-    SAFEHMPDF(create_corr(d));
+    ENDFCT
+}//}}}
+
+static int
+cov_settings_hash(hmpdf_obj *d, uint64_t *out)
+// fingerprint of the inputs to the covariance matrix,
+//     used to decide whether a checkpoint or shard file can be used.
+// Only inputs enter, not computed quantities, which may differ at round-off
+//     level between processes (e.g. because of different FFTW plans).
+// Fails if a user-supplied function is passed, whose effect cannot be hashed.
+{//{{{
+    STARTFCT
+
+    HMPDFCHECK(d->settings_unhashable != NULL,
+               "%s is passed, so checkpoint and shard files cannot be matched "
+               "to the settings and are not supported.", d->settings_unhashable);
+
+    uint64_t h = d->settings_hash;
+    h = hash_bytes(h, sizeof(int), &d->n->Nphi);
+    h = hash_doubles(h, d->n->Nphi, d->n->phigrid);
+    h = hash_doubles(h, d->n->Nphi, d->n->phiweights);
+
+    *out = h;
+
+    ENDFCT
+}//}}}
+
+static int
+read_cov_file(hmpdf_obj *d, char *fname, uint64_t hash,
+              int *shard, int *Nshards,
+              char *done, double *corr_diagn, double *cov, double *cov_noisy,
+              int *ok)
+// reads a checkpoint or shard file.
+// On output, ok = -1 if the file does not exist,
+//                  0 if it does not match the settings hash or is corrupted,
+//                  1 on success.
+// shard and Nshards are those the file was written for.
+// The output buffers may be partially overwritten if ok = 0.
+{//{{{
+    STARTFCT
+
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL)
+    {
+        *ok = -1;
+        return 0;
+    }
+
+    long N = d->n->Nsignal;
+    long Nnoisy = (d->ns->have_noise) ? d->n->Nsignal_noisy : 0;
+
+    char magic[sizeof COV_CHECKPOINT_MAGIC];
+    uint64_t file_hash;
+    int file_Nphi;
+    long file_N, file_Nnoisy;
+    *ok = fread(magic, 1, sizeof magic, f) == sizeof magic
+          && memcmp(magic, COV_CHECKPOINT_MAGIC, sizeof magic) == 0
+          && fread(&file_hash, sizeof(uint64_t), 1, f) == 1
+          && fread(&file_Nphi, sizeof(int), 1, f) == 1
+          && fread(&file_N, sizeof(long), 1, f) == 1
+          && fread(&file_Nnoisy, sizeof(long), 1, f) == 1
+          && fread(shard, sizeof(int), 1, f) == 1
+          && fread(Nshards, sizeof(int), 1, f) == 1
+          && file_hash == hash
+          && file_Nphi == d->n->Nphi
+          && file_N == N
+          && file_Nnoisy == Nnoisy;
+    *ok = *ok
+          && fread(done, 1, d->n->Nphi, f) == (size_t)d->n->Nphi
+          && fread(corr_diagn, sizeof(double), d->n->Nphi, f) == (size_t)d->n->Nphi
+          && fread(cov, sizeof(double), N * N, f) == (size_t)(N * N)
+          && (Nnoisy == 0
+              || fread(cov_noisy, sizeof(double), Nnoisy * Nnoisy, f)
+                 == (size_t)(Nnoisy * Nnoisy));
+    fclose(f);
+
+    ENDFCT
+}//}}}
+
+static int
+write_cov_file(hmpdf_obj *d, char *fname, uint64_t hash, int shard, int Nshards, int *ok)
+// writes Cov, Cov_noisy, corr_diagn and phidone, computed as part shard of Nshards.
+// Cov and Cov_noisy are the sums over the phi values marked in phidone,
+//     i.e. the accumulators must have been reduced and the one-point term
+//     is not subtracted.
+// Writes to a temporary file first, so an interruption does not leave
+//     a corrupted file behind.
+{//{{{
+    STARTFCT
+
+    long N = d->n->Nsignal;
+    long Nnoisy = (d->ns->have_noise) ? d->n->Nsignal_noisy : 0;
+
+    char *tmp_fname;
+    SAFEALLOC(tmp_fname, malloc(strlen(fname) + 5));
+    sprintf(tmp_fname, "%s.tmp", fname);
+
+    FILE *f = fopen(tmp_fname, "wb");
+    if (f == NULL)
+    {
+        free(tmp_fname);
+        *ok = 0;
+        return 0;
+    }
+
+    *ok = fwrite(COV_CHECKPOINT_MAGIC, 1, sizeof COV_CHECKPOINT_MAGIC, f)
+          == sizeof COV_CHECKPOINT_MAGIC
+          && fwrite(&hash, sizeof(uint64_t), 1, f) == 1
+          && fwrite(&d->n->Nphi, sizeof(int), 1, f) == 1
+          && fwrite(&N, sizeof(long), 1, f) == 1
+          && fwrite(&Nnoisy, sizeof(long), 1, f) == 1
+          && fwrite(&shard, sizeof(int), 1, f) == 1
+          && fwrite(&Nshards, sizeof(int), 1, f) == 1
+          && fwrite(d->cov->phidone, 1, d->n->Nphi, f) == (size_t)d->n->Nphi
+          && fwrite(d->cov->corr_diagn, sizeof(double), d->n->Nphi, f)
+             == (size_t)d->n->Nphi
+          && fwrite(d->cov->Cov, sizeof(double), N * N, f) == (size_t)(N * N)
+          && (Nnoisy == 0
+              || fwrite(d->cov->Cov_noisy, sizeof(double), Nnoisy * Nnoisy, f)
+                 == (size_t)(Nnoisy * Nnoisy));
+    *ok = (fclose(f) == 0) && *ok;
+    *ok = *ok && (rename(tmp_fname, fname) == 0);
+    free(tmp_fname);
+
+    ENDFCT
+}//}}}
+
+static int
+cov_shard_fname(hmpdf_obj *d, char *fname, char **out)
+// the file name used by this shard, with the shard index appended
+//     if the computation is split
+{//{{{
+    STARTFCT
+
+    SAFEALLOC(*out, malloc(strlen(fname) + 32));
+    if (d->cov->Nshards > 1)
+    {
+        sprintf(*out, "%s.%dof%d", fname, d->cov->shard, d->cov->Nshards);
+    }
+    else
+    {
+        strcpy(*out, fname);
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+read_cov_checkpoint(hmpdf_obj *d, char *fname, uint64_t hash, int *Ndone)
+// if a matching checkpoint file exists, fills Cov, Cov_noisy, corr_diagn and phidone
+{//{{{
+    STARTFCT
+
+    *Ndone = 0;
+
+    int ok, shard, Nshards;
+    SAFEHMPDF(read_cov_file(d, fname, hash, &shard, &Nshards,
+                            d->cov->phidone, d->cov->corr_diagn,
+                            d->cov->Cov, d->cov->Cov_noisy, &ok));
+    ok = (ok == 1) ? (shard == d->cov->shard && Nshards == d->cov->Nshards) : ok;
+
+    if (ok == -1)
+    {
+        HMPDFPRINT(1, "\t\tno checkpoint file %s, starting from scratch\n",
+                      fname);
+        return 0;
+    }
+
+    if (ok == 0)
+    {
+        // the buffers may have been partially overwritten
+        memset(d->cov->phidone, 0, d->n->Nphi);
+        zero_real(d->n->Nsignal * d->n->Nsignal, d->cov->Cov);
+        if (d->ns->have_noise)
+        {
+            zero_real(d->n->Nsignal_noisy * d->n->Nsignal_noisy, d->cov->Cov_noisy);
+        }
+        HMPDFPRINT(1, "\t\tcheckpoint file %s was written with different settings "
+                      "or is corrupted, ignoring it\n", fname);
+        return 0;
+    }
+
+    for (int pp=0; pp<d->n->Nphi; pp++)
+    {
+        *Ndone += d->cov->phidone[pp];
+    }
+
+    HMPDFPRINT(1, "\t\tresuming from checkpoint file %s, %d of %d phi values done\n",
+                  fname, *Ndone, d->n->Nphi);
+
+    ENDFCT
+}//}}}
+
+static int
+write_cov_checkpoint(hmpdf_obj *d, char *fname, uint64_t hash)
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(2, "\t\twriting checkpoint file %s\n", fname);
+
+    int ok;
+    SAFEHMPDF(write_cov_file(d, fname, hash, d->cov->shard, d->cov->Nshards, &ok));
+
+    // failure to write a checkpoint should not abort the computation
+    if (!ok)
+    {
+        HMPDFPRINT(1, "\t\tfailed to write checkpoint file %s\n", fname);
+    }
+
+    ENDFCT
+}//}}}
+
+static double
+cov_walltime(void)
+{//{{{
+    #ifdef _OPENMP
+    return omp_get_wtime();
+    #else
+    return (double)clock() / (double)CLOCKS_PER_SEC;
+    #endif
+}//}}}
+
+static int
+read_cov_timings(hmpdf_obj *d, char *fname, uint64_t hash)
+// fills phitime from a matching timings file, leaves it zero otherwise
+{//{{{
+    STARTFCT
+
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) { return 0; }
+
+    char magic[sizeof COV_TIMINGS_MAGIC];
+    uint64_t file_hash;
+    int file_Nphi;
+    int ok = fread(magic, 1, sizeof magic, f) == sizeof magic
+             && memcmp(magic, COV_TIMINGS_MAGIC, sizeof magic) == 0
+             && fread(&file_hash, sizeof(uint64_t), 1, f) == 1
+             && fread(&file_Nphi, sizeof(int), 1, f) == 1
+             && file_hash == hash
+             && file_Nphi == d->n->Nphi
+             && fread(d->cov->phitime, sizeof(double), d->n->Nphi, f)
+                == (size_t)d->n->Nphi;
+    fclose(f);
+
+    if (ok)
+    {
+        HMPDFPRINT(1, "\t\tusing recorded timings from %s\n", fname);
+    }
+    else
+    {
+        zero_real(d->n->Nphi, d->cov->phitime);
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+write_cov_timings(hmpdf_obj *d, char *fname, uint64_t hash)
+// failure to write is not critical
+{//{{{
+    STARTFCT
+
+    char *tmp_fname;
+    SAFEALLOC(tmp_fname, malloc(strlen(fname) + 5));
+    sprintf(tmp_fname, "%s.tmp", fname);
+
+    int ok = 0;
+    FILE *f = fopen(tmp_fname, "wb");
+    if (f != NULL)
+    {
+        ok = fwrite(COV_TIMINGS_MAGIC, 1, sizeof COV_TIMINGS_MAGIC, f)
+             == sizeof COV_TIMINGS_MAGIC
+             && fwrite(&hash, sizeof(uint64_t), 1, f) == 1
+             && fwrite(&d->n->Nphi, sizeof(int), 1, f) == 1
+             && fwrite(d->cov->phitime, sizeof(double), d->n->Nphi, f)
+                == (size_t)d->n->Nphi;
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && (rename(tmp_fname, fname) == 0);
+    }
+    free(tmp_fname);
+
+    if (!ok)
+    {
+        HMPDFPRINT(1, "\t\tfailed to write timings file %s\n", fname);
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+cov_schedule(hmpdf_obj *d, int *order)
+// order in which create_cov processes the phi values.
+// If all phi values that remain to be computed have recorded timings,
+//     they are processed longest-first according to these,
+//     otherwise in the phi grid order (which is longest-first according
+//     to the cost model).
+{//{{{
+    STARTFCT
+
+    int have_all = 1;
+    for (int pp=0; pp<d->n->Nphi; pp++)
+    {
+        if (!d->cov->phidone[pp] && (pp % d->cov->Nshards == d->cov->shard)
+            && d->cov->phitime[pp] <= 0.0)
+        {
+            have_all = 0;
+            break;
+        }
+    }
+
+    phicost_t *c;
+    SAFEALLOC(c, malloc(d->n->Nphi * sizeof(phicost_t)));
+    for (int pp=0; pp<d->n->Nphi; pp++)
+    {
+        c[pp].cost = (have_all) ? d->cov->phitime[pp] : 0.0;
+        c[pp].idx = pp;
+    }
+
+    if (have_all)
+    {
+        qsort(c, d->n->Nphi, sizeof(phicost_t), comp_phicost);
+    }
+
+    for (int ii=0; ii<d->n->Nphi; ii++)
+    {
+        order[ii] = c[ii].idx;
+    }
+
+    free(c);
+
+    ENDFCT
+}//}}}
+
+static int
+alloc_cov(hmpdf_obj *d)
+// allocates and zeroes Cov, Cov_noisy, corr_diagn, phidone and phitime
+{//{{{
+    STARTFCT
+
+    SAFEALLOC(d->cov->Cov, malloc(d->n->Nsignal
+                                  * d->n->Nsignal
+                                  * sizeof(double)));
+    if (d->ns->have_noise)
+    {
+        SAFEALLOC(d->cov->Cov_noisy, malloc(d->n->Nsignal_noisy
+                                            * d->n->Nsignal_noisy
+                                            * sizeof(double)));
+    }
+    SAFEALLOC(d->cov->corr_diagn, malloc(d->n->Nphi * sizeof(double)));
+    SAFEALLOC(d->cov->phidone, calloc(d->n->Nphi, 1));
+    SAFEALLOC(d->cov->phitime, calloc(d->n->Nphi, sizeof(double)));
+
+    zero_real(d->n->Nsignal * d->n->Nsignal, d->cov->Cov);
+    if (d->ns->have_noise)
+    {
+        zero_real(d->n->Nsignal_noisy * d->n->Nsignal_noisy,
+                  d->cov->Cov_noisy);
+    }
+    zero_real(d->n->Nphi, d->cov->corr_diagn);
+
+    ENDFCT
+}//}}}
+
+static int
+create_cov(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    if (d->cov->created_cov) { return 0; }
+
+    HMPDFPRINT(2, "\tcreate_cov\n");
+
+    SAFEHMPDF(alloc_cov(d));
+
+    // per-thread accumulators, or locks for the striped fallback
+    SAFEHMPDF(alloc_cov_acc(d, d->n->Nsignal, &d->cov->acc));
+    if (d->ns->have_noise)
+    {
+        SAFEHMPDF(alloc_cov_acc(d, d->n->Nsignal_noisy, &d->cov->acc_noisy));
+    }
+    #ifdef _OPENMP
+    for (int ii=0; ii<COV_NSTRIPES; ii++)
+    {
+        omp_init_lock(d->cov->stripe_locks+ii);
+    }
+    #endif
+
+    // checkpointing and recorded timings
+    int checkpointing = strcmp(d->cov->checkpoint_fname, "none") != 0;
+    int timings = strcmp(d->cov->timings_fname, "none") != 0;
+    uint64_t hash = 0;
+    int Ndone = 0;
+    char *checkpoint_fname = NULL, *timings_fname = NULL;
+    // the timings are only an optimization, so they are not an error
+    if (timings && d->settings_unhashable != NULL)
+    {
+        HMPDFPRINT(1, "\t%s is passed, not using %s.\n",
+                      d->settings_unhashable, d->cov->timings_fname);
+        timings = 0;
+    }
+    if (checkpointing || timings)
+    {
+        SAFEHMPDF(cov_settings_hash(d, &hash));
+    }
+    if (checkpointing)
+    {
+        SAFEHMPDF(cov_shard_fname(d, d->cov->checkpoint_fname, &checkpoint_fname));
+        SAFEHMPDF(read_cov_checkpoint(d, checkpoint_fname, hash, &Ndone));
+    }
+    if (timings)
+    {
+        SAFEHMPDF(cov_shard_fname(d, d->cov->timings_fname, &timings_fname));
+        SAFEHMPDF(read_cov_timings(d, timings_fname, hash));
+    }
+
+    int *order;
+    SAFEALLOC(order, malloc(d->n->Nphi * sizeof(int)));
+    SAFEHMPDF(cov_schedule(d, order));
+
+    SAFEHMPDF(create_noise_groups(d));
+
+    // only part of the phi values if we compute a shard
+    int Ntodo = 0;
+    for (int pp=0; pp<d->n->Nphi; pp++)
+    {
+        Ntodo += !d->cov->phidone[pp] && (pp % d->cov->Nshards == d->cov->shard);
+    }
+
+    // status
+    int Nstatus = 0;
+    int zcompr_rank_max = 0;
+    time_t start_time = time(NULL);
+    time_t checkpoint_time = start_time;
+
+    // with checkpointing, the phi loop is split into chunks
+    // so that all accumulators are up to date in between
+    int chunk = (checkpointing) ? COV_CHECKPOINT_CHUNK * d->cov->Nws : d->n->Nphi;
+    
+    for (int p0=0; p0<d->n->Nphi; p0+=chunk)
+    {
+        int p1 = GSL_MIN(p0+chunk, d->n->Nphi);
+
+        // loop over phi values
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->cov->Nws) schedule(dynamic)
+        #endif
+        for (int ii=p0; ii<p1; ii++)
+        {
+            CONTINUE_IF_ERR
+
+            int pp = order[ii];
+
+            if (d->cov->phidone[pp] || (pp % d->cov->Nshards != d->cov->shard))
+            {
+                continue;
+            }
+
+            double t0 = cov_walltime();
+
+            // create twopoint at this phi
+            SAFEHMPDF_NORETURN(create_tp(d, d->n->phigrid[pp],
+                                         d->cov->ws[THIS_THREAD]));
+            CONTINUE_IF_ERR
+
+            // compute noisy two-point PDF if necessary
+            if (d->ns->have_noise && d->cov->noise_group[pp] < 0)
+            {
+                SAFEHMPDF_NORETURN(noise_matr(d, d->cov->ws[THIS_THREAD]->pdf_real,
+                                              NULL/*no separate output allocated*/,
+                                              1/*is buffered*/, d->n->phigrid[pp]));
+            }
+            CONTINUE_IF_ERR
+        
+            // compute the correlation function
+            SAFEHMPDF_NORETURN(corr_diagn(d, d->cov->ws[THIS_THREAD],
+                                          d->cov->corr_diagn+pp));
+            CONTINUE_IF_ERR
+
+            d->cov->phitime[pp] = cov_walltime() - t0;
+
+            // checkpoints are only written after the whole chunk is done
+            // (phi values with bad corr_diagn are done as well, they are never added)
+            d->cov->phidone[pp] = 1;
+
+            // status update
+            #ifdef _OPENMP
+            #   pragma omp critical(StatusCov)
+            #endif
+            {
+                ++Nstatus;
+                zcompr_rank_max = GSL_MAX(zcompr_rank_max,
+                                          d->cov->ws[THIS_THREAD]->zcompr_rank);
+                if ((Nstatus%COV_STATUS_PERIOD == 0) && (d->verbosity > 0))
+                {
+                    TIMEREMAIN(Nstatus, Ntodo, "create_cov");
+                }
+            }
+            CONTINUE_IF_ERR
+
+            // This is a pretty dirty hack but it should be ok for the low separations
+            // where we have a large number of sample points and a few mess up sometimes
+            // Always need to check the diagnostics that only a very small number of points
+            // is messed up!!!
+            if (d->cov->corr_diagn[pp] < 0.0 || d->cov->corr_diagn[pp] > 1e-3)
+                continue;
+        
+            // add to covariance
+            SAFEHMPDF_NORETURN(add_tp_to_cov(d, pp));
+            CONTINUE_IF_ERR
+        }
+
+        RETURN_IF_ERR
+
+        if (!checkpointing) { continue; }
+
+        time_t t1 = time(NULL);
+        if (difftime(t1, checkpoint_time) >= d->cov->checkpoint_period
+            || p1 == d->n->Nphi)
+        {
+            SAFEHMPDF(reduce_cov_acc(d, d->n->Nsignal, d->cov->acc, d->cov->Cov));
+            if (d->ns->have_noise)
+            {
+                SAFEHMPDF(flush_noise_groups(d));
+                SAFEHMPDF(reduce_cov_acc(d, d->n->Nsignal_noisy, d->cov->acc_noisy, d->cov->Cov_noisy));
+            }
+            SAFEHMPDF(write_cov_checkpoint(d, checkpoint_fname, hash));
+            checkpoint_time = t1;
+        }
+    }
+
+    // the batched noise convolutions
+    if (d->ns->have_noise)
+    {
+        SAFEHMPDF(flush_noise_groups(d));
+    }
+    SAFEHMPDF(free_noise_groups(d));
+
+    #ifdef _OPENMP
+    for (int ii=0; ii<COV_NSTRIPES; ii++)
+    {
+        omp_destroy_lock(d->cov->stripe_locks+ii);
+    }
+    #endif
+
+    free(order);
+    if (checkpoint_fname != NULL) { free(checkpoint_fname); }
+
+    if (timings)
+    {
+        SAFEHMPDF(write_cov_timings(d, timings_fname, hash));
+        free(timings_fname);
+    }
+
+    // sum the per-thread accumulators
+    SAFEHMPDF(reduce_cov_acc(d, d->n->Nsignal, d->cov->acc, d->cov->Cov));
+    SAFEHMPDF(free_cov_acc(d, &d->cov->acc));
+    if (d->ns->have_noise)
+    {
+        SAFEHMPDF(reduce_cov_acc(d, d->n->Nsignal_noisy, d->cov->acc_noisy, d->cov->Cov_noisy));
+        SAFEHMPDF(free_cov_acc(d, &d->cov->acc_noisy));
+    }
+
+    if (d->tp->zcompr_tol > 0.0)
+    {
+        HMPDFPRINT(1, "\t\tclustered term compressed to rank <= %d (from %d redshifts)\n",
+                      zcompr_rank_max, d->n->Nz);
+    }
+
+    // a shard only holds the partial sum, which is written to file
+    if (d->cov->Nshards > 1) { return 0; }
+
+    // subtract the one-point outer product
+    SAFEHMPDF(subtract_op_from_cov(d));
+
+    d->cov->created_cov = 1;
+
+    ENDFCT
+}//}}}
+
+static int
+prepare_cov_inputs(hmpdf_obj *d)
+// everything that is needed to identify the settings
+{//{{{
+    STARTFCT
+
+    // run necessary code from other modules
+    if (d->f->Nfilters > 0)
+    {
+        SAFEHMPDF(create_conj_profiles(d));
+        SAFEHMPDF(create_filtered_profiles(d));
+    }
+
+    SAFEHMPDF(create_segments(d));
+
+    SAFEHMPDF(create_op(d));
+
+    if (d->ns->have_noise)
+    {
+        SAFEHMPDF(create_noisy_op(d));
+        SAFEHMPDF(create_noise_matr_conv(d, d->Ncores));
+    }
+
+    SAFEHMPDF(create_corr(d));
 
-    SAFEHMPDF(create_phi_indep(d));
-    
     SAFEHMPDF(create_phigrid(d));
+
+    ENDFCT
+}//}}}
+
+static int
+prepare_cov(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(1, "prepare_cov\n");
+
+    SAFEHMPDF(prepare_cov_inputs(d));
+
+    // may have been merged from shard files
+    if (d->cov->created_cov) { return 0; }
+
+    SAFEHMPDF(create_phi_indep(d));
     
     SAFEHMPDF(create_tp_ws(d));
     
@@ -669,6 +1562,142 @@ prepare_cov(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
+int
+hmpdf_get_cov_shard(hmpdf_obj *d, int shard, int Nshards, char *fname)
+{//{{{
+    STARTFCT
+
+    CHECKINIT;
+
+    HMPDFCHECK(Nshards < 1 || shard < 0 || shard >= Nshards,
+               "invalid shard %d of %d.", shard, Nshards);
+
+    HMPDFPRINT(1, "hmpdf_get_cov_shard : %d of %d\n", shard, Nshards);
+
+    // fail before the expensive part, the shard could not be merged
+    HMPDFCHECK(d->settings_unhashable != NULL,
+               "%s is passed, so shard files cannot be matched to the settings "
+               "and are not supported.", d->settings_unhashable);
+
+    // a complete covariance matrix from a previous call would be overwritten
+    SAFEHMPDF(free_cov(d));
+
+    d->cov->shard = shard;
+    d->cov->Nshards = Nshards;
+    int status = prepare_cov(d);
+    d->cov->shard = 0;
+    d->cov->Nshards = 1;
+    if (status) { return status; }
+
+    uint64_t hash;
+    SAFEHMPDF(cov_settings_hash(d, &hash));
+
+    int ok;
+    SAFEHMPDF(write_cov_file(d, fname, hash, shard, Nshards, &ok));
+    HMPDFCHECK(!ok, "failed to write shard file %s.", fname);
+
+    // Cov is only a partial sum
+    SAFEHMPDF(free_cov(d));
+
+    ENDFCT
+}//}}}
+
+int
+hmpdf_merge_cov_shards(hmpdf_obj *d, int Nshards, char *fnames[Nshards])
+{//{{{
+    STARTFCT
+
+    CHECKINIT;
+
+    HMPDFPRINT(1, "hmpdf_merge_cov_shards\n");
+
+    // the shards may have been computed with different functions
+    HMPDFCHECK(d->settings_unhashable != NULL,
+               "%s is passed, so shard files cannot be matched to the settings "
+               "and are not supported.", d->settings_unhashable);
+
+    SAFEHMPDF(prepare_cov_inputs(d));
+
+    SAFEHMPDF(free_cov(d));
+    SAFEHMPDF(alloc_cov(d));
+
+    uint64_t hash;
+    SAFEHMPDF(cov_settings_hash(d, &hash));
+
+    long N = d->n->Nsignal;
+    long Nnoisy = (d->ns->have_noise) ? d->n->Nsignal_noisy : 0;
+
+    char *done, *shard_found;
+    double *corr_diagn, *cov, *cov_noisy = NULL;
+    SAFEALLOC(shard_found, calloc(Nshards, 1));
+    SAFEALLOC(done, malloc(d->n->Nphi));
+    SAFEALLOC(corr_diagn, malloc(d->n->Nphi * sizeof(double)));
+    SAFEALLOC(cov, malloc(N * N * sizeof(double)));
+    if (d->ns->have_noise)
+    {
+        SAFEALLOC(cov_noisy, malloc(Nnoisy * Nnoisy * sizeof(double)));
+    }
+
+    for (int ss=0; ss<Nshards; ss++)
+    {
+        HMPDFPRINT(2, "\treading shard file %s\n", fnames[ss]);
+
+        int ok, shard, file_Nshards;
+        SAFEHMPDF(read_cov_file(d, fnames[ss], hash, &shard, &file_Nshards,
+                                done, corr_diagn, cov, cov_noisy, &ok));
+        HMPDFCHECK(ok == -1, "shard file %s not found.", fnames[ss]);
+        HMPDFCHECK(ok == 0, "shard file %s was computed with different settings "
+                            "or is corrupted.", fnames[ss]);
+        HMPDFCHECK(file_Nshards != Nshards,
+                   "shard file %s is part of a split into %d, not %d.",
+                   fnames[ss], file_Nshards, Nshards);
+        HMPDFCHECK(shard < 0 || shard >= Nshards,
+                   "shard file %s has invalid index %d.", fnames[ss], shard);
+        HMPDFCHECK(shard_found[shard],
+                   "shard %d is contained in more than one file (%s).", shard, fnames[ss]);
+        shard_found[shard] = 1;
+
+        for (int pp=0; pp<d->n->Nphi; pp++)
+        {
+            if (!done[pp]) { continue; }
+            HMPDFCHECK(d->cov->phidone[pp],
+                       "phi index %d is contained in more than one shard file.", pp);
+            d->cov->phidone[pp] = 1;
+            d->cov->corr_diagn[pp] = corr_diagn[pp];
+        }
+
+        for (long ii=0; ii<N*N; ii++)
+        {
+            d->cov->Cov[ii] += cov[ii];
+        }
+        for (long ii=0; ii<Nnoisy*Nnoisy; ii++)
+        {
+            d->cov->Cov_noisy[ii] += cov_noisy[ii];
+        }
+    }
+
+    free(shard_found);
+    free(done);
+    free(corr_diagn);
+    free(cov);
+    if (cov_noisy != NULL) { free(cov_noisy); }
+
+    int Nmissing = 0;
+    for (int pp=0; pp<d->n->Nphi; pp++)
+    {
+        Nmissing += !d->cov->phidone[pp];
+    }
+    HMPDFCHECK(Nmissing, "%d of %d phi values are not contained in any shard file.",
+                         Nmissing, d->n->Nphi);
+
+    // subtract the one-point outer product
+    SAFEHMPDF(subtract_op_from_cov(d));
+
+    d->cov->created_cov = 1;
+
+    ENDFCT
+}//}}}
+
 int
 hmpdf_get_cov(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double cov[Nbins*Nbins], int noisy)
 {//{{{
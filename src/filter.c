@@ -58,7 +58,7 @@ reset_filters(hmpdf_obj *d)
         {
             if (d->f->quadraticpixel_accel[ii] != NULL)
             {
-                for (int jj=0; jj<d->Ncores; jj++)
+                for (int jj=0; jj<d->f->Nquadraticpixel_accel; jj++)
                 {
                     if (d->f->quadraticpixel_accel[ii][jj] != NULL)
                     {
@@ -150,10 +150,11 @@ create_quadraticpixelinterp(hmpdf_obj *d, filter_mode mode)
 
     SAFEALLOC(d->f->quadraticpixel_interp[mode],
               gsl_spline_alloc(gsl_interp_cspline, Nell));
+    d->f->Nquadraticpixel_accel = d->Ncores;
     SAFEALLOC(d->f->quadraticpixel_accel[mode],
-              malloc(d->Ncores * sizeof(gsl_interp_accel *)));
-    SETARRNULL(d->f->quadraticpixel_accel[mode], d->Ncores);
-    for (int ii=0; ii<d->Ncores; ii++)
+              malloc(d->f->Nquadraticpixel_accel * sizeof(gsl_interp_accel *)));
+    SETARRNULL(d->f->quadraticpixel_accel[mode], d->f->Nquadraticpixel_accel);
+    for (int ii=0; ii<d->f->Nquadraticpixel_accel; ii++)
     {
         SAFEALLOC(d->f->quadraticpixel_accel[mode][ii],
                   gsl_interp_accel_alloc());
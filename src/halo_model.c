@@ -52,7 +52,7 @@ reset_halo_model(hmpdf_obj *d)
     if (d->h->c_interp != NULL) { gsl_spline_free(d->h->c_interp); }
     if (d->h->c_accel != NULL)
     {
-        for (int ii=0; ii<d->Ncores; ii++)
+        for (int ii=0; ii<d->h->Nc_accel; ii++)
         {
             if (d->h->c_accel[ii] != NULL)
             {
@@ -221,9 +221,10 @@ create_c_of_y(hmpdf_obj *d)
         logy_grid[ii] = log(3.0) - 3.0*logc_grid[ii] + log(log1p(_c) - _c/(1.0+_c));
     }
     SAFEALLOC(d->h->c_interp, gsl_spline_alloc(gsl_interp_cspline, CINTERP_NC));
-    SAFEALLOC(d->h->c_accel,  malloc(d->Ncores * sizeof(gsl_interp_accel *)));
-    SETARRNULL(d->h->c_accel, d->Ncores);
-    for (int ii=0; ii<d->Ncores; ii++)
+    d->h->Nc_accel = d->Ncores;
+    SAFEALLOC(d->h->c_accel,  malloc(d->h->Nc_accel * sizeof(gsl_interp_accel *)));
+    SETARRNULL(d->h->c_accel, d->h->Nc_accel);
+    for (int ii=0; ii<d->h->Nc_accel; ii++)
     {
         SAFEALLOC(d->h->c_accel[ii], gsl_interp_accel_alloc());
     }
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <complex.h>
+
+#include <fftw3.h>
+
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_dht.h>
+#include <gsl/gsl_sf_bessel.h>
+#include <gsl/gsl_sf_gamma.h>
+
+#include "utils.h"
+#include "configs.h"
+#include "hankel.h"
+
+// The transform is
+//     out(k_m) = \int_0^xmax dx x J_0(k_m x) in(x) ,
+// with in sampled at x_n = j_{0,n+1} xmax / j_{0,N+1}
+// and k_m = j_{0,m+1} / xmax , as in gsl_dht_apply.
+//
+// The FFTLog version interpolates the input to a logarithmic grid,
+// uses the analytic transform of power laws
+//     \int_0^\infty dt t^{i\omega} J_0(t)
+//         = 2^{i\omega} \Gamma[(1+i\omega)/2] / \Gamma[(1-i\omega)/2] ,
+// and interpolates the result back to the k_m.
+// See Hamilton 2000 (astro-ph/9905191).
+
+// per-thread buffers and interpolators for FFTLog
+typedef struct//{{{
+{
+    double *y; // [ N+1 ], input with the zero at xmax appended
+    double *rbuf; // [ Nlog ]
+    double complex *cbuf; // [ Nlog/2+1 ]
+    interp1d *in; // on (xin, y)
+    interp1d *out; // on (lnk, rbuf)
+    #ifdef DEBUG
+    double *check; // [ N ]
+    long Ncalls;
+    #endif
+}//}}}
+fftlog_ws;
+
+struct
+hankel_s
+{//{{{
+    int N;
+    double xmax;
+    double *x; // [ N ]
+    double *k; // [ N ]
+
+    int fftlog;
+
+    // if !fftlog (and always in DEBUG mode, for comparison)
+    gsl_dht *dht;
+
+    // if fftlog
+    int Nlog;
+    double *xin; // [ N+1 ], x with xmax appended
+    double *r; // [ Nlog ]
+    double *lnk; // [ Nlog ]
+    double complex *u; // [ Nlog/2+1 ], includes FFT normalization
+    fftw_plan p_r2c;
+    fftw_plan p_c2r;
+    int Nws;
+    fftlog_ws *ws; // [ Nws ]
+};//}}}
+
+static int
+fftlog_kernel(double omega, double complex *out)
+// 2^{i\omega} \Gamma[(1+i\omega)/2] / \Gamma[(1-i\omega)/2],
+//     which has unit modulus
+{//{{{
+    STARTFCT
+
+    gsl_sf_result lnr, arg;
+    SAFEGSL(gsl_sf_lngamma_complex_e(0.5, 0.5*omega, &lnr, &arg));
+    *out = cexp(I * (omega * M_LN2 + 2.0 * arg.val));
+
+    ENDFCT
+}//}}}
+
+static int
+fftlog_size(int n)
+// smallest even number >= n without prime factors larger than 5
+{//{{{
+    for (n += n%2; ; n += 2)
+    {
+        int m = n;
+        while (m%2 == 0) { m /= 2; }
+        while (m%3 == 0) { m /= 3; }
+        while (m%5 == 0) { m /= 5; }
+        if (m == 1) { return n; }
+    }
+}//}}}
+
+static int
+new_fftlog_ws(hankel *h, fftlog_ws *ws)
+{//{{{
+    STARTFCT
+
+    SAFEALLOC(ws->y, malloc((h->N+1) * sizeof(double)));
+    SAFEALLOC(ws->rbuf, fftw_malloc(h->Nlog * sizeof(double)));
+    SAFEALLOC(ws->cbuf, fftw_malloc((h->Nlog/2+1) * sizeof(double complex)));
+
+    // the interpolators are re-initialized with the data in each call
+    zero_real(h->N+1, ws->y);
+    zero_real(h->Nlog, ws->rbuf);
+    SAFEHMPDF(new_interp1d(h->N+1, h->xin, ws->y, 0.0, 0.0,
+                           FFTLOG_INTERP_TYPE, NULL, &ws->in));
+    SAFEHMPDF(new_interp1d(h->Nlog, h->lnk, ws->rbuf, 0.0, 0.0,
+                           FFTLOG_INTERP_TYPE, NULL, &ws->out));
+
+    #ifdef DEBUG
+    SAFEALLOC(ws->check, malloc(h->N * sizeof(double)));
+    ws->Ncalls = 0;
+    #endif
+
+    ENDFCT
+}//}}}
+
+static void
+delete_fftlog_ws(fftlog_ws *ws)
+{//{{{
+    if (ws->in != NULL) { delete_interp1d(ws->in); }
+    if (ws->out != NULL) { delete_interp1d(ws->out); }
+    if (ws->y != NULL) { free(ws->y); }
+    if (ws->rbuf != NULL) { fftw_free(ws->rbuf); }
+    if (ws->cbuf != NULL) { fftw_free(ws->cbuf); }
+    #ifdef DEBUG
+    if (ws->check != NULL) { free(ws->check); }
+    #endif
+}//}}}
+
+static int
+new_fftlog(hankel *h, int Nthreads)
+{//{{{
+    STARTFCT
+
+    // logarithmic grid, zero padded beyond xmax.
+    // The accuracy is limited by the extent below the first sample.
+    //     The spacing is FFTLOG_SPACING times the input's log spacing at xmax,
+    //     The x_n are nearly uniform (dlnx ~ 1/N at xmax), so this coarser sampling
+    //     near xmax still resolves the smooth inputs, while the log grid is
+    //     much finer than the x_n at small x.
+    double r0 = h->x[0] / FFTLOG_XMIN_FACTOR;
+    double r1 = FFTLOG_PAD * h->xmax;
+    double lnrange = log(r1 / r0);
+    double dlnx = log(h->x[h->N-1] / h->x[h->N-2]);
+    h->Nlog = fftlog_size((int)ceil(lnrange / (FFTLOG_SPACING * dlnx)));
+    double dlnr = lnrange / (double)(h->Nlog - 1);
+
+    // low-ringing choice of k_0 r_0 (Hamilton 2000, eq. 186),
+    //     starting from k_0 = 1 / r_max
+    double omega_nyq = M_PI / dlnr;
+    double complex U;
+    SAFEHMPDF(fftlog_kernel(omega_nyq, &U));
+    double lnkr = -(double)(h->Nlog - 1) * dlnr;
+    double arg = (carg(U) - omega_nyq * lnkr) / M_PI;
+    lnkr += dlnr * (arg - round(arg));
+
+    SAFEALLOC(h->r,   malloc(h->Nlog * sizeof(double)));
+    SAFEALLOC(h->lnk, malloc(h->Nlog * sizeof(double)));
+    for (int ii=0; ii<h->Nlog; ii++)
+    {
+        h->r[ii] = r0 * exp((double)ii * dlnr);
+        h->lnk[ii] = lnkr - log(r0) + (double)ii * dlnr;
+    }
+
+    SAFEALLOC(h->u, malloc((h->Nlog/2+1) * sizeof(double complex)));
+    for (int ii=0; ii<=h->Nlog/2; ii++)
+    {
+        double omega = 2.0 * M_PI * (double)ii / ((double)h->Nlog * dlnr);
+        SAFEHMPDF(fftlog_kernel(omega, h->u+ii));
+        h->u[ii] *= cexp(-I * omega * lnkr) / (double)h->Nlog;
+    }
+    // this is real up to round-off because of the low-ringing condition
+    h->u[h->Nlog/2] = creal(h->u[h->Nlog/2]);
+
+    SAFEALLOC(h->xin, malloc((h->N+1) * sizeof(double)));
+    memcpy(h->xin, h->x, h->N * sizeof(double));
+    h->xin[h->N] = h->xmax;
+
+    h->Nws = Nthreads;
+    SAFEALLOC(h->ws, calloc(h->Nws, sizeof(fftlog_ws)));
+    for (int ii=0; ii<h->Nws; ii++)
+    {
+        SAFEHMPDF(new_fftlog_ws(h, h->ws+ii));
+    }
+
+    // the plans are executed with the new-array interface,
+    //     which is thread safe
+    h->p_r2c = fftw_plan_dft_r2c_1d(h->Nlog, h->ws[0].rbuf, h->ws[0].cbuf,
+                                    FFTLOG_PLAN_MODE);
+    h->p_c2r = fftw_plan_dft_c2r_1d(h->Nlog, h->ws[0].cbuf, h->ws[0].rbuf,
+                                    FFTLOG_PLAN_MODE);
+
+    ENDFCT
+}//}}}
+
+int
+new_hankel(int N, double xmax, int fftlog, int Nthreads, hankel **out)
+// hankel_apply can be called from threads 0 ... Nthreads-1 simultaneously
+{//{{{
+    STARTFCT
+
+    SAFEALLOC(*out, malloc(sizeof(hankel)));
+    hankel *h = *out;
+    h->N = N;
+    h->xmax = xmax;
+    h->fftlog = fftlog;
+    h->dht = NULL;
+    h->xin = NULL;
+    h->r = NULL;
+    h->lnk = NULL;
+    h->u = NULL;
+    h->p_r2c = NULL;
+    h->p_c2r = NULL;
+    h->ws = NULL;
+
+    SAFEALLOC(h->x, malloc(N * sizeof(double)));
+    SAFEALLOC(h->k, malloc(N * sizeof(double)));
+
+    if (fftlog)
+    {
+        double jN = gsl_sf_bessel_zero_J0(N+1);
+        for (int ii=0; ii<N; ii++)
+        {
+            double j = gsl_sf_bessel_zero_J0(ii+1);
+            h->x[ii] = j * xmax / jN;
+            h->k[ii] = j / xmax;
+        }
+        SAFEHMPDF(new_fftlog(h, Nthreads));
+
+        #ifdef DEBUG
+        SAFEALLOC(h->dht, gsl_dht_new(N, 0.0, xmax));
+        #endif
+    }
+    else
+    {
+        SAFEALLOC(h->dht, gsl_dht_new(N, 0.0, xmax));
+        for (int ii=0; ii<N; ii++)
+        {
+            h->x[ii] = gsl_dht_x_sample(h->dht, ii);
+            h->k[ii] = gsl_dht_k_sample(h->dht, ii);
+        }
+    }
+
+    ENDFCT
+}//}}}
+
+void
+delete_hankel(hankel *h)
+{//{{{
+    if (h->dht != NULL) { gsl_dht_free(h->dht); }
+    if (h->xin != NULL) { free(h->xin); }
+    if (h->r != NULL) { free(h->r); }
+    if (h->lnk != NULL) { free(h->lnk); }
+    if (h->u != NULL) { free(h->u); }
+    if (h->p_r2c != NULL) { fftw_destroy_plan(h->p_r2c); }
+    if (h->p_c2r != NULL) { fftw_destroy_plan(h->p_c2r); }
+    if (h->ws != NULL)
+    {
+        for (int ii=0; ii<h->Nws; ii++)
+        {
+            delete_fftlog_ws(h->ws+ii);
+        }
+        free(h->ws);
+    }
+    free(h->x);
+    free(h->k);
+    free(h);
+}//}}}
+
+double
+hankel_x_sample(hankel *h, int n)
+{//{{{
+    return h->x[n];
+}//}}}
+
+double
+hankel_k_sample(hankel *h, int n)
+{//{{{
+    return h->k[n];
+}//}}}
+
+static int
+apply_fftlog(hankel *h, fftlog_ws *ws, double *in, double *out)
+{//{{{
+    STARTFCT
+
+    // interpolate the input to the logarithmic grid,
+    //     it goes to zero at xmax and is constant below the first sample
+    memcpy(ws->y, in, h->N * sizeof(double));
+    ws->y[h->N] = 0.0;
+    SAFEHMPDF(interp1d_reinit(ws->in, ws->y[0], 0.0));
+    for (int ii=0; ii<h->Nlog; ii++)
+    {
+        SAFEHMPDF(interp1d_eval(ws->in, h->r[ii], ws->rbuf+ii));
+        // the power law transform is w.r.t. d(kr), hence one more power of r
+        ws->rbuf[ii] *= h->r[ii];
+    }
+
+    // convolve in log-space
+    fftw_execute_dft_r2c(h->p_r2c, ws->rbuf, ws->cbuf);
+    for (int ii=0; ii<=h->Nlog/2; ii++)
+    {
+        ws->cbuf[ii] = conj(ws->cbuf[ii] * h->u[ii]);
+    }
+    fftw_execute_dft_c2r(h->p_c2r, ws->cbuf, ws->rbuf);
+
+    // now rbuf = k * out(k) on the logarithmic k-grid,
+    //     interpolate to the requested k
+    for (int ii=0; ii<h->Nlog; ii++)
+    {
+        ws->rbuf[ii] *= exp(-h->lnk[ii]);
+    }
+    SAFEHMPDF(interp1d_reinit(ws->out, 0.0, 0.0));
+    for (int ii=0; ii<h->N; ii++)
+    {
+        SAFEHMPDF(interp1d_eval(ws->out, log(h->k[ii]), out+ii));
+    }
+
+    ENDFCT
+}//}}}
+
+#ifdef DEBUG
+static int
+check_fftlog(hankel *h, fftlog_ws *ws, double *in, double *out)
+// compares with the discrete Hankel transform on some of the calls
+{//{{{
+    STARTFCT
+
+    if ((ws->Ncalls++) % FFTLOG_CHECK_PERIOD != 0) { return 0; }
+
+    SAFEGSL(gsl_dht_apply(h->dht, in, ws->check));
+
+    double maxdiff = 0.0, maxval = 0.0;
+    for (int ii=0; ii<h->N; ii++)
+    {
+        maxdiff = GSL_MAX(maxdiff, fabs(out[ii] - ws->check[ii]));
+        maxval = GSL_MAX(maxval, fabs(ws->check[ii]));
+    }
+    HMPDFCHECK(maxdiff > FFTLOG_CHECK_TOL * maxval,
+               "FFTLog Hankel transform deviates from gsl_dht by %.2e "
+               "(relative to maximum).", maxdiff / maxval);
+
+    ENDFCT
+}//}}}
+#endif
+
+int
+hankel_apply(hankel *h, double *in, double *out)
+// thread safe for the number of threads passed to new_hankel
+{//{{{
+    STARTFCT
+
+    if (h->fftlog)
+    {
+        HMPDFCHECK(THIS_THREAD >= h->Nws,
+                   "hankel_apply called from thread %d, only %d workspaces.",
+                   THIS_THREAD, h->Nws);
+        SAFEHMPDF(apply_fftlog(h, h->ws+THIS_THREAD, in, out));
+        #ifdef DEBUG
+        SAFEHMPDF(check_fftlog(h, h->ws+THIS_THREAD, in, out));
+        #endif
+    }
+    else
+    {
+        SAFEGSL(gsl_dht_apply(h->dht, in, out));
+    }
+
+    ENDFCT
+}//}}}
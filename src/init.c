@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <math.h>
 
 #include "utils.h"
 #include "configs.h"
 #include "object.h"
 #include "class_interface.h"
+#include "lcdm.h"
 #include "cosmology.h"
 #include "numerics.h"
 #include "power.h"
@@ -41,6 +43,8 @@ typedef enum
     mc_type, // hmpdf_mass_cuts_f
     br_type, // hmpdf_bias_resc_f
     nz_type, // hmpdf_dndz_f
+    nzptr_type, // hmpdf_dndz_f *
+    vptrptr_type, // void **
 }//}}}
 dtype;
 
@@ -67,6 +71,8 @@ dtype;
             case (mc_type) : expr(hmpdf_mass_cuts_f); break;       \
             case (br_type) : expr(hmpdf_bias_resc_f); break;       \
             case (nz_type) : expr(hmpdf_dndz_f); break;            \
+            case (nzptr_type) : expr(hmpdf_dndz_f *); break;       \
+            case (vptrptr_type) : expr(void **); break;            \
             case (np_type) : expr(hmpdf_noise_pwr_f); break;       \
             default : HMPDFERR("Unknown dtype.");                  \
                       break;                                       \
@@ -187,6 +193,14 @@ init_params(hmpdf_obj *d, param *p)
            d->n->dndz, nz_type, def.dndz);
     INIT_P(hmpdf_dndz_params,
            d->n->dndz_params, vptr_type, def.dndz_params);
+    INIT_P(hmpdf_N_dndz,
+           d->n->Ndndz, int_type, def.Ndndz);
+    INIT_P(hmpdf_dndz_list,
+           d->n->dndz_list, nzptr_type, def.dndz_list);
+    INIT_P(hmpdf_dndz_params_list,
+           d->n->dndz_params_list, vptrptr_type, def.dndz_params_list);
+    INIT_P(hmpdf_dndz_index,
+           d->p->dndz_index, int_type, def.dndz_index);
     INIT_P_B(hmpdf_N_M,
              d->n->NM, int_type, def.Npoints_M);
     INIT_P_B(hmpdf_M_min,
@@ -309,6 +323,52 @@ init_params(hmpdf_obj *d, param *p)
            d->m->mappoisson, int_type, def.mappoisson);
     INIT_P(hmpdf_map_seed,
            d->m->mapseed, int_type, def.mapseed);
+    INIT_P_B(hmpdf_tp_zcompr_tol,
+             d->tp->zcompr_tol, dbl_type, def.tp_zcompr_tol);
+    INIT_P(hmpdf_cov_checkpoint,
+           d->cov->checkpoint_fname, str_type, def.cov_checkpoint);
+    INIT_P_B(hmpdf_cov_checkpoint_period,
+             d->cov->checkpoint_period, int_type, def.cov_checkpoint_period);
+    INIT_P(hmpdf_cov_timings,
+           d->cov->timings_fname, str_type, def.cov_timings);
+    INIT_P_B(hmpdf_cov_noise_zeta_tol,
+             d->cov->noise_zeta_tol, dbl_type, def.cov_noise_zeta_tol);
+    INIT_P(hmpdf_fftlog,
+           d->n->fftlog, int_type, def.fftlog);
+    INIT_P(hmpdf_fast_ssq,
+           d->pwr->fast_ssq, int_type, def.fast_ssq);
+    INIT_P(hmpdf_class_cache,
+           d->cls->class_cache, str_type, def.class_cache);
+    INIT_P(hmpdf_lcdm_params,
+           d->cls->lcdm_params, dptr_type, def.lcdm_params);
+    INIT_P(hmpdf_tab_Nz,
+           d->cls->tab_Nz, int_type, def.tab_Nz);
+    INIT_P(hmpdf_tab_z,
+           d->cls->tab_z, dptr_type, def.tab_z);
+    INIT_P(hmpdf_tab_H,
+           d->cls->tab_H, dptr_type, def.tab_H);
+    INIT_P(hmpdf_tab_comoving,
+           d->cls->tab_comoving, dptr_type, def.tab_comoving);
+    INIT_P(hmpdf_tab_angular_diameter,
+           d->cls->tab_angular_diameter, dptr_type, def.tab_angular_diameter);
+    INIT_P(hmpdf_tab_Dsq,
+           d->cls->tab_Dsq, dptr_type, def.tab_Dsq);
+    INIT_P(hmpdf_tab_Om,
+           d->cls->tab_Om, dptr_type, def.tab_Om);
+    INIT_P(hmpdf_tab_Nk,
+           d->cls->tab_Nk, int_type, def.tab_Nk);
+    INIT_P(hmpdf_tab_k,
+           d->cls->tab_k, dptr_type, def.tab_k);
+    INIT_P(hmpdf_tab_Pk,
+           d->cls->tab_Pk, dptr_type, def.tab_Pk);
+    INIT_P(hmpdf_tab_Omega_b,
+           d->cls->tab_Omega_b, dbl_type, def.tab_Omega_b);
+    INIT_P(hmpdf_map_tiled,
+           d->m->tiled, int_type, def.map_tiled);
+    INIT_P(hmpdf_map_stamp_cache,
+           d->m->stamp_cache_budget, dbl_type, def.map_stamp_cache);
+    INIT_P(hmpdf_map_zslices,
+           d->m->zslices, int_type, def.map_zslices);
 
     HMPDFCHECK(ctr != hmpdf_end_configs, "Not all params filled, ctr = %d.", ctr);
 
@@ -463,6 +523,160 @@ printval(char *f, void *val, dtype dt, int *printed)
 #undef PRINTVAL
 #undef WFORMATOFF
 #undef WFORMATON
+
+// hash the value, pointer types are hashed by address
+//     and marked volatile if they differ from the default
+//     since we cannot know whether the memory they point to changed
+//PARAM_HASH{{{
+#define PARAM_HASH(dt1)                                     \
+    do {                                                    \
+        *h = hash_bytes(*h, sizeof(dt1), p->target);        \
+        if (p->dt > end_comparable_dtypes                   \
+            && memcmp(p->target, p->def, sizeof(dt1)))      \
+        {                                                   \
+            *is_volatile = 1;                               \
+        }                                                   \
+    } while (0)
+//}}}
+
+static int
+param_hash(param *p, uint64_t *h, int *is_volatile)
+{//{{{
+    STARTFCT
+
+    if (p->dt == str_type)
+    // compare by content
+    {
+        char *str = *((char **)(p->target));
+        *h = hash_bytes(*h, strlen(str), str);
+    }
+    else
+    {
+        DT_DEP_ACTION(p->dt, PARAM_HASH);
+    }
+
+    ENDFCT
+}//}}}
+
+// options that do not change the one- and two-point outputs
+static const hmpdf_configs_e settings_hash_skip[] =
+    { hmpdf_N_threads, hmpdf_verbosity, hmpdf_warn_is_err, hmpdf_class_cache,
+      hmpdf_profiles_N, hmpdf_profiles_fnames, hmpdf_profiles_where,
+      hmpdf_profiles_Nr, hmpdf_profiles_r,
+      hmpdf_tot_profiles_N, hmpdf_tot_profiles_fnames, hmpdf_tot_profiles_where,
+      hmpdf_tot_profiles_Nr, hmpdf_tot_profiles_r,
+      hmpdf_cov_checkpoint, hmpdf_cov_checkpoint_period, hmpdf_cov_timings,
+      hmpdf_map_fsky, hmpdf_map_pixelgrid, hmpdf_map_poisson, hmpdf_map_seed,
+      hmpdf_map_tiled, hmpdf_map_stamp_cache, hmpdf_map_zslices, };
+
+// lengths of the fit parameter arrays (see hmpdf_configs.h)
+#define DUFFY08_NPARAMS 12
+#define TINKER10_NPARAMS 10
+#define BATTAGLIA12_NPARAMS 15
+
+static long
+settings_hash_len(hmpdf_obj *d, int idx)
+// number of doubles the option idx of dptr_type points to,
+//     -1 if not known
+{//{{{
+    switch (idx)
+    {
+        case (hmpdf_lcdm_params) : return lcdm_end;
+        case (hmpdf_tab_z) :
+        case (hmpdf_tab_H) :
+        case (hmpdf_tab_comoving) :
+        case (hmpdf_tab_angular_diameter) :
+        case (hmpdf_tab_Dsq) :
+        case (hmpdf_tab_Om) : return d->cls->tab_Nz;
+        case (hmpdf_tab_k) :
+        case (hmpdf_tab_Pk) : return d->cls->tab_Nk;
+        case (hmpdf_Duffy08_conc_params) :
+        case (hmpdf_DM_conc_params) :
+        case (hmpdf_bar_conc_params) : return DUFFY08_NPARAMS;
+        case (hmpdf_Tinker10_hmf_params) : return TINKER10_NPARAMS;
+        case (hmpdf_Battaglia12_tsz_params) : return BATTAGLIA12_NPARAMS;
+        case (hmpdf_Arico20_z) : return d->bcm->Arico20_Nz;
+        case (hmpdf_Arico20_params) : return d->bcm->Arico20_Nz * hmpdf_Arico20_Nparams;
+        default : return -1;
+    }
+}//}}}
+
+#undef DUFFY08_NPARAMS
+#undef TINKER10_NPARAMS
+#undef BATTAGLIA12_NPARAMS
+
+// comparable types are hashed by value, double arrays by content,
+//     other pointer types (functions and their parameters) cannot be hashed
+//     and are only recorded if they differ from the default
+//SETTINGS_HASH{{{
+#define SETTINGS_HASH(dt1)                                               \
+    do {                                                                 \
+        if (p[ii].dt < end_comparable_dtypes)                            \
+        {                                                                \
+            h = hash_bytes(h, sizeof(dt1), p[ii].target);                \
+        }                                                                \
+        else if (p[ii].dt == dptr_type && settings_hash_len(d, ii) >= 0) \
+        {                                                                \
+            double *arr = *((double **)(p[ii].target));                  \
+            long len = (arr == NULL) ? 0 : settings_hash_len(d, ii);     \
+            h = hash_bytes(h, sizeof(long), &len);                       \
+            h = hash_doubles(h, len, arr);                               \
+        }                                                                \
+        else if (memcmp(p[ii].target, p[ii].def, sizeof(dt1))            \
+                 && d->settings_unhashable == NULL)                      \
+        {                                                                \
+            d->settings_unhashable = p[ii].name;                         \
+        }                                                                \
+    } while (0)
+//}}}
+
+static int
+settings_hash(hmpdf_obj *d, param *p)
+// fingerprint of the inputs that identifies a computation across processes
+//     (e.g. for checkpoint and shard files).
+// Unlike the stage hashes, no addresses enter, the double arrays are hashed
+//     by content. If a function or its parameters are passed, the computation
+//     cannot be identified and d->settings_unhashable is set to its name.
+{//{{{
+    STARTFCT
+
+    uint64_t h = HASH_INIT;
+    d->settings_unhashable = NULL;
+
+    for (int ii=0; ii<hmpdf_end_configs; ii++)
+    {
+        int skip = 0;
+        for (size_t jj=0; jj<sizeof settings_hash_skip / sizeof settings_hash_skip[0]; jj++)
+        {
+            skip = skip || (ii == (int)settings_hash_skip[jj]);
+        }
+        if (skip) { continue; }
+
+        if (p[ii].dt == str_type)
+        {
+            char *str = *((char **)(p[ii].target));
+            h = hash_bytes(h, strlen(str), str);
+        }
+        else
+        {
+            DT_DEP_ACTION(p[ii].dt, SETTINGS_HASH);
+        }
+    }
+
+    h = hash_bytes(h, sizeof(hmpdf_signaltype_e), &(d->p->stype));
+    if (d->p->stype == hmpdf_kappa)
+    {
+        h = hash_bytes(h, sizeof(double), &(d->n->zsource));
+    }
+    SAFEHMPDF(class_inputs_hash(d, &h));
+
+    d->settings_hash = h;
+
+    ENDFCT
+}//}}}
+
+#undef SETTINGS_HASH
+#undef PARAM_HASH
 #undef DT_DEP_ACTION
 
 static int
@@ -498,6 +712,7 @@ unit_conversions(hmpdf_obj *d)
     d->f->tophat_radius  *= RADPERARCMIN;
     d->f->gaussian_sigma *= RADPERARCMIN / sqrt(8.0*M_LN2); // convert FWHM (input) to sigma
     d->m->area           *= 4.0 * M_PI; // convert fsky to area
+    d->m->stamp_cache_budget *= 1e9; // convert GB to bytes
 
     ENDFCT
 }//}}}
@@ -516,6 +731,26 @@ sanity_checks(hmpdf_obj *d)
     HMPDFCHECK(d->Ncores>1, "You specified hmpdf_N_threads = %d, "
                             "but code is compiled without OpenMP.", d->Ncores);
     #endif
+    HMPDFCHECK(d->cls->class_ini == NULL && d->cls->lcdm_params == NULL
+               && d->cls->tab_z == NULL,
+               "class_ini can only be NULL if hmpdf_lcdm_params or hmpdf_tab_z is passed.");
+    HMPDFCHECK(d->cls->lcdm_params != NULL && d->cls->tab_z != NULL,
+               "either use hmpdf_lcdm_params or the tabulated cosmology.");
+    HMPDFCHECK(d->cls->tab_z != NULL
+               && (d->cls->tab_Nz < 4 || d->cls->tab_H == NULL
+                   || d->cls->tab_comoving == NULL || d->cls->tab_angular_diameter == NULL
+                   || d->cls->tab_Dsq == NULL || d->cls->tab_Om == NULL
+                   || d->cls->tab_Nk < 4 || d->cls->tab_k == NULL || d->cls->tab_Pk == NULL
+                   || d->cls->tab_Omega_b < 0.0),
+               "incomplete tabulated cosmology, need all of hmpdf_tab_Nz ... hmpdf_tab_Omega_b.");
+    HMPDFCHECK(d->cls->lcdm_params != NULL
+               && (d->cls->lcdm_params[lcdm_h] <= 0.0
+                   || d->cls->lcdm_params[lcdm_Omega_m] <= 0.0
+                   || d->cls->lcdm_params[lcdm_Omega_m] > 1.0
+                   || d->cls->lcdm_params[lcdm_Omega_b] < 0.0
+                   || d->cls->lcdm_params[lcdm_Omega_b] >= d->cls->lcdm_params[lcdm_Omega_m]
+                   || d->cls->lcdm_params[lcdm_sigma_8] <= 0.0),
+               "Invalid hmpdf_lcdm_params.");
     HMPDFCHECK(d->n->signalmin >= d->n->signalmax,
                "hmpdf_signal_min must be less than hmpdf_signal_max.");
     HMPDFCHECK(d->n->zmin >= d->n->zmax,
@@ -536,24 +771,149 @@ sanity_checks(hmpdf_obj *d)
 
     HMPDFCHECK(d->n->dndz != NULL && d->p->stype != hmpdf_kappa,
                "dndz does not make sense for a non-WL signal");
+    HMPDFCHECK(d->n->Ndndz < 0,
+               "hmpdf_N_dndz must be non-negative.");
+    HMPDFCHECK(d->n->Ndndz > 0 && d->p->stype != hmpdf_kappa,
+               "dndz does not make sense for a non-WL signal");
+    HMPDFCHECK(d->n->Ndndz > 0 && d->n->dndz != NULL,
+               "either pass hmpdf_dndz or hmpdf_dndz_list");
+    HMPDFCHECK((d->n->Ndndz > 0) != (d->n->dndz_list != NULL),
+               "hmpdf_dndz_list must be passed together with positive hmpdf_N_dndz");
+    HMPDFCHECK(d->n->dndz_params_list != NULL && d->n->dndz_list == NULL,
+               "hmpdf_dndz_params_list passed without hmpdf_dndz_list");
+    HMPDFCHECK(d->p->dndz_index < 0
+               || d->p->dndz_index >= ((d->n->Ndndz > 0) ? d->n->Ndndz : 1),
+               "hmpdf_dndz_index out of range.");
+
+    HMPDFCHECK(d->m->zslices < 1,
+               "hmpdf_map_zslices must be positive.");
 
     ENDFCT
 }//}}}
 
+#define IN_MODULE(ptr, m) \
+    ((char *)(ptr) >= (char *)(m) && (char *)(ptr) < (char *)(m) + sizeof(*(m)))
+
+static int
+param_stages(hmpdf_obj *d, param *p)
+// returns bitmask of the stages that directly depend on this option
+{//{{{
+    if (p->target == &(d->Ncores))
+    {
+        // all stages that keep per-thread workspaces or interpolation accelerators
+        return (1<<stage_power) | (1<<stage_halo_model) | (1<<stage_filters)
+               | (1<<stage_bcm) | (1<<stage_profiles) | (1<<stage_noise)
+               | (1<<stage_onepoint);
+    }
+    return IN_MODULE(p->target, d->n) ? 1<<stage_numerics
+           : IN_MODULE(p->target, d->cls) ? 1<<stage_class_interface
+           : IN_MODULE(p->target, d->c) ? 1<<stage_cosmology
+           : IN_MODULE(p->target, d->pwr) ? 1<<stage_power
+           : IN_MODULE(p->target, d->h) ? 1<<stage_halo_model
+           : IN_MODULE(p->target, d->f) ? 1<<stage_filters
+           : IN_MODULE(p->target, d->bcm) ? 1<<stage_bcm
+           : IN_MODULE(p->target, d->p) ? 1<<stage_profiles
+           : IN_MODULE(p->target, d->ns) ? 1<<stage_noise
+           : IN_MODULE(p->target, d->op) ? 1<<stage_onepoint
+           // the remaining output products are always recomputed
+           : 0;
+}//}}}
+
+#undef IN_MODULE
+
+// direct dependencies between the stages
+//STAGE_DEPS{{{
+#define S(x) (1<<stage_##x)
+static const int stage_deps[stage_end] =
+    { [stage_numerics]        = 0,
+      [stage_class_interface] = 0,
+      [stage_cosmology]       = S(numerics) | S(class_interface),
+      [stage_power]           = S(numerics) | S(class_interface) | S(cosmology),
+      [stage_halo_model]      = S(numerics) | S(cosmology) | S(power),
+      [stage_filters]         = S(numerics) | S(cosmology),
+      [stage_bcm]             = S(numerics) | S(cosmology),
+      [stage_profiles]        = S(numerics) | S(cosmology) | S(halo_model)
+                                | S(filters) | S(bcm),
+      [stage_noise]           = S(numerics) | S(filters),
+      [stage_onepoint]        = S(numerics) | S(cosmology) | S(power)
+                                | S(halo_model) | S(filters) | S(profiles)
+                                | S(noise), };
+#undef S
+
+static const char *stage_names[stage_end] =
+    { "numerics", "class_interface", "cosmology", "power", "halo_model",
+      "filters", "bcm", "profiles", "noise", "onepoint", };
+//}}}
+
 static int
-compute_necessary_for_all(hmpdf_obj *d)
+find_dirty_stages(hmpdf_obj *d, param *p, int was_inited, int *dirty)
+// compares the inputs of each stage with those of the previous call
 {//{{{
     STARTFCT
 
-    SAFEHMPDF(init_numerics(d));
-    SAFEHMPDF(init_class_interface(d));
-    SAFEHMPDF(init_cosmology(d));
-    SAFEHMPDF(init_power(d));
-    SAFEHMPDF(init_halo_model(d));
-    SAFEHMPDF(init_filters(d));
-    SAFEHMPDF(init_bcm(d));
-    SAFEHMPDF(init_profiles(d));
-    SAFEHMPDF(init_noise(d));
+    uint64_t h[stage_end];
+    int is_volatile[stage_end];
+    for (int ss=0; ss<stage_end; ss++)
+    {
+        h[ss] = HASH_INIT;
+        is_volatile[ss] = 0;
+    }
+
+    for (int ii=0; ii<hmpdf_end_configs; ii++)
+    {
+        int stages = param_stages(d, p+ii);
+        for (int ss=0; ss<stage_end; ss++)
+        {
+            if (stages & (1<<ss))
+            {
+                SAFEHMPDF(param_hash(p+ii, h+ss, is_volatile+ss));
+            }
+        }
+    }
+
+    // the inputs that are not options
+    h[stage_numerics] = hash_bytes(h[stage_numerics], sizeof(hmpdf_signaltype_e),
+                                   &(d->p->stype));
+    if (d->p->stype == hmpdf_kappa)
+    {
+        h[stage_numerics] = hash_bytes(h[stage_numerics], sizeof(double),
+                                       &(d->n->zsource));
+    }
+    SAFEHMPDF(class_inputs_hash(d, h+stage_class_interface));
+
+    for (int ss=0; ss<stage_end; ss++)
+    {
+        dirty[ss] = !was_inited || is_volatile[ss] || h[ss] != d->stage_hash[ss];
+        // stages are ordered such that dependencies come first
+        for (int tt=0; tt<ss; tt++)
+        {
+            dirty[ss] = dirty[ss] || (dirty[tt] && (stage_deps[ss] & (1<<tt)));
+        }
+        d->stage_hash[ss] = h[ss];
+
+        if (!dirty[ss])
+        {
+            HMPDFPRINT(2, "\tkeeping %s\n", stage_names[ss]);
+        }
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+compute_necessary_for_all(hmpdf_obj *d, int *dirty)
+{//{{{
+    STARTFCT
+
+    if (dirty[stage_numerics]) { SAFEHMPDF(init_numerics(d)); }
+    if (dirty[stage_class_interface]) { SAFEHMPDF(init_class_interface(d)); }
+    if (dirty[stage_cosmology]) { SAFEHMPDF(init_cosmology(d)); }
+    if (dirty[stage_power]) { SAFEHMPDF(init_power(d)); }
+    if (dirty[stage_halo_model]) { SAFEHMPDF(init_halo_model(d)); }
+    if (dirty[stage_filters]) { SAFEHMPDF(init_filters(d)); }
+    if (dirty[stage_bcm]) { SAFEHMPDF(init_bcm(d)); }
+    if (dirty[stage_profiles]) { SAFEHMPDF(init_profiles(d)); }
+    if (dirty[stage_noise]) { SAFEHMPDF(init_noise(d)); }
 
     ENDFCT
 }//}}}
@@ -565,6 +925,9 @@ hmpdf_init_fct(hmpdf_obj *d, char *class_ini, hmpdf_signaltype_e stype, ...)
 
     gsl_set_error_handler(&new_gsl_error_handler);
 
+    // if the previous call completed, we only need to recompute
+    //     what depends on changed inputs
+    int was_inited = d->inited;
     d->inited = 0;
 
     d->cls->class_ini = class_ini;
@@ -627,21 +990,24 @@ hmpdf_init_fct(hmpdf_obj *d, char *class_ini, hmpdf_signaltype_e stype, ...)
         }
     }
 
-    free(p);
-
     // do necessary conversions
     SAFEHMPDF(unit_conversions(d));
 
     // perform basic sanity checks
     SAFEHMPDF(sanity_checks(d));
 
-    // this frees all the computed quantities,
-    // since we assume that each call of init changes some
-    // parameter (cosmological or numerical)
-    SAFEHMPDF(reset_obj(d));
+    // figure out which stages are affected by changed inputs
+    int dirty[stage_end];
+    SAFEHMPDF(find_dirty_stages(d, p, was_inited, dirty));
+    SAFEHMPDF(settings_hash(d, p));
+
+    free(p);
+
+    // this frees the computed quantities that depend on changed inputs
+    SAFEHMPDF(reset_stages(d, dirty));
 
     // compute things that we need for all output products
-    SAFEHMPDF(compute_necessary_for_all(d));
+    SAFEHMPDF(compute_necessary_for_all(d, dirty));
 
     d->inited = 1;
 
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <gsl/gsl_math.h>
+
+#include "configs.h"
+#include "utils.h"
+#include "object.h"
+#include "numerics.h"
+#include "class_interface.h"
+#include "lcdm.h"
+
+#include "hmpdf.h"
+
+// Flat LambdaCDM, radiation and massive neutrinos are neglected.
+// The background is integrated numerically on the table grid,
+// the linear power spectrum uses the Eisenstein & Hu (1998)
+// no-wiggle transfer function, normalized to sigma_8.
+
+static inline double
+E_of_lnzp1(double Om, double lnzp1)
+// H(z)/H0
+{//{{{
+    return sqrt(Om * exp(3.0*lnzp1) + 1.0 - Om);
+}//}}}
+
+static int
+fill_background(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    int N = d->cls->Nbg;
+    double Om = d->cls->Omega0_m;
+    double H0 = d->cls->H0;
+    double *x = d->cls->bg_lnzp1;
+    double dx = x[1] - x[0];
+
+    for (int ii=0; ii<N; ii++)
+    {
+        double E = E_of_lnzp1(Om, x[ii]);
+        d->cls->bg[bg_H][ii] = H0 * E;
+        d->cls->bg[bg_Om][ii] = Om * exp(3.0*x[ii]) / gsl_pow_2(E);
+    }
+
+    // chi = \int dln(1+z) (1+z)/H , Simpson on each interval
+    d->cls->bg[bg_comoving][0] = 0.0;
+    for (int ii=1; ii<N; ii++)
+    {
+        double xm = 0.5 * (x[ii-1] + x[ii]);
+        double f0 = exp(x[ii-1]) / E_of_lnzp1(Om, x[ii-1]);
+        double fm = exp(xm) / E_of_lnzp1(Om, xm);
+        double f1 = exp(x[ii]) / E_of_lnzp1(Om, x[ii]);
+        d->cls->bg[bg_comoving][ii] = d->cls->bg[bg_comoving][ii-1]
+                                      + dx / 6.0 * (f0 + 4.0*fm + f1) / H0;
+    }
+    for (int ii=0; ii<N; ii++)
+    {
+        d->cls->bg[bg_angular_diameter][ii] = d->cls->bg[bg_comoving][ii]
+                                              * exp(-x[ii]);
+    }
+
+    // D(a) \propto E(a) \int_0^a da' / (a' E(a'))^3
+    //      = E(a) \int dln(1+z) (1+z)^2 / E^3 ,
+    // integrated downwards from the top of the table,
+    // above which matter domination is assumed
+    double *D = d->cls->bg[bg_D];
+    D[N-1] = exp(-2.5*x[N-1]) / (2.5 * pow(Om, 1.5));
+    for (int ii=N-2; ii>=0; ii--)
+    {
+        double xm = 0.5 * (x[ii] + x[ii+1]);
+        double f0 = exp(2.0*x[ii]) / gsl_pow_3(E_of_lnzp1(Om, x[ii]));
+        double fm = exp(2.0*xm) / gsl_pow_3(E_of_lnzp1(Om, xm));
+        double f1 = exp(2.0*x[ii+1]) / gsl_pow_3(E_of_lnzp1(Om, x[ii+1]));
+        D[ii] = D[ii+1] + dx / 6.0 * (f0 + 4.0*fm + f1);
+    }
+    for (int ii=N-1; ii>=0; ii--)
+    {
+        D[ii] *= E_of_lnzp1(Om, x[ii]) / D[0];
+    }
+
+    ENDFCT
+}//}}}
+
+static double
+EH_nowiggle_T(double k, double h, double Om, double Ob)
+// k in 1/Mpc
+{//{{{
+    double theta = LCDM_TCMB / 2.7;
+    double omm = Om * h * h;
+    double omb = Ob * h * h;
+    double fb = Ob / Om;
+
+    double s = 44.5 * log(9.83/omm) / sqrt(1.0 + 10.0*pow(omb, 0.75)); // Mpc
+    double alpha = 1.0 - 0.328 * log(431.0*omm) * fb
+                   + 0.38 * log(22.3*omm) * fb * fb;
+    double Gamma = Om * h * (alpha + (1.0-alpha) / (1.0 + gsl_pow_4(0.43*k*s)));
+    double q = k * theta * theta / (h * Gamma);
+
+    double L = log(2.0*M_E + 1.8*q);
+    double C = 14.2 + 731.0 / (1.0 + 62.5*q);
+    return L / (L + C*q*q);
+}//}}}
+
+static inline double
+tophat_W(double x)
+{//{{{
+    return (x < 1e-3) ? 1.0 - 0.1*x*x
+           : 3.0 * (sin(x) - x*cos(x)) / gsl_pow_3(x);
+}//}}}
+
+static int
+fill_Pk(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    double *p = d->cls->lcdm_params;
+    double h = d->cls->h;
+
+    linspace(d->cls->NPk, log(PKINTERP_KMIN), log(LCDM_KMAX), d->cls->Pk_lnk);
+
+    // unnormalized P(k), and the sigma_8 integrand (Simpson needs odd N)
+    int Nint = d->cls->NPk - 1 + d->cls->NPk%2;
+    double *integrand;
+    SAFEALLOC(integrand, malloc(Nint * sizeof(double)));
+    double R8 = 8.0 / h; // Mpc
+    for (int ii=0; ii<d->cls->NPk; ii++)
+    {
+        double k = exp(d->cls->Pk_lnk[ii]);
+        double T = EH_nowiggle_T(k, h, d->cls->Omega0_m, d->cls->Omega0_b);
+        d->cls->Pk_lnPk[ii] = p[lcdm_n_s] * log(k) + 2.0 * log(T);
+        if (ii < Nint)
+        {
+            integrand[ii] = gsl_pow_3(k) * exp(d->cls->Pk_lnPk[ii])
+                            * gsl_pow_2(tophat_W(k*R8));
+        }
+    }
+    double ssq8 = integr_real(Nint, d->cls->Pk_lnk[1] - d->cls->Pk_lnk[0],
+                              1, integrand) / (2.0 * M_PI * M_PI);
+    free(integrand);
+
+    double lnA = 2.0 * log(p[lcdm_sigma_8]) - log(ssq8);
+    for (int ii=0; ii<d->cls->NPk; ii++)
+    {
+        d->cls->Pk_lnPk[ii] += lnA;
+    }
+
+    ENDFCT
+}//}}}
+
+int
+lcdm_fill_tables(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(2, "\tlcdm_fill_tables\n");
+
+    double *p = d->cls->lcdm_params;
+    d->cls->h = p[lcdm_h];
+    d->cls->H0 = p[lcdm_h] / SPEEDOFLIGHT; // 1/Mpc
+    d->cls->Omega0_m = p[lcdm_Omega_m];
+    d->cls->Omega0_b = p[lcdm_Omega_b];
+
+    linspace(d->cls->Nbg, 0.0, log1p(CLASSBG_ZMAX), d->cls->bg_lnzp1);
+
+    SAFEHMPDF(fill_background(d));
+    SAFEHMPDF(fill_Pk(d));
+
+    ENDFCT
+}//}}}
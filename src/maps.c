@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <limits.h>
 #include <complex.h>
@@ -12,7 +13,6 @@
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
-#include <gsl/gsl_histogram.h>
 
 #include "configs.h"
 #include "utils.h"
@@ -44,6 +44,25 @@ null_maps(hmpdf_obj *d)
     d->m->created_map_ws = 0;
     d->m->ws = NULL;
 
+    d->m->tgts = NULL;
+    #ifdef _OPENMP
+    d->m->tile_locks = NULL;
+    #endif
+
+    d->m->stamp_cache_used = 0;
+    d->m->stamp_index = NULL;
+    d->m->stamp_lru_head = NULL;
+    d->m->stamp_lru_tail = NULL;
+
+    d->m->conv_bins = NULL;
+    d->m->conv_N = NULL;
+    d->m->created_conv_buffers = 0;
+    d->m->conv_counts = NULL;
+    d->m->conv_stamp = NULL;
+    d->m->p_conv_counts_r2c = NULL;
+    d->m->p_conv_counts_c2r = NULL;
+    d->m->p_conv_stamp_r2c = NULL;
+
     ENDFCT
 }//}}}
 
@@ -87,6 +106,7 @@ reset_maps(hmpdf_obj *d)
                 }
                 if (d->m->ws[ii]->pos != NULL) { free(d->m->ws[ii]->pos); }
                 if (d->m->ws[ii]->buf != NULL) { free(d->m->ws[ii]->buf); }
+                if (d->m->ws[ii]->tilebuf != NULL) { free(d->m->ws[ii]->tilebuf); }
                 if (d->m->ws[ii]->rng != NULL) { gsl_rng_free(d->m->ws[ii]->rng); }
                 if (d->m->ws[ii]->p_r2c != NULL)
                 {
@@ -98,6 +118,35 @@ reset_maps(hmpdf_obj *d)
         }
         free(d->m->ws);
     }
+    #ifdef _OPENMP
+    if (d->m->tile_locks != NULL)
+    {
+        for (long ii=0; ii<d->m->Ntile_locks; ii++)
+        {
+            omp_destroy_lock(d->m->tile_locks+ii);
+        }
+        free(d->m->tile_locks);
+    }
+    #endif
+    if (d->m->tgts != NULL) { free(d->m->tgts); }
+    while (d->m->stamp_lru_head != NULL)
+    {
+        map_stamp *next = d->m->stamp_lru_head->next;
+        free(d->m->stamp_lru_head->buf);
+        free(d->m->stamp_lru_head);
+        d->m->stamp_lru_head = next;
+    }
+    if (d->m->stamp_index != NULL) { free(d->m->stamp_index); }
+    if (d->m->conv_bins != NULL) { free(d->m->conv_bins); }
+    if (d->m->conv_N != NULL) { free(d->m->conv_N); }
+    if (d->m->conv_counts != NULL) { fftw_free(d->m->conv_counts); }
+    if (d->m->conv_stamp != NULL) { fftw_free(d->m->conv_stamp); }
+    fftw_plan **plans[] = { &d->m->p_conv_counts_r2c, &d->m->p_conv_counts_c2r,
+                            &d->m->p_conv_stamp_r2c, };
+    for (int ii=0; ii<3; ii++)
+    {
+        if (*plans[ii] != NULL) { fftw_destroy_plan(**plans[ii]); free(*plans[ii]); }
+    }
 
     ENDFCT
 }//}}}
@@ -113,6 +162,8 @@ reset_maps(hmpdf_obj *d)
             { free(ws->pos); }         \
             if (ws->buf != NULL)       \
             { free(ws->buf); }         \
+            if (ws->tilebuf != NULL)   \
+            { free(ws->tilebuf); }     \
             free(*out);                \
             if (ws->rng != NULL)       \
             { gsl_rng_free(ws->rng); } \
@@ -134,10 +185,15 @@ new_map_ws(hmpdf_obj *d, int idx, map_ws **out)
     ws->map = NULL;
     ws->pos = NULL;
     ws->buf = NULL;
+    ws->tilebuf = NULL;
     ws->rng = NULL;
     ws->p_r2c = NULL;
 
-    if (idx == 0 && d->f->has_z_dependent)
+    // the 0th workspace map is also used as a buffer for FFTs,
+    //     as are the maps of all workspaces that hold a redshift slice.
+    //     Without z-dependent filters, each workspace may hold
+    //     a complete realization in hmpdf_get_map_ensemble
+    if (idx == 0 || idx < d->m->Nzslices || !(d->f->has_z_dependent))
     {
         ws->for_fft = 1;
         ws->ldmap = d->m->Nside+2;
@@ -158,6 +214,28 @@ new_map_ws(hmpdf_obj *d, int idx, map_ws **out)
     //     fast one
     NEWMAPWS_SAFEALLOC(ws->rng, gsl_rng_alloc(gsl_rng_taus));
 
+    if (d->m->tiled || d->m->Nzslices > 1)
+    {
+        NEWMAPWS_SAFEALLOC(ws->tilebuf, malloc(4 * MAPTILE_SIDE * MAPTILE_SIDE
+                                               * sizeof(double)));
+    }
+
+    // in the tiled mode, only the z-dependent loop needs a map,
+    //     in which the redshift slices are accumulated.
+    //     If the power spectrum is requested, the FFT buffer is allocated
+    //     in perform_map_FT
+    if (d->m->tiled && !(idx == 0 && d->f->has_z_dependent))
+    {
+        return 0;
+    }
+
+    // if several redshift slices are processed concurrently,
+    //     only the workspaces holding one of them need a map
+    if (d->m->Nzslices > 1 && idx >= d->m->Nzslices)
+    {
+        return 0;
+    }
+
     NEWMAPWS_SAFEALLOC(ws->map, ((ws->for_fft) ?
                                  fftw_malloc
                                  : malloc)(ws->ldmap * d->m->Nside
@@ -190,6 +268,11 @@ create_map_ws(hmpdf_obj *d)
     HMPDFPRINT(2, "\tcreate_map_ws\n");
     HMPDFPRINT(3, "\t\ttrying to allocate workspaces for %d threads.\n", d->Ncores);
 
+    // number of redshift slices in flight
+    //     (the tiled mode paints all slices into a single map)
+    d->m->Nzslices = (d->f->has_z_dependent && !(d->m->tiled)) ?
+                     GSL_MIN(d->m->zslices, GSL_MIN(d->Ncores, d->n->Nz)) : 1;
+
     SAFEALLOC(d->m->ws, malloc(d->Ncores * sizeof(map_ws *)));
     SETARRNULL(d->m->ws, d->Ncores);
     d->m->Nws = 0;
@@ -215,6 +298,33 @@ create_map_ws(hmpdf_obj *d)
 
     HMPDFCHECK(d->m->Nws<1, "Failed to allocate any workspaces.");
 
+    d->m->Nzslices = GSL_MIN(d->m->Nzslices, d->m->Nws);
+    if (d->m->Nzslices > 1)
+    {
+        HMPDFPRINT(3, "\t\tprocessing %d redshift slices concurrently.\n",
+                      d->m->Nzslices);
+    }
+
+    // in the tiled mode, all threads paint into one shared map,
+    //     with several redshift slices, they share the slices' maps
+    if (d->m->tiled || d->m->Nzslices > 1)
+    {
+        d->m->Ntiles = (d->m->Nside + MAPTILE_SIDE - 1) / MAPTILE_SIDE;
+        SAFEALLOC(d->m->tgts, malloc(d->m->Nzslices * sizeof(map_tgt)));
+        #ifdef _OPENMP
+        d->m->Ntile_locks = d->m->Nzslices * d->m->Ntiles * d->m->Ntiles;
+        SAFEALLOC(d->m->tile_locks, malloc(d->m->Ntile_locks * sizeof(omp_lock_t)));
+        for (long ii=0; ii<d->m->Ntile_locks; ii++)
+        {
+            omp_init_lock(d->m->tile_locks+ii);
+        }
+        for (int ii=0; ii<d->m->Nzslices; ii++)
+        {
+            d->m->tgts[ii].locks = d->m->tile_locks + ii * d->m->Ntiles * d->m->Ntiles;
+        }
+        #endif
+    }
+
     d->m->created_map_ws = 1;
 
     ENDFCT
@@ -270,14 +380,25 @@ reset_map_ws(hmpdf_obj *d, map_ws *ws)
     // seed the random number generator
     gsl_rng_set(ws->rng, seed);
 
-    zero_real(ws->ldmap * d->m->Nside, ws->map);
+    if (ws->map != NULL)
+    {
+        zero_real(ws->ldmap * d->m->Nside, ws->map);
+    }
 
     ENDFCT
 }//}}}
 
+static inline long
+stamp_halfwidth(hmpdf_obj *d, int z_index, int M_index)
+// the map of an object is of size (2*w+1)^2
+{//{{{
+    return (long)ceil(d->p->profiles[z_index][M_index][0] / d->f->pixelside);
+}//}}}
+
 static int
-fill_buf(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
-// creates a map of the given object in the buffer
+compute_buf(hmpdf_obj *d, int z_index, int M_index, double dx, double dy, map_ws *ws)
+// creates a map of the given object in the buffer,
+//     with its center displaced by (dx, dy) pixels
 {//{{{
     STARTFCT
 
@@ -286,15 +407,10 @@ fill_buf(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
                   / d->f->pixelside;
 
     // compute how large this specific map needs to be
-    //     the map is of size (2*w+1)^2
-    long w = (long)ceil(tout);
+    long w = stamp_halfwidth(d, z_index, M_index);
     ws->bufside = 2 * w + 1;
     long pixside = 2 * d->m->pxlgrid + 1;
 
-    // draw random displacement of the center of the halo
-    double dx = gsl_rng_uniform(ws->rng) - 0.5;
-    double dy = gsl_rng_uniform(ws->rng) - 0.5;
-
     long Npix_filled = 0;
     while (Npix_filled < ws->bufside * ws->bufside)
     {
@@ -345,6 +461,139 @@ fill_buf(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
     ENDFCT
 }//}}}
 
+static void
+stamp_lru_unlink(hmpdf_obj *d, map_stamp *st)
+{//{{{
+    if (st->prev != NULL) { st->prev->next = st->next; }
+    else { d->m->stamp_lru_head = st->next; }
+    if (st->next != NULL) { st->next->prev = st->prev; }
+    else { d->m->stamp_lru_tail = st->prev; }
+}//}}}
+
+static void
+stamp_lru_push(hmpdf_obj *d, map_stamp *st)
+{//{{{
+    st->prev = NULL;
+    st->next = d->m->stamp_lru_head;
+    if (d->m->stamp_lru_head != NULL) { d->m->stamp_lru_head->prev = st; }
+    else { d->m->stamp_lru_tail = st; }
+    d->m->stamp_lru_head = st;
+}//}}}
+
+static int
+stamp_cache_lookup(hmpdf_obj *d, long key, map_ws *ws, int *found)
+// if cached, copies the stamp into the buffer and marks it as recently used
+{//{{{
+    STARTFCT
+
+    *found = 0;
+
+    #ifdef _OPENMP
+    #   pragma omp critical(MapStampCache)
+    #endif
+    {
+        map_stamp *st = d->m->stamp_index[key];
+        if (st != NULL)
+        {
+            memcpy(ws->buf, st->buf, st->bufside * st->bufside * sizeof(double));
+            stamp_lru_unlink(d, st);
+            stamp_lru_push(d, st);
+            *found = 1;
+        }
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+stamp_cache_insert(hmpdf_obj *d, long key, map_ws *ws)
+// stores the stamp in the buffer, evicting least recently used ones
+//     as long as the memory budget is exceeded
+{//{{{
+    STARTFCT
+
+    size_t size = ws->bufside * ws->bufside * sizeof(double) + sizeof(map_stamp);
+    if ((double)size > d->m->stamp_cache_budget)
+    {
+        return 0;
+    }
+
+    // allocate outside the critical region
+    map_stamp *st;
+    SAFEALLOC(st, malloc(sizeof(map_stamp)));
+    SAFEALLOC(st->buf, malloc(ws->bufside * ws->bufside * sizeof(double)));
+    memcpy(st->buf, ws->buf, ws->bufside * ws->bufside * sizeof(double));
+    st->key = key;
+    st->bufside = ws->bufside;
+
+    #ifdef _OPENMP
+    #   pragma omp critical(MapStampCache)
+    #endif
+    {
+        if (d->m->stamp_index[key] != NULL)
+        // another thread was faster
+        {
+            free(st->buf);
+            free(st);
+        }
+        else
+        {
+            while ((double)(d->m->stamp_cache_used + size) > d->m->stamp_cache_budget)
+            {
+                map_stamp *old = d->m->stamp_lru_tail;
+                stamp_lru_unlink(d, old);
+                d->m->stamp_index[old->key] = NULL;
+                d->m->stamp_cache_used -= old->bufside * old->bufside * sizeof(double)
+                                          + sizeof(map_stamp);
+                free(old->buf);
+                free(old);
+            }
+            stamp_lru_push(d, st);
+            d->m->stamp_index[key] = st;
+            d->m->stamp_cache_used += size;
+        }
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+fill_buf(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
+// creates a map of the given object in the buffer,
+//     at a random sub-pixel position
+{//{{{
+    STARTFCT
+
+    if (d->m->stamp_index == NULL)
+    {
+        // draw random displacement of the center of the halo
+        double dx = gsl_rng_uniform(ws->rng) - 0.5;
+        double dy = gsl_rng_uniform(ws->rng) - 0.5;
+        SAFEHMPDF(compute_buf(d, z_index, M_index, dx, dy, ws));
+        return 0;
+    }
+
+    // draw a random point on the lattice of sub-pixel displacements
+    long ix = gsl_rng_uniform_int(ws->rng, MAPSTAMP_NSUB);
+    long iy = gsl_rng_uniform_int(ws->rng, MAPSTAMP_NSUB);
+    long key = ((long)(z_index * d->n->NM + M_index) * MAPSTAMP_NSUB + ix)
+               * MAPSTAMP_NSUB + iy;
+
+    ws->bufside = 2 * stamp_halfwidth(d, z_index, M_index) + 1;
+
+    int found;
+    SAFEHMPDF(stamp_cache_lookup(d, key, ws, &found));
+    if (!found)
+    {
+        double dx = ((double)ix + 0.5) / (double)MAPSTAMP_NSUB - 0.5;
+        double dy = ((double)iy + 0.5) / (double)MAPSTAMP_NSUB - 0.5;
+        SAFEHMPDF(compute_buf(d, z_index, M_index, dx, dy, ws));
+        SAFEHMPDF(stamp_cache_insert(d, key, ws));
+    }
+
+    ENDFCT
+}//}}}
+
 // convenience macro to reduce typing
 #define INNERLOOP_OP                      \
     ws->map[ixx*ws->ldmap + iyy]          \
@@ -367,6 +616,151 @@ add_buf_inner_loop(hmpdf_obj *d, map_ws *ws, long y0, long xx, long ixx)
     }
 }//}}}
 
+static void
+add_buf_tiled(hmpdf_obj *d, map_tgt *tgt, const double *src, long side, long x0, long y0)
+// adds the side x side array src at (x0, y0) into the shared map,
+//     locking one tile at a time
+{//{{{
+    long N = d->m->Nside;
+    long T = MAPTILE_SIDE;
+    double *map = tgt->map;
+    long ld = tgt->ldmap;
+
+    // with the periodic boundary conditions, the array covers
+    //     at most two contiguous ranges in each direction
+    //     [lo, hi) in the map, starting at off in the array
+    long xlo[] = { x0, 0, }, xhi[] = { GSL_MIN(x0+side, N), x0+side-N, };
+    long ylo[] = { y0, 0, }, yhi[] = { GSL_MIN(y0+side, N), y0+side-N, };
+    long xoff[] = { 0, N-x0, }, yoff[] = { 0, N-y0, };
+
+    for (int rx=0; rx<2; rx++)
+    {
+        for (int ry=0; ry<2; ry++)
+        {
+            if (xhi[rx] <= xlo[rx] || yhi[ry] <= ylo[ry])
+            {
+                continue;
+            }
+
+            for (long tx=xlo[rx]/T; tx<=(xhi[rx]-1)/T; tx++)
+            {
+                for (long ty=ylo[ry]/T; ty<=(yhi[ry]-1)/T; ty++)
+                {
+                    #ifdef _OPENMP
+                    omp_set_lock(tgt->locks + tx*d->m->Ntiles + ty);
+                    #endif
+
+                    for (long ixx=GSL_MAX(xlo[rx], tx*T);
+                         ixx<GSL_MIN(xhi[rx], (tx+1)*T); ixx++)
+                    {
+                        long xx = ixx - xlo[rx] + xoff[rx];
+                        for (long iyy=GSL_MAX(ylo[ry], ty*T);
+                             iyy<GSL_MIN(yhi[ry], (ty+1)*T); iyy++)
+                        {
+                            long yy = iyy - ylo[ry] + yoff[ry];
+                            map[ixx*ld + iyy] += src[xx*side + yy];
+                        }
+                    }
+
+                    #ifdef _OPENMP
+                    omp_unset_lock(tgt->locks + tx*d->m->Ntiles + ty);
+                    #endif
+                }
+            }
+        }
+    }
+}//}}}
+
+static int
+comp_long(const void *a, const void *b)
+// to qsort an array of longs
+{//{{{
+    long long_a = *((long *)(a));
+    long long_b = *((long *)(b));
+    return (long_a > long_b) - (long_a < long_b);
+}//}}}
+
+static int
+add_bufs_tiled(hmpdf_obj *d, map_ws *ws, map_tgt *tgt, unsigned N)
+// adds the buffer N times at random positions into the shared map.
+//     The halos are sorted by the tile their corner falls into,
+//     and all halos of one tile are summed in the thread's tilebuf
+//     (which covers the tile and the overhang of the halos),
+//     which is then flushed into the map under the tile locks.
+//     This way, the locks are taken once per tile instead of once per halo.
+{//{{{
+    STARTFCT
+
+    long T = MAPTILE_SIDE;
+    long side = T + ws->bufside - 1;
+
+    // the halos are too large to be collected around a tile
+    if (ws->bufside > T || side > d->m->Nside)
+    {
+        for (unsigned ii=0; ii<N; ii++)
+        {
+            long x0 = gsl_rng_uniform_int(ws->rng, d->m->Nside);
+            long y0 = gsl_rng_uniform_int(ws->rng, d->m->Nside);
+            add_buf_tiled(d, tgt, ws->buf, ws->bufside, x0, y0);
+        }
+        return 0;
+    }
+
+    // key = tile * T^2 + offset within the tile
+    long *keys;
+    SAFEALLOC(keys, malloc(N * sizeof(long)));
+    for (unsigned ii=0; ii<N; ii++)
+    {
+        long x0 = gsl_rng_uniform_int(ws->rng, d->m->Nside);
+        long y0 = gsl_rng_uniform_int(ws->rng, d->m->Nside);
+        keys[ii] = ((x0/T) * d->m->Ntiles + y0/T) * T * T
+                   + (x0%T) * T + y0%T;
+    }
+    qsort(keys, N, sizeof(long), comp_long);
+
+    for (unsigned start=0, end; start<N; start=end)
+    {
+        long tile = keys[start] / (T*T);
+        for (end=start; end<N && keys[end]/(T*T) == tile; end++);
+
+        // for few halos, flushing the whole tilebuf is more expensive
+        //     than adding them one by one
+        if ((double)(end-start) * (double)(ws->bufside * ws->bufside)
+            < (double)(side * side))
+        {
+            for (unsigned ii=start; ii<end; ii++)
+            {
+                add_buf_tiled(d, tgt, ws->buf, ws->bufside,
+                              (tile/d->m->Ntiles)*T + (keys[ii]%(T*T))/T,
+                              (tile%d->m->Ntiles)*T + keys[ii]%T);
+            }
+            continue;
+        }
+
+        zero_real(side*side, ws->tilebuf);
+        for (unsigned ii=start; ii<end; ii++)
+        {
+            long lx = (keys[ii]%(T*T)) / T;
+            long ly = keys[ii] % T;
+            for (long xx=0; xx<ws->bufside; xx++)
+            {
+                double *restrict dst = ws->tilebuf + (lx+xx)*side + ly;
+                const double *restrict src = ws->buf + xx*ws->bufside;
+                for (long yy=0; yy<ws->bufside; yy++)
+                {
+                    dst[yy] += src[yy];
+                }
+            }
+        }
+        add_buf_tiled(d, tgt, ws->tilebuf, side,
+                      (tile/d->m->Ntiles)*T, (tile%d->m->Ntiles)*T);
+    }
+
+    free(keys);
+
+    ENDFCT
+}//}}}
+
 #define OUTERLOOP_OP \
     add_buf_inner_loop(d, ws, y0, xx, ixx);
 
@@ -407,19 +801,36 @@ add_buf(hmpdf_obj *d, map_ws *ws)
 #undef OUTERLOOP_OP
 #undef INNERLOOP_OP
 
+static double
+expected_N_halos(hmpdf_obj *d, int z_index, int M_index)
+// expected number of halos in the given bin
+{//{{{
+    return d->h->hmf[z_index][M_index] // dn_3d / dlogM
+           * gsl_pow_2(d->c->comoving[z_index])
+           / d->c->hubble[z_index]
+           * d->n->zweights[z_index]
+           * d->n->Mweights[M_index]
+           * d->m->area;
+}//}}}
+
+static int
+conv_is_cheaper(hmpdf_obj *d, int z_index, int M_index, double N)
+// rough cost estimates for painting N halos of the given bin,
+//     by scattering the stamps or by convolution (paint_conv_bins)
+{//{{{
+    double Npix = (double)(d->m->Nside * d->m->Nside);
+    double scatter_cost = N * gsl_pow_2((double)(2*stamp_halfwidth(d, z_index, M_index)+1));
+    double conv_cost = N + MAPCONV_FFT_COST * Npix * log2(Npix);
+    return scatter_cost > conv_cost;
+}//}}}
+
 static int
 draw_N_halos(hmpdf_obj *d, int z_index, int M_index, map_ws *ws, unsigned *N)
 // draws the number of halos in the given bin
 {//{{{
     STARTFCT
 
-    // expected number of halos in this bin
-    double n = d->h->hmf[z_index][M_index] // dn_3d / dlogM
-               * gsl_pow_2(d->c->comoving[z_index])
-               / d->c->hubble[z_index]
-               * d->n->zweights[z_index]
-               * d->n->Mweights[M_index]
-               * d->m->area;
+    double n = expected_N_halos(d, z_index, M_index);
 
     if (d->m->mappoisson)
     {
@@ -440,10 +851,13 @@ draw_N_halos(hmpdf_obj *d, int z_index, int M_index, map_ws *ws, unsigned *N)
 }//}}}
 
 static int
-do_this_bin(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
+do_this_bin(hmpdf_obj *d, int z_index, int M_index, map_ws *ws, map_tgt *tgt,
+            int may_defer)
 // draws random integer from correct distribution
 // if ==0, return
-// else, fill_buf and then integer x add_buf
+// else, if scattering the halos is cheaper, fill_buf and then integer x add_buf,
+//       otherwise defer the bin to paint_conv_bins (if may_defer, not in the tiled mode)
+// the halos are added to ws->map, or to the shared map tgt if not NULL
 {//{{{
     STARTFCT
 
@@ -454,6 +868,20 @@ do_this_bin(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
     {
         return 0;
     }
+
+    // the tiled mode does not have the memory for the full-size convolution grids
+    if (may_defer && !(d->m->tiled) && conv_is_cheaper(d, z_index, M_index, (double)N))
+    {
+        int idx;
+        #ifdef _OPENMP
+        #   pragma omp critical(MapConvBins)
+        #endif
+        {
+            idx = d->m->Nconv++;
+        }
+        d->m->conv_bins[idx] = z_index * d->n->NM + M_index;
+        d->m->conv_N[idx] = N;
+    }
     else
     {
         SAFEHMPDF(fill_buf(d, z_index, M_index, ws));
@@ -462,9 +890,16 @@ do_this_bin(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
                    "attempting to add a halo that is larger than the map. "
                    "You should make the map larger.");
 
-        for (unsigned ii=0; ii<N; ii++)
+        if (tgt != NULL)
+        {
+            SAFEHMPDF(add_bufs_tiled(d, ws, tgt, N));
+        }
+        else
         {
-            SAFEHMPDF(add_buf(d, ws));
+            for (unsigned ii=0; ii<N; ii++)
+            {
+                SAFEHMPDF(add_buf(d, ws));
+            }
         }
     }
 
@@ -472,49 +907,115 @@ do_this_bin(hmpdf_obj *d, int z_index, int M_index, map_ws *ws)
 }//}}}
 
 static int
-add_grf(hmpdf_obj *d, double (*pwr_spec)(double, void *), void *pwr_spec_params)
-// adds random GRF realization to the Fourier space map
-// if pwr_spec == NULL, no computation is performed
+create_conv_buffers(hmpdf_obj *d)
 {//{{{
     STARTFCT
 
-    if (pwr_spec == NULL)
-    {
-        return 0;
-    }
-    else
+    if (d->m->created_conv_buffers) { return 0; }
+
+    HMPDFPRINT(2, "\tcreate_conv_buffers\n");
+
+    SAFEALLOC(d->m->conv_counts, fftw_malloc(d->m->Nside * (d->m->Nside+2)
+                                             * sizeof(double)));
+    d->m->conv_counts_comp = (double complex *)d->m->conv_counts;
+    SAFEALLOC(d->m->conv_stamp, fftw_malloc(d->m->Nside * (d->m->Nside+2)
+                                            * sizeof(double)));
+    d->m->conv_stamp_comp = (double complex *)d->m->conv_stamp;
+
+    SAFEALLOC(d->m->p_conv_counts_r2c, malloc(sizeof(fftw_plan)));
+    *(d->m->p_conv_counts_r2c) = fftw_plan_dft_r2c_2d(d->m->Nside, d->m->Nside,
+                                                      d->m->conv_counts,
+                                                      d->m->conv_counts_comp,
+                                                      FFTW_ESTIMATE);
+    SAFEALLOC(d->m->p_conv_counts_c2r, malloc(sizeof(fftw_plan)));
+    *(d->m->p_conv_counts_c2r) = fftw_plan_dft_c2r_2d(d->m->Nside, d->m->Nside,
+                                                      d->m->conv_counts_comp,
+                                                      d->m->conv_counts,
+                                                      FFTW_ESTIMATE);
+    SAFEALLOC(d->m->p_conv_stamp_r2c, malloc(sizeof(fftw_plan)));
+    *(d->m->p_conv_stamp_r2c) = fftw_plan_dft_r2c_2d(d->m->Nside, d->m->Nside,
+                                                     d->m->conv_stamp,
+                                                     d->m->conv_stamp_comp,
+                                                     FFTW_ESTIMATE);
+
+    d->m->created_conv_buffers = 1;
+
+    ENDFCT
+}//}}}
+
+static int
+paint_conv_bins(hmpdf_obj *d, double *map, long ldmap, int z_index)
+// paints the deferred bins into map:
+//     the halo centers are deposited onto a count grid
+//     which is then convolved with the object's stamp.
+//     This is the same as add_buf at each of the centers.
+// if z_index is non-negative, only the bins at this redshift are painted
+{//{{{
+    STARTFCT
+
+    if (d->m->Nconv == 0) { return 0; }
+
+    HMPDFPRINT(3, "\t\tpainting %d bins by convolution\n", d->m->Nconv);
+
+    SAFEHMPDF(create_conv_buffers(d));
+
+    // we are outside the parallel region, so this workspace is free
+    map_ws *ws = d->m->ws[0];
+    long ld = d->m->Nside + 2;
+    double norm = 1.0 / (double)(d->m->Nside * d->m->Nside);
+
+    for (int cc=0; cc<d->m->Nconv; cc++)
     {
-        HMPDFPRINT(2, "\tadding Gaussian random field to the map\n");
+        int this_z_index = d->m->conv_bins[cc] / d->n->NM;
+        int M_index = d->m->conv_bins[cc] % d->n->NM;
 
-        #ifdef _OPENMP
-        #   pragma omp parallel for num_threads(d->m->Nws) schedule(static)
-        #endif
-        for (long ii=0; ii<d->m->Nside; ii++)
-        // loop over the long direction (rows)
+        if (z_index >= 0 && this_z_index != z_index)
         {
-            double ell1 = WAVENR(d->m->Nside, d->m->ellgrid, ii);
+            continue;
+        }
 
-            for (long jj=0; jj<d->m->Nside/2+1; jj++)
-            {
-                CONTINUE_IF_ERR
+        SAFEHMPDF(fill_buf(d, this_z_index, M_index, ws));
 
-                double ell2 = WAVENR(d->m->Nside, d->m->ellgrid, jj);
-                double ellmod = hypot(ell1, ell2);
+        HMPDFCHECK(ws->bufside >= d->m->Nside,
+                   "attempting to add a halo that is larger than the map. "
+                   "You should make the map larger.");
 
-                double Cl = pwr_spec(ellmod, pwr_spec_params);
+        zero_real(d->m->Nside * ld, d->m->conv_stamp);
+        for (long xx=0; xx<ws->bufside; xx++)
+        {
+            memcpy(d->m->conv_stamp + xx*ld, ws->buf + xx*ws->bufside,
+                   ws->bufside * sizeof(double));
+        }
 
-                HMPDFCHECK_NORETURN(Cl < 0.0,
-                                    "power spectrum must be positive everywhere.");
-                
-                CONTINUE_IF_ERR
+        zero_real(d->m->Nside * ld, d->m->conv_counts);
+        for (unsigned ii=0; ii<d->m->conv_N[cc]; ii++)
+        {
+            long x0 = gsl_rng_uniform_int(ws->rng, d->m->Nside);
+            long y0 = gsl_rng_uniform_int(ws->rng, d->m->Nside);
+            d->m->conv_counts[x0*ld + y0] += 1.0;
+        }
+
+        fftw_execute(*(d->m->p_conv_stamp_r2c));
+        fftw_execute(*(d->m->p_conv_counts_r2c));
+
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+        #endif
+        for (long ii=0; ii<d->m->Nside * (d->m->Nside/2+1); ii++)
+        {
+            d->m->conv_counts_comp[ii] *= d->m->conv_stamp_comp[ii] * norm;
+        }
 
-                double complex ampl
-                    = gsl_ran_gaussian(d->m->ws[THIS_THREAD]->rng, 1.0)
-                      + _Complex_I * gsl_ran_gaussian(d->m->ws[THIS_THREAD]->rng, 1.0);
-                ampl *= sqrt(0.5 * Cl) / d->f->pixelside
-                        * (double)(d->m->Nside);
+        fftw_execute(*(d->m->p_conv_counts_c2r));
 
-                d->m->map_comp[ii*(d->m->Nside/2+1)+jj] += ampl;
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+        #endif
+        for (long ii=0; ii<d->m->Nside; ii++)
+        {
+            for (long jj=0; jj<d->m->Nside; jj++)
+            {
+                map[ii*ldmap + jj] += d->m->conv_counts[ii*ld + jj];
             }
         }
     }
@@ -523,45 +1024,116 @@ add_grf(hmpdf_obj *d, double (*pwr_spec)(double, void *), void *pwr_spec_params)
 }//}}}
 
 static int
-filter_map(hmpdf_obj *d, double complex *map_comp, int *z_index)
+add_grf_row(hmpdf_obj *d, double (*pwr_spec)(double, void *), void *pwr_spec_params,
+            long ii, gsl_rng *rng, double complex *map_comp)
+// adds random GRF realization to row ii of the Fourier space map
 {//{{{
     STARTFCT
 
-    if (z_index == NULL)
-    {
-        HMPDFPRINT(3, "\t\tapplying filters to the map\n");
-    }
+    double ell1 = WAVENR(d->m->Nside, d->m->ellgrid, ii);
 
-    #ifdef _OPENMP
-    #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
-    #endif
-    for (long ii=0; ii<d->m->Nside; ii++)
-    // loop over long direction (rows)
+    for (long jj=0; jj<d->m->Nside/2+1; jj++)
     {
-        CONTINUE_IF_ERR
+        double ell2 = WAVENR(d->m->Nside, d->m->ellgrid, jj);
+        double ellmod = hypot(ell1, ell2);
 
-        double *ellmod;
-        SAFEALLOC_NORETURN(ellmod, malloc((d->m->Nside/2+1) * sizeof(double)));
+        double Cl = pwr_spec(ellmod, pwr_spec_params);
 
-        CONTINUE_IF_ERR
+        HMPDFCHECK(Cl < 0.0,
+                   "power spectrum must be positive everywhere.");
 
-        double ell1 = WAVENR(d->m->Nside, d->m->ellgrid, ii);
+        double complex ampl
+            = gsl_ran_gaussian(rng, 1.0)
+              + _Complex_I * gsl_ran_gaussian(rng, 1.0);
+        ampl *= sqrt(0.5 * Cl) / d->f->pixelside
+                * (double)(d->m->Nside);
 
-        for (long jj=0; jj<d->m->Nside/2+1; jj++)
-        // loop over short direction (cols)
-        {
-            double ell2 = WAVENR(d->m->Nside, d->m->ellgrid, jj);
-            ellmod[jj] = hypot(ell1, ell2);
-        }
+        map_comp[ii*(d->m->Nside/2+1)+jj] += ampl;
+    }
 
-        SAFEHMPDF_NORETURN(apply_filters_map(d, d->m->Nside/2+1, ellmod,
-                                             map_comp + ii * (d->m->Nside/2+1),
-                                             map_comp + ii * (d->m->Nside/2+1),
-                                             z_index));
+    ENDFCT
+}//}}}
+
+static int
+add_grf(hmpdf_obj *d, double (*pwr_spec)(double, void *), void *pwr_spec_params)
+// adds random GRF realization to the Fourier space map
+// if pwr_spec == NULL, no computation is performed
+{//{{{
+    STARTFCT
+
+    if (pwr_spec == NULL)
+    {
+        return 0;
+    }
+    else
+    {
+        HMPDFPRINT(2, "\tadding Gaussian random field to the map\n");
+
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->m->Nws) schedule(static)
+        #endif
+        for (long ii=0; ii<d->m->Nside; ii++)
+        // loop over the long direction (rows)
+        {
+            CONTINUE_IF_ERR
+
+            SAFEHMPDF_NORETURN(add_grf_row(d, pwr_spec, pwr_spec_params, ii,
+                                           d->m->ws[THIS_THREAD]->rng,
+                                           d->m->map_comp));
+        }
+    }
 
-        free(ellmod);
+    ENDFCT
+}//}}}
+
+static int
+filter_map_row(hmpdf_obj *d, double complex *map_comp, long ii, int *z_index)
+// applies the filters to row ii of the Fourier space map
+{//{{{
+    STARTFCT
+
+    double *ellmod;
+    SAFEALLOC(ellmod, malloc((d->m->Nside/2+1) * sizeof(double)));
+
+    double ell1 = WAVENR(d->m->Nside, d->m->ellgrid, ii);
+
+    for (long jj=0; jj<d->m->Nside/2+1; jj++)
+    // loop over short direction (cols)
+    {
+        double ell2 = WAVENR(d->m->Nside, d->m->ellgrid, jj);
+        ellmod[jj] = hypot(ell1, ell2);
     }
 
+    SAFEHMPDF(apply_filters_map(d, d->m->Nside/2+1, ellmod,
+                                map_comp + ii * (d->m->Nside/2+1),
+                                map_comp + ii * (d->m->Nside/2+1),
+                                z_index));
+
+    free(ellmod);
+
+    ENDFCT
+}//}}}
+
+static int
+filter_map(hmpdf_obj *d, double complex *map_comp, int *z_index)
+{//{{{
+    STARTFCT
+
+    if (z_index == NULL)
+    {
+        HMPDFPRINT(3, "\t\tapplying filters to the map\n");
+    }
+
+    #ifdef _OPENMP
+    #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+    #endif
+    for (long ii=0; ii<d->m->Nside; ii++)
+    // loop over long direction (rows)
+    {
+        CONTINUE_IF_ERR
+
+        SAFEHMPDF_NORETURN(filter_map_row(d, map_comp, ii, z_index));
+    }
 
     ENDFCT
 }//}}}
@@ -581,6 +1153,14 @@ loop_no_z_dependence(hmpdf_obj *d)
     {
         SAFEHMPDF(reset_map_ws(d, d->m->ws[ii]));
     }
+    d->m->Nconv = 0;
+    map_tgt *tgt = NULL;
+    if (d->m->tiled)
+    {
+        tgt = d->m->tgts;
+        tgt->map = d->m->map_real;
+        tgt->ldmap = d->m->ldmap;
+    }
 
     // create the array of bins
     int *bins;
@@ -607,7 +1187,7 @@ loop_no_z_dependence(hmpdf_obj *d)
         int z_index = bins[ii] / d->n->NM;
         int M_index = bins[ii] % d->n->NM;
         SAFEHMPDF_NORETURN(do_this_bin(d, z_index, M_index,
-                                       d->m->ws[THIS_THREAD]));
+                                       d->m->ws[THIS_THREAD], tgt, 1));
 
         #ifdef _OPENMP
         #   pragma omp critical(StatusMapNoz)
@@ -625,8 +1205,8 @@ loop_no_z_dependence(hmpdf_obj *d)
 
     free(bins);
 
-    // add to the total map
-    for (int ii=0; ii<d->m->Nws; ii++)
+    // add to the total map (the tiled mode painted there directly)
+    for (int ii=0; ii<d->m->Nws && !(d->m->tiled); ii++)
     {
         #ifdef _OPENMP
         #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
@@ -641,6 +1221,9 @@ loop_no_z_dependence(hmpdf_obj *d)
         }
     }
 
+    // the populous bins
+    SAFEHMPDF(paint_conv_bins(d, d->m->map_real, d->m->ldmap, -1));
+
     if (d->m->need_ft)
     {
         // transform to conjugate space
@@ -677,6 +1260,14 @@ loop_w_z_dependence(hmpdf_obj *d)
         Mbins[ii] = ii;
     }
 
+    map_tgt *tgt = NULL;
+    if (d->m->tiled)
+    {
+        tgt = d->m->tgts;
+        tgt->map = d->m->ws[0]->map;
+        tgt->ldmap = d->m->ws[0]->ldmap;
+    }
+
     // status
     time_t start_time = time(NULL);
 
@@ -689,6 +1280,7 @@ loop_w_z_dependence(hmpdf_obj *d)
         {
             SAFEHMPDF(reset_map_ws(d, d->m->ws[ii]));
         }
+        d->m->Nconv = 0;
 
         // shuffle to equalize load
         gsl_ran_shuffle(d->m->ws[0]->rng, Mbins, d->n->NM, sizeof(int));
@@ -701,36 +1293,56 @@ loop_w_z_dependence(hmpdf_obj *d)
             CONTINUE_IF_ERR
             int M_index = Mbins[mm];
             SAFEHMPDF_NORETURN(do_this_bin(d, z_index, M_index,
-                                           d->m->ws[THIS_THREAD]));
+                                           d->m->ws[THIS_THREAD], tgt, 1));
         }
 
-        // sum all sub-maps in the 0th one (which always exists)
-        for (int ii=1; ii<d->m->Nws; ii++)
+        // sum all sub-maps in the 0th one (which always exists),
+        //     the tiled mode painted there directly
+        if (!(d->m->tiled))
         {
+            #ifdef _OPENMP
+            #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+            #endif
             for (long jj=0; jj<d->m->Nside; jj++)
             {
-                for (long kk=0; kk<d->m->Nside; kk++)
+                for (int ii=1; ii<d->m->Nws; ii++)
                 {
-                    d->m->ws[0]->map[jj*(d->m->Nside+2) + kk]
-                        += d->m->ws[ii]->map[jj*d->m->Nside + kk];
+                    for (long kk=0; kk<d->m->Nside; kk++)
+                    {
+                        d->m->ws[0]->map[jj*d->m->ws[0]->ldmap + kk]
+                            += d->m->ws[ii]->map[jj*d->m->ws[ii]->ldmap + kk];
+                    }
                 }
             }
         }
 
+        // the populous bins
+        SAFEHMPDF(paint_conv_bins(d, d->m->ws[0]->map, d->m->ws[0]->ldmap, -1));
+
         // transform to conjugate space
         HMPDFCHECK(d->m->ws[0]->p_r2c == NULL,
                    "trying to execute an fftw_plan that has not been initialized.");
         fftw_execute(*(d->m->ws[0]->p_r2c));
 
-        // apply the z-dependent filters
-        SAFEHMPDF(filter_map(d, d->m->ws[0]->map_comp, &z_index));
-
-        // add to the total map
-        for (long ii=0; ii<d->m->Nside * (d->m->Nside/2+1); ii++)
+        // apply the z-dependent filters and add to the total map
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+        #endif
+        for (long ii=0; ii<d->m->Nside; ii++)
         {
-            d->m->map_comp[ii] += d->m->ws[0]->map_comp[ii];
+            CONTINUE_IF_ERR
+
+            SAFEHMPDF_NORETURN(filter_map_row(d, d->m->ws[0]->map_comp, ii, &z_index));
+
+            for (long jj=0; jj<d->m->Nside/2+1; jj++)
+            {
+                d->m->map_comp[ii*(d->m->Nside/2+1)+jj]
+                    += d->m->ws[0]->map_comp[ii*(d->m->Nside/2+1)+jj];
+            }
         }
 
+        RETURN_IF_ERR
+
         if (((zz+1)%MAPWZ_STATUS_PERIOD == 0) && (d->verbosity > 0))
         {
             TIMEREMAIN(zz+1, d->n->Nz, "create_map");
@@ -745,6 +1357,135 @@ loop_w_z_dependence(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
+static int
+loop_w_z_pipelined(hmpdf_obj *d)
+// the loop with z-dependent filters if several redshift slices
+//     are processed concurrently, each in its own workspace
+// NOTE : the map that comes out of this is in conjugate space!
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(3, "\t\tloop_w_z_pipelined\n");
+
+    int *zbins;
+    SAFEALLOC(zbins, malloc(d->n->Nz * sizeof(int)));
+    for (int ii=0; ii<d->n->Nz; ii++)
+    {
+        zbins[ii] = ii;
+    }
+    // shuffle for more representative status updates
+    gsl_ran_shuffle(d->m->ws[0]->rng, zbins, d->n->Nz, sizeof(int));
+
+    int *Mbins;
+    SAFEALLOC(Mbins, malloc(d->n->NM * sizeof(int)));
+    for (int ii=0; ii<d->n->NM; ii++)
+    {
+        Mbins[ii] = ii;
+    }
+
+    for (int ss=0; ss<d->m->Nzslices; ss++)
+    {
+        d->m->tgts[ss].map = d->m->ws[ss]->map;
+        d->m->tgts[ss].ldmap = d->m->ws[ss]->ldmap;
+    }
+
+    // status
+    time_t start_time = time(NULL);
+
+    for (int zz=0; zz<d->n->Nz; zz+=d->m->Nzslices)
+    {
+        // the slices in this round are zbins[zz ... zz+Nactive-1],
+        //     slice ss is held in the ss-th workspace
+        int Nactive = GSL_MIN(d->m->Nzslices, d->n->Nz - zz);
+
+        // reset the workspaces (the maps of inactive slices are not needed)
+        for (int ii=0; ii<d->m->Nws; ii++)
+        {
+            if (ii < Nactive || ii >= d->m->Nzslices)
+            {
+                SAFEHMPDF(reset_map_ws(d, d->m->ws[ii]));
+            }
+        }
+        for (int ss=0; ss<Nactive; ss++)
+        {
+            HMPDFCHECK(d->m->ws[ss]->p_r2c == NULL,
+                       "trying to execute an fftw_plan that has not been initialized.");
+        }
+        d->m->Nconv = 0;
+
+        // shuffle to equalize load
+        gsl_ran_shuffle(d->m->ws[0]->rng, Mbins, d->n->NM, sizeof(int));
+
+        // paint the halos, all threads share all slices,
+        //     the slices' maps are locked tile by tile
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->m->Nws) schedule(dynamic)
+        #endif
+        for (int ii=0; ii<Nactive*d->n->NM; ii++)
+        {
+            CONTINUE_IF_ERR
+            int ss = ii % Nactive;
+            int M_index = Mbins[ii / Nactive];
+            SAFEHMPDF_NORETURN(do_this_bin(d, zbins[zz+ss], M_index,
+                                           d->m->ws[THIS_THREAD], d->m->tgts+ss, 1));
+        }
+
+        RETURN_IF_ERR
+
+        // the populous bins
+        for (int ss=0; ss<Nactive; ss++)
+        {
+            SAFEHMPDF(paint_conv_bins(d, d->m->ws[ss]->map, d->m->ws[ss]->ldmap,
+                                      zbins[zz+ss]));
+        }
+
+        // transform to conjugate space, one thread per slice
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(Nactive) schedule(static, 1)
+        #endif
+        for (int ss=0; ss<Nactive; ss++)
+        {
+            fftw_execute(*(d->m->ws[ss]->p_r2c));
+        }
+
+        // apply the z-dependent filters and add to the total map
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+        #endif
+        for (long ii=0; ii<d->m->Nside; ii++)
+        {
+            for (int ss=0; ss<Nactive; ss++)
+            {
+                CONTINUE_IF_ERR
+
+                int z_index = zbins[zz+ss];
+                SAFEHMPDF_NORETURN(filter_map_row(d, d->m->ws[ss]->map_comp, ii, &z_index));
+
+                for (long jj=0; jj<d->m->Nside/2+1; jj++)
+                {
+                    d->m->map_comp[ii*(d->m->Nside/2+1)+jj]
+                        += d->m->ws[ss]->map_comp[ii*(d->m->Nside/2+1)+jj];
+                }
+            }
+        }
+
+        RETURN_IF_ERR
+
+        if (((zz+Nactive)/MAPWZ_STATUS_PERIOD > zz/MAPWZ_STATUS_PERIOD)
+            && (d->verbosity > 0))
+        {
+            TIMEREMAIN(zz+Nactive, d->n->Nz, "create_map");
+        }
+    }
+
+    TIMEELAPSED("create_map");
+
+    free(Mbins);
+    free(zbins);
+
+    ENDFCT
+}//}}}
+
 static int
 create_mem(hmpdf_obj *d)
 {//{{{
@@ -771,6 +1512,16 @@ create_mem(hmpdf_obj *d)
                                fftw_malloc : malloc)(d->m->Nside * d->m->ldmap
                                                      * sizeof(double)));
 
+    if (d->m->stamp_cache_budget > 0.0)
+    {
+        long Nstamps = (long)(d->n->Nz * d->n->NM) * MAPSTAMP_NSUB * MAPSTAMP_NSUB;
+        SAFEALLOC(d->m->stamp_index, malloc(Nstamps * sizeof(map_stamp *)));
+        SETARRNULL(d->m->stamp_index, Nstamps);
+    }
+
+    SAFEALLOC(d->m->conv_bins, malloc(d->n->Nz * d->n->NM * sizeof(int)));
+    SAFEALLOC(d->m->conv_N, malloc(d->n->Nz * d->n->NM * sizeof(unsigned)));
+
     if (d->m->need_ft)
     {
         d->m->map_comp = (double complex *)d->m->map_real;
@@ -797,7 +1548,7 @@ create_mem(hmpdf_obj *d)
 }//}}}
 
 static int
-subtract_map_mean(hmpdf_obj *d)
+subtract_map_mean(hmpdf_obj *d, double *map, long ldmap)
 {//{{{
     STARTFCT
     
@@ -806,7 +1557,7 @@ subtract_map_mean(hmpdf_obj *d)
     {
         for (long jj=0; jj<d->m->Nside; jj++)
         {
-            mean += d->m->map_real[ii*d->m->ldmap+jj];
+            mean += map[ii*ldmap+jj];
         }
     }
     
@@ -816,7 +1567,7 @@ subtract_map_mean(hmpdf_obj *d)
     {
         for (long jj=0; jj<d->m->Nside; jj++)
         {
-            d->m->map_real[ii*d->m->ldmap+jj] -= mean;
+            map[ii*ldmap+jj] -= mean;
         }
     }
 
@@ -836,7 +1587,11 @@ create_map(hmpdf_obj *d)
     zero_real(d->m->Nside * d->m->ldmap, d->m->map_real);
 
     // run the loop
-    if (d->f->has_z_dependent)
+    if (d->f->has_z_dependent && d->m->Nzslices > 1)
+    {
+        SAFEHMPDF(loop_w_z_pipelined(d));
+    }
+    else if (d->f->has_z_dependent)
     {
         SAFEHMPDF(loop_w_z_dependence(d));
     }
@@ -870,7 +1625,7 @@ create_map(hmpdf_obj *d)
 
     if (d->p->stype == hmpdf_kappa)
     {
-        SAFEHMPDF(subtract_map_mean(d));
+        SAFEHMPDF(subtract_map_mean(d, d->m->map_real, d->m->ldmap));
     }
 
     d->m->created_map = 1;
@@ -932,13 +1687,14 @@ prepare_maps(hmpdf_obj *d)
     SAFEHMPDF(create_mem(d));
     SAFEHMPDF(create_ellgrid(d));
     SAFEHMPDF(create_map_ws(d));
-    SAFEHMPDF(create_map(d));
 
     ENDFCT
 }//}}}
 
 static int
 common_input_processing(hmpdf_obj *d, int new_map)
+// checks the inputs and prepares the buffers,
+//     the map itself is created by create_map
 {//{{{
     STARTFCT
     
@@ -973,62 +1729,122 @@ common_input_processing(hmpdf_obj *d, int new_map)
     ENDFCT
 }//}}}
 
-int
-hmpdf_get_map_op(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double op[Nbins], int new_map)
-// if (new_map), create one
-// else, if not available, create one
-//       else, use the existing one
+static inline int
+find_bin(int Nbins, double binedges[Nbins+1], double x, int closed)
+// returns the index of the bin containing x, or -1 if x is out of range
+//     bins are half-open [lo, hi), if (closed) the last one includes its upper edge
 {//{{{
-    STARTFCT
+    if (x < binedges[0] || x > binedges[Nbins]
+        || (x == binedges[Nbins] && !(closed)))
+    {
+        return -1;
+    }
 
-    HMPDFCHECK(not_monotonic(Nbins+1, binedges, 1),
-               "binedges not monotonically increasing.");
+    int lo = 0;
+    int hi = Nbins;
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (x < binedges[mid])
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid;
+        }
+    }
 
-    SAFEHMPDF(common_input_processing(d, new_map));
-    
-    // prepare a histogram
-    gsl_histogram *h;
-    SAFEALLOC(h, gsl_histogram_alloc(Nbins));
-    SAFEGSL(gsl_histogram_set_ranges(h, binedges, Nbins+1));
+    return lo;
+}//}}}
+
+static inline void
+bin_map_op_row(hmpdf_obj *d, double *map, long ldmap, long ii,
+               int Nbins, double binedges[Nbins+1], double counts[Nbins])
+// adds the pixels in row ii of the real space map to the histogram counts
+{//{{{
+    for (long jj=0; jj<d->m->Nside; jj++)
+    {
+        int idx = find_bin(Nbins, binedges, map[ii*ldmap+jj], 0);
+        if (idx >= 0)
+        {
+            counts[idx] += 1.0;
+        }
+    }
+}//}}}
+
+static int
+bin_map_op(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double op[Nbins])
+// histogram of the real space map, normalized by the number of pixels
+{//{{{
+    STARTFCT
+
+    // each thread accumulates into its own row
+    double *counts;
+    SAFEALLOC(counts, calloc(d->Ncores * Nbins, sizeof(double)));
 
-    // accumulate the histogram
+    #ifdef _OPENMP
+    #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+    #endif
     for (long ii=0; ii<d->m->Nside; ii++)
     {
-        for (long jj=0; jj<d->m->Nside; jj++)
+        bin_map_op_row(d, d->m->map_real, d->m->ldmap, ii,
+                       Nbins, binedges, counts + THIS_THREAD * Nbins);
+    }
+
+    zero_real(Nbins, op);
+    for (int ii=0; ii<d->Ncores; ii++)
+    {
+        for (int jj=0; jj<Nbins; jj++)
         {
-            double val = d->m->map_real[ii*d->m->ldmap+jj];
-            if (val < binedges[0] || val >= binedges[Nbins])
-            {
-                continue;
-            }
-            else
-            {
-                SAFEGSL(gsl_histogram_increment(h, val));
-            }
+            op[jj] += counts[ii*Nbins+jj];
         }
     }
 
     // normalize
-    SAFEGSL(gsl_histogram_scale(h, 1.0/(double)(d->m->Nside * d->m->Nside)));
-
-    // write into output
     for (int ii=0; ii<Nbins; ii++)
     {
-        op[ii] = gsl_histogram_get(h, ii);
+        op[ii] /= (double)(d->m->Nside * d->m->Nside);
     }
 
-    gsl_histogram_free(h);
+    free(counts);
 
     ENDFCT
 }//}}}
 
 int
-perform_map_FT(hmpdf_obj *d)
-// creates the fourier space representation of the map
-//     in the 0th workspace (which is needed as buffer)
+hmpdf_get_map_op(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double op[Nbins], int new_map)
+// if (new_map), create one
+// else, if not available, create one
+//       else, use the existing one
+{//{{{
+    STARTFCT
+
+    HMPDFCHECK(not_monotonic(Nbins+1, binedges, 1),
+               "binedges not monotonically increasing.");
+
+    SAFEHMPDF(common_input_processing(d, new_map));
+    SAFEHMPDF(create_map(d));
+    
+    SAFEHMPDF(bin_map_op(d, Nbins, binedges, op));
+
+    ENDFCT
+}//}}}
+
+static int
+prepare_map_FT(hmpdf_obj *d)
+// allocates the FFT buffer in the 0th workspace and creates the r2c plan
 {//{{{
     STARTFCT
 
+    // in the tiled mode, the buffer may not exist yet
+    if (d->m->ws[0]->map == NULL)
+    {
+        SAFEALLOC(d->m->ws[0]->map, fftw_malloc(d->m->ws[0]->ldmap * d->m->Nside
+                                                * sizeof(double)));
+        d->m->ws[0]->map_comp = (double complex *)d->m->ws[0]->map;
+    }
+
     // prepare the fftw plan if not already existing
     //     need to do this before copying data because creating
     //     an fftw plan does not preserve the memory pointed to
@@ -1041,6 +1857,18 @@ perform_map_FT(hmpdf_obj *d)
                                                      FFTW_ESTIMATE);
     }
 
+    ENDFCT
+}//}}}
+
+int
+perform_map_FT(hmpdf_obj *d)
+// creates the fourier space representation of the map
+//     in the 0th workspace (which is needed as buffer)
+{//{{{
+    STARTFCT
+
+    SAFEHMPDF(prepare_map_FT(d));
+
     // copy the real space map into the 0th workspace
     for (long ii=0; ii<d->m->Nside; ii++)
     {
@@ -1055,55 +1883,64 @@ perform_map_FT(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
+static inline void
+avg_bin_FT_row(hmpdf_obj *d, double complex *map_comp, long ii,
+               int Nbins, double binedges[Nbins+1],
+               double nmodes[Nbins], double modepwrs[Nbins])
+// adds the modes in row ii of the Fourier space map to the mode counts and powers
+{//{{{
+    double ell1 = WAVENR(d->m->Nside, d->m->ellgrid, ii);
+
+    for (long jj=0; jj<d->m->Nside/2+1; jj++)
+    {
+        double ell2 = WAVENR(d->m->Nside, d->m->ellgrid, jj);
+        int idx = find_bin(Nbins, binedges, hypot(ell1, ell2), 1);
+        if (idx >= 0)
+        {
+            nmodes[idx] += 1.0;
+            modepwrs[idx] += cabs(map_comp[ii*(d->m->Nside/2+1)+jj]);
+        }
+    }
+}//}}}
+
 int
 avg_bin_FT_map(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double ps[Nbins])
 {//{{{
     STARTFCT
 
-    // prepare two histograms
-    //     (one to count number of modes, the other to accumulate mode powers
-    gsl_histogram *h_nmodes;
-    gsl_histogram *h_modepwrs;
-    SAFEALLOC(h_nmodes, gsl_histogram_alloc(Nbins));
-    SAFEALLOC(h_modepwrs, gsl_histogram_alloc(Nbins));
-    SAFEGSL(gsl_histogram_set_ranges(h_nmodes, binedges, Nbins+1));
-    SAFEGSL(gsl_histogram_set_ranges(h_modepwrs, binedges, Nbins+1));
+    // each thread counts the number of modes and accumulates the mode powers
+    //     in its own rows
+    double *nmodes;
+    double *modepwrs;
+    SAFEALLOC(nmodes, calloc(d->Ncores * Nbins, sizeof(double)));
+    SAFEALLOC(modepwrs, calloc(d->Ncores * Nbins, sizeof(double)));
 
     // loop over the Fourier space map
+    #ifdef _OPENMP
+    #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+    #endif
     for (long ii=0; ii<d->m->Nside; ii++)
     {
-        double ell1 = WAVENR(d->m->Nside, d->m->ellgrid, ii);
-
-        for (long jj=0; jj<d->m->Nside/2+1; jj++)
-        {
-            double ell2 = WAVENR(d->m->Nside, d->m->ellgrid, jj);
-            double ellmod = hypot(ell1, ell2);
-
-            if (ellmod < binedges[0] || ellmod > binedges[Nbins])
-            {
-                continue;
-            }
-            else
-            {
-                SAFEGSL(gsl_histogram_increment(h_nmodes, ellmod));
-                SAFEGSL(gsl_histogram_accumulate(h_modepwrs, ellmod,
-                                                 cabs(d->m->ws[0]->map_comp[ii*(d->m->Nside/2+1)+jj])));
-
-            }
-        }
+        avg_bin_FT_row(d, d->m->ws[0]->map_comp, ii, Nbins, binedges,
+                       nmodes + THIS_THREAD * Nbins,
+                       modepwrs + THIS_THREAD * Nbins);
     }
 
     // perform the averaging over modes
-    SAFEGSL(gsl_histogram_div(h_modepwrs, h_nmodes));
-
-    // write into output
     for (int ii=0; ii<Nbins; ii++)
     {
-        ps[ii] = gsl_histogram_get(h_modepwrs, ii);
+        double n = 0.0;
+        ps[ii] = 0.0;
+        for (int jj=0; jj<d->Ncores; jj++)
+        {
+            n += nmodes[jj*Nbins+ii];
+            ps[ii] += modepwrs[jj*Nbins+ii];
+        }
+        ps[ii] /= n;
     }
 
-    gsl_histogram_free(h_nmodes);
-    gsl_histogram_free(h_modepwrs);
+    free(nmodes);
+    free(modepwrs);
 
     ENDFCT
 }//}}}
@@ -1117,6 +1954,7 @@ hmpdf_get_map_ps(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double ps[Nb
                "binedges not monotonically increasing.");
 
     SAFEHMPDF(common_input_processing(d, new_map));
+    SAFEHMPDF(create_map(d));
 
     // create the Fourier space map
     SAFEHMPDF(perform_map_FT(d));
@@ -1127,6 +1965,385 @@ hmpdf_get_map_ps(hmpdf_obj *d, int Nbins, double binedges[Nbins+1], double ps[Nb
     ENDFCT
 }//}}}
 
+static void
+welford_update(int N, long n, double x[N], double mean[N], double *M2, double *delta)
+// adds the n-th sample x to the running mean and,
+//     if M2 is not NULL, to the running sum of outer products
+//     of deviations from the mean [N*N]
+//     delta is a work space [N]
+{//{{{
+    for (int ii=0; ii<N; ii++)
+    {
+        delta[ii] = x[ii] - mean[ii];
+        mean[ii] += delta[ii] / (double)n;
+    }
+
+    if (M2 == NULL)
+    {
+        return;
+    }
+
+    for (int ii=0; ii<N; ii++)
+    {
+        for (int jj=0; jj<N; jj++)
+        {
+            M2[ii*N+jj] += delta[ii] * (x[jj] - mean[jj]);
+        }
+    }
+}//}}}
+
+static void
+chan_combine(int N, long nA, double meanA[N], double *M2A,
+             long nB, double meanB[N], double *M2B, double *delta)
+// merges the running statistics of nB samples (meanB, M2B)
+//     into those of nA samples (meanA, M2A) [Chan, Golub & LeVeque 1979]
+//     delta is a work space [N]
+{//{{{
+    if (nB == 0)
+    {
+        return;
+    }
+
+    double n = (double)(nA + nB);
+    for (int ii=0; ii<N; ii++)
+    {
+        delta[ii] = meanB[ii] - meanA[ii];
+        meanA[ii] += delta[ii] * (double)nB / n;
+    }
+
+    if (M2A == NULL)
+    {
+        return;
+    }
+
+    for (int ii=0; ii<N; ii++)
+    {
+        for (int jj=0; jj<N; jj++)
+        {
+            M2A[ii*N+jj] += M2B[ii*N+jj]
+                            + delta[ii] * delta[jj] * (double)nA * (double)nB / n;
+        }
+    }
+}//}}}
+
+static int
+ensemble_realization(hmpdf_obj *d, map_ws *ws,
+                     int Nbins_op, double *binedges_op, double *op,
+                     int Nbins_ps, double *binedges_ps, double *ps, double *work)
+// creates a complete map in the workspace's own map and bins it.
+//     This is the single-threaded equivalent of create_map,
+//     hmpdf_get_map_ensemble calls it from several threads at once.
+// op, ps may be NULL
+// work is a work space [2*Nbins_ps]
+{//{{{
+    STARTFCT
+
+    zero_real(ws->ldmap * d->m->Nside, ws->map);
+
+    for (int ii=0; ii<d->n->Nz * d->n->NM; ii++)
+    {
+        SAFEHMPDF(do_this_bin(d, ii / d->n->NM, ii % d->n->NM, ws, NULL, 0));
+    }
+
+    // the plans were created for buffers of the same layout
+    if (d->m->need_ft)
+    {
+        fftw_execute_dft_r2c(*(d->m->ws[0]->p_r2c), ws->map, ws->map_comp);
+
+        for (long ii=0; ii<d->m->Nside; ii++)
+        {
+            if (d->ns->noise_pwr != NULL)
+            {
+                SAFEHMPDF(add_grf_row(d, d->ns->noise_pwr, d->ns->noise_pwr_params,
+                                      ii, ws->rng, ws->map_comp));
+            }
+            SAFEHMPDF(filter_map_row(d, ws->map_comp, ii, NULL));
+        }
+
+        fftw_execute_dft_c2r(*(d->m->p_c2r), ws->map_comp, ws->map);
+
+        for (long ii=0; ii<d->m->Nside * (d->m->Nside+2); ii++)
+        {
+            ws->map[ii] /= (double)(d->m->Nside * d->m->Nside);
+        }
+    }
+
+    if (d->p->stype == hmpdf_kappa)
+    {
+        SAFEHMPDF(subtract_map_mean(d, ws->map, ws->ldmap));
+    }
+
+    if (op != NULL)
+    {
+        zero_real(Nbins_op, op);
+        for (long ii=0; ii<d->m->Nside; ii++)
+        {
+            bin_map_op_row(d, ws->map, ws->ldmap, ii, Nbins_op, binedges_op, op);
+        }
+        for (int ii=0; ii<Nbins_op; ii++)
+        {
+            op[ii] /= (double)(d->m->Nside * d->m->Nside);
+        }
+    }
+
+    if (ps != NULL)
+    {
+        fftw_execute_dft_r2c(*(d->m->ws[0]->p_r2c), ws->map, ws->map_comp);
+
+        zero_real(2 * Nbins_ps, work);
+        for (long ii=0; ii<d->m->Nside; ii++)
+        {
+            avg_bin_FT_row(d, ws->map_comp, ii, Nbins_ps, binedges_ps,
+                           work, work + Nbins_ps);
+        }
+        for (int ii=0; ii<Nbins_ps; ii++)
+        {
+            ps[ii] = work[Nbins_ps+ii] / work[ii];
+        }
+    }
+
+    ENDFCT
+}//}}}
+
+int
+hmpdf_get_map_ensemble(hmpdf_obj *d, int Nrealizations,
+                       int Nbins_op, double binedges_op[Nbins_op+1],
+                       double op_mean[Nbins_op], double op_cov[Nbins_op*Nbins_op],
+                       int Nbins_ps, double binedges_ps[Nbins_ps+1],
+                       double ps_mean[Nbins_ps], double ps_cov[Nbins_ps*Nbins_ps])
+{//{{{
+    STARTFCT
+
+    int do_op = Nbins_op > 0 && binedges_op != NULL && op_mean != NULL;
+    int do_ps = Nbins_ps > 0 && binedges_ps != NULL && ps_mean != NULL;
+
+    HMPDFCHECK(Nrealizations < 1,
+               "need at least one realization.");
+    HMPDFCHECK(!(do_op) && !(do_ps),
+               "neither one-point PDF nor power spectrum requested.");
+    HMPDFCHECK((op_cov != NULL || ps_cov != NULL) && Nrealizations < 2,
+               "need at least two realizations to estimate a covariance.");
+    HMPDFCHECK(do_op && not_monotonic(Nbins_op+1, binedges_op, 1),
+               "binedges_op not monotonically increasing.");
+    HMPDFCHECK(do_ps && not_monotonic(Nbins_ps+1, binedges_ps, 1),
+               "binedges_ps not monotonically increasing.");
+
+    HMPDFPRINT(1, "get_map_ensemble\n");
+
+    // sets up all buffers and plans
+    SAFEHMPDF(common_input_processing(d, 1));
+
+    if (!(do_op)) { Nbins_op = 0; }
+    if (!(do_ps)) { Nbins_ps = 0; }
+    double *op_M2 = (do_op) ? op_cov : NULL;
+    double *ps_M2 = (do_ps) ? ps_cov : NULL;
+
+    // Without z-dependent filters, each workspace has a complete map
+    //     of its own, so whole realizations can be painted concurrently,
+    //     one per thread, without any memory beyond that of a single map.
+    //     Each thread keeps its own running statistics,
+    //     which are merged at the end.
+    //     The remaining realizations (and all of them in the tiled mode
+    //     or with z-dependent filters) use the threaded create_map.
+    // Since the concurrent realizations scatter all halos, they are only used
+    //     if create_map would not paint any bin by convolution
+    //     (judged by the expected number of halos).
+    int any_conv = 0;
+    if (!(d->m->tiled))
+    {
+        for (int ii=0; ii<d->n->Nz * d->n->NM && !(any_conv); ii++)
+        {
+            int z_index = ii / d->n->NM;
+            int M_index = ii % d->n->NM;
+            any_conv = conv_is_cheaper(d, z_index, M_index,
+                                       expected_N_halos(d, z_index, M_index));
+        }
+    }
+    int Nacc = (!(d->m->tiled) && !(d->f->has_z_dependent) && !(any_conv)) ?
+               d->m->Nws : 1;
+    if (any_conv)
+    {
+        HMPDFPRINT(3, "\t\tsome bins are painted by convolution, "
+                      "generating the maps one after another.\n");
+    }
+    long Npar = (Nacc > 1) ? (Nrealizations / Nacc) * Nacc : 0;
+
+    long *n;
+    double **acc_op_mean, **acc_op_M2, **acc_ps_mean, **acc_ps_M2;
+    SAFEALLOC(n, calloc(Nacc, sizeof(long)));
+    SAFEALLOC(acc_op_mean, malloc(Nacc * sizeof(double *)));
+    SAFEALLOC(acc_op_M2, malloc(Nacc * sizeof(double *)));
+    SAFEALLOC(acc_ps_mean, malloc(Nacc * sizeof(double *)));
+    SAFEALLOC(acc_ps_M2, malloc(Nacc * sizeof(double *)));
+    SETARRNULL(acc_op_mean, Nacc);
+    SETARRNULL(acc_op_M2, Nacc);
+    SETARRNULL(acc_ps_mean, Nacc);
+    SETARRNULL(acc_ps_M2, Nacc);
+
+    // the 0th accumulator is the output
+    acc_op_mean[0] = op_mean;
+    acc_op_M2[0] = op_M2;
+    acc_ps_mean[0] = ps_mean;
+    acc_ps_M2[0] = ps_M2;
+    for (int ii=1; ii<Nacc; ii++)
+    {
+        if (do_op)
+        {
+            SAFEALLOC(acc_op_mean[ii], malloc(Nbins_op * sizeof(double)));
+        }
+        if (op_M2 != NULL)
+        {
+            SAFEALLOC(acc_op_M2[ii], malloc(Nbins_op * Nbins_op * sizeof(double)));
+        }
+        if (do_ps)
+        {
+            SAFEALLOC(acc_ps_mean[ii], malloc(Nbins_ps * sizeof(double)));
+        }
+        if (ps_M2 != NULL)
+        {
+            SAFEALLOC(acc_ps_M2[ii], malloc(Nbins_ps * Nbins_ps * sizeof(double)));
+        }
+    }
+    for (int ii=0; ii<Nacc; ii++)
+    {
+        if (do_op) { zero_real(Nbins_op, acc_op_mean[ii]); }
+        if (op_M2 != NULL) { zero_real(Nbins_op * Nbins_op, acc_op_M2[ii]); }
+        if (do_ps) { zero_real(Nbins_ps, acc_ps_mean[ii]); }
+        if (ps_M2 != NULL) { zero_real(Nbins_ps * Nbins_ps, acc_ps_M2[ii]); }
+    }
+
+    // single-realization outputs and work space, per thread
+    int Nx = Nbins_op + Nbins_ps;
+    int Nbuf = GSL_MAX(Nbins_op, 2 * Nbins_ps);
+    double *x, *delta;
+    SAFEALLOC(x, malloc(Nacc * Nx * sizeof(double)));
+    SAFEALLOC(delta, malloc(Nacc * Nbuf * sizeof(double)));
+
+    if (Npar > 0)
+    {
+        HMPDFPRINT(3, "\t\tpainting %d realizations concurrently.\n", Nacc);
+
+        SAFEHMPDF(prepare_map_FT(d));
+        for (int ii=0; ii<Nacc; ii++)
+        {
+            SAFEHMPDF(reset_map_ws(d, d->m->ws[ii]));
+        }
+
+        int Nstatus = 0;
+
+        #ifdef _OPENMP
+        #   pragma omp parallel for num_threads(Nacc) schedule(static)
+        #endif
+        for (long rr=0; rr<Npar; rr++)
+        {
+            CONTINUE_IF_ERR
+
+            int tt = THIS_THREAD;
+            double *x_op = x + tt*Nx;
+            double *x_ps = x_op + Nbins_op;
+            double *this_delta = delta + tt*Nbuf;
+
+            SAFEHMPDF_NORETURN(ensemble_realization(d, d->m->ws[tt],
+                                                    Nbins_op, binedges_op,
+                                                    (do_op) ? x_op : NULL,
+                                                    Nbins_ps, binedges_ps,
+                                                    (do_ps) ? x_ps : NULL,
+                                                    this_delta));
+
+            CONTINUE_IF_ERR
+
+            ++n[tt];
+            if (do_op)
+            {
+                welford_update(Nbins_op, n[tt], x_op, acc_op_mean[tt], acc_op_M2[tt],
+                               this_delta);
+            }
+            if (do_ps)
+            {
+                welford_update(Nbins_ps, n[tt], x_ps, acc_ps_mean[tt], acc_ps_M2[tt],
+                               this_delta);
+            }
+
+            #ifdef _OPENMP
+            #   pragma omp critical(StatusMapEnsemble)
+            #endif
+            {
+                ++Nstatus;
+                HMPDFPRINT(3, "\t\trealization %d / %d\n", Nstatus, Nrealizations);
+            }
+        }
+
+        RETURN_IF_ERR
+    }
+
+    for (long rr=Npar; rr<Nrealizations; rr++)
+    {
+        d->m->created_map = 0;
+        SAFEHMPDF(create_map(d));
+
+        ++n[0];
+        if (do_op)
+        {
+            SAFEHMPDF(bin_map_op(d, Nbins_op, binedges_op, x));
+            welford_update(Nbins_op, n[0], x, op_mean, op_M2, delta);
+        }
+
+        if (do_ps)
+        {
+            SAFEHMPDF(perform_map_FT(d));
+            SAFEHMPDF(avg_bin_FT_map(d, Nbins_ps, binedges_ps, x));
+            welford_update(Nbins_ps, n[0], x, ps_mean, ps_M2, delta);
+        }
+
+        HMPDFPRINT(3, "\t\trealization %ld / %d\n", rr+1, Nrealizations);
+    }
+
+    // merge the per-thread statistics
+    for (int ii=1; ii<Nacc; ii++)
+    {
+        if (do_op)
+        {
+            chan_combine(Nbins_op, n[0], op_mean, op_M2,
+                         n[ii], acc_op_mean[ii], acc_op_M2[ii], delta);
+        }
+        if (do_ps)
+        {
+            chan_combine(Nbins_ps, n[0], ps_mean, ps_M2,
+                         n[ii], acc_ps_mean[ii], acc_ps_M2[ii], delta);
+        }
+        n[0] += n[ii];
+    }
+
+    HMPDFCHECK(n[0] != Nrealizations, "lost realizations. this is a bug.");
+
+    // unbiased sample covariances
+    for (int ii=0; ii<Nbins_op * Nbins_op && op_M2 != NULL; ii++)
+    {
+        op_M2[ii] /= (double)(Nrealizations - 1);
+    }
+    for (int ii=0; ii<Nbins_ps * Nbins_ps && ps_M2 != NULL; ii++)
+    {
+        ps_M2[ii] /= (double)(Nrealizations - 1);
+    }
+
+    for (int ii=1; ii<Nacc; ii++)
+    {
+        if (acc_op_mean[ii] != NULL) { free(acc_op_mean[ii]); }
+        if (acc_op_M2[ii] != NULL) { free(acc_op_M2[ii]); }
+        if (acc_ps_mean[ii] != NULL) { free(acc_ps_mean[ii]); }
+        if (acc_ps_M2[ii] != NULL) { free(acc_ps_M2[ii]); }
+    }
+    free(n);
+    free(acc_op_mean);
+    free(acc_op_M2);
+    free(acc_ps_mean);
+    free(acc_ps_M2);
+    free(x);
+    free(delta);
+
+    ENDFCT
+}//}}}
+
 int
 _get_Nside(hmpdf_obj *d, long *Nside)
 {//{{{
@@ -1143,6 +2360,7 @@ hmpdf_get_map1(hmpdf_obj *d, double *map, int new_map)
     STARTFCT
 
     SAFEHMPDF(common_input_processing(d, new_map));
+    SAFEHMPDF(create_map(d));
 
     for (long ii=0; ii<d->m->Nside; ii++)
     {
@@ -8,15 +8,14 @@
 #include <fftw3.h>
 
 #include <gsl/gsl_math.h>
-#include <gsl/gsl_cblas.h>
 #include <gsl/gsl_integration.h>
-#include <gsl/gsl_dht.h>
 
 #include "configs.h"
 #include "utils.h"
 #include "object.h"
 #include "numerics.h"
 #include "filter.h"
+#include "hankel.h"
 #include "noise.h"
 
 #include "hmpdf.h"
@@ -26,7 +25,12 @@ null_noise(hmpdf_obj *d)
 {//{{{
     STARTFCT
 
-    d->ns->toepl = NULL;
+    d->ns->kernel = NULL;
+    d->ns->kernel_ft = NULL;
+
+    // these belong to the noise module since it creates them
+    d->n->signalgrid_noisy = NULL;
+    d->n->lambdagrid_noisy = NULL;
 
     d->ns->created_noise_zeta_interp = 0;
     d->ns->zeta_interp = NULL;
@@ -46,11 +50,14 @@ reset_noise(hmpdf_obj *d)
 
     HMPDFPRINT(2, "\treset_noise\n");
 
-    if (d->ns->toepl != NULL) { free(d->ns->toepl); }
+    if (d->ns->kernel != NULL) { free(d->ns->kernel); }
+    if (d->ns->kernel_ft != NULL) { fftw_free(d->ns->kernel_ft); }
+    if (d->n->signalgrid_noisy != NULL) { free(d->n->signalgrid_noisy); }
+    if (d->n->lambdagrid_noisy != NULL) { free(d->n->lambdagrid_noisy); }
     if (d->ns->zeta_interp != NULL) { gsl_spline_free(d->ns->zeta_interp); }
     if (d->ns->zeta_accel != NULL)
     {
-        for (int ii=0; ii<d->Ncores; ii++)
+        for (int ii=0; ii<d->ns->Nzeta_accel; ii++)
         {
             if (d->ns->zeta_accel[ii] != NULL)
             {
@@ -61,7 +68,7 @@ reset_noise(hmpdf_obj *d)
     }
     if (d->ns->conv_buffer_real != NULL)
     {
-        for (int ii=0; ii<d->Ncores; ii++)
+        for (int ii=0; ii<d->ns->Nconv_buffers; ii++)
         {
             if (d->ns->conv_buffer_real[ii] != NULL)
             {
@@ -72,7 +79,7 @@ reset_noise(hmpdf_obj *d)
     }
     if (d->ns->pconv_r2c != NULL)
     {
-        for (int ii=0; ii<d->Ncores; ii++)
+        for (int ii=0; ii<d->ns->Nconv_buffers; ii++)
         {
             if (d->ns->pconv_r2c[ii] != NULL)
             {
@@ -84,7 +91,7 @@ reset_noise(hmpdf_obj *d)
     }
     if (d->ns->pconv_c2r != NULL)
     {
-        for (int ii=0; ii<d->Ncores; ii++)
+        for (int ii=0; ii<d->ns->Nconv_buffers; ii++)
         {
             if (d->ns->pconv_c2r[ii] != NULL)
             {
@@ -98,6 +105,21 @@ reset_noise(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
+static int
+is_fft_friendly(long N)
+// whether N has no prime factors larger than 7
+{//{{{
+    long primes[] = { 2, 3, 5, 7, };
+    for (int ii=0; ii<4; ii++)
+    {
+        while (N % primes[ii] == 0)
+        {
+            N /= primes[ii];
+        }
+    }
+    return N == 1;
+}//}}}
+
 static int
 create_noisy_grids(hmpdf_obj *d)
 {//{{{
@@ -105,8 +127,21 @@ create_noisy_grids(hmpdf_obj *d)
 
     HMPDFPRINT(2, "\tcreate_noisy_grids\n");
 
-    // can in principle make this a user setting
-    d->ns->len_kernel = d->n->Nsignal;
+    // pad by NOISE_PAD_NSIGMA standard deviations on each side,
+    //     beyond which the kernel (and the periodic wrap-around
+    //     in the 2D convolutions) is negligible,
+    //     but not by more than the signal grid itself
+    double sigma_bins = sqrt(d->ns->sigmasq)
+                        / (d->n->signalgrid[1] - d->n->signalgrid[0]);
+    d->ns->len_kernel = (long)GSL_MIN((double)d->n->Nsignal,
+                                      ceil(NOISE_PAD_NSIGMA * sigma_bins) + 1.0);
+    // round up such that the FFTs are efficient
+    while (!is_fft_friendly(d->n->Nsignal + 2*d->ns->len_kernel))
+    {
+        ++d->ns->len_kernel;
+    }
+    HMPDFPRINT(3, "\t\tpadding by %ld on each side\n", d->ns->len_kernel);
+
     // construct the new signal grid
     d->n->Nsignal_noisy = d->n->Nsignal+2*d->ns->len_kernel;
     SAFEALLOC(d->n->signalgrid_noisy, malloc(d->n->Nsignal_noisy
@@ -133,8 +168,8 @@ create_noise_zeta_interp(hmpdf_obj *d)
 
     if (d->ns->created_noise_zeta_interp) { return 0; }
 
-    gsl_dht *t;
-    SAFEALLOC(t, gsl_dht_new(NOISE_ZETAINTERP_N, 0, d->n->phimax));
+    hankel *t;
+    SAFEHMPDF(new_hankel(NOISE_ZETAINTERP_N, d->n->phimax, d->n->fftlog, 1, &t));
     double *ell;
     double *Nell;
     double *phi;
@@ -146,15 +181,15 @@ create_noise_zeta_interp(hmpdf_obj *d)
     phi[0] = 0.0;
     zeta[0] = d->ns->sigmasq;
 
-    double hankel_norm = gsl_pow_2(gsl_dht_k_sample(t, 0)
-                                   / gsl_dht_x_sample(t, 0));
+    double hankel_norm = gsl_pow_2(hankel_k_sample(t, 0)
+                                   / hankel_x_sample(t, 0));
 
     // fill the integrand
     for (int ii=0; ii<NOISE_ZETAINTERP_N; ii++)
     {
-        ell[ii] = gsl_dht_k_sample(t, ii);
+        ell[ii] = hankel_k_sample(t, ii);
         Nell[ii] = d->ns->noise_pwr(ell[ii], d->ns->noise_pwr_params);
-        phi[ii+1] = gsl_dht_x_sample(t, ii);
+        phi[ii+1] = hankel_x_sample(t, ii);
     }
 
     // add the filter functions
@@ -162,7 +197,8 @@ create_noise_zeta_interp(hmpdf_obj *d)
                             1, filter_ps, NULL));
 
     // perform the hankel transform
-    SAFEGSL(gsl_dht_apply(t, Nell, zeta+1));
+    SAFEHMPDF(hankel_apply(t, Nell, zeta+1));
+    delete_hankel(t);
     free(ell);
     free(Nell);
 
@@ -175,10 +211,11 @@ create_noise_zeta_interp(hmpdf_obj *d)
     // interpolate
     SAFEALLOC(d->ns->zeta_interp,
               gsl_spline_alloc(gsl_interp_cspline, NOISE_ZETAINTERP_N+1));
+    d->ns->Nzeta_accel = d->Ncores;
     SAFEALLOC(d->ns->zeta_accel,
-              malloc(d->Ncores * sizeof(gsl_interp_accel *)));
-    SETARRNULL(d->ns->zeta_accel, d->Ncores);
-    for (int ii=0; ii<d->Ncores; ii++)
+              malloc(d->ns->Nzeta_accel * sizeof(gsl_interp_accel *)));
+    SETARRNULL(d->ns->zeta_accel, d->ns->Nzeta_accel);
+    for (int ii=0; ii<d->ns->Nzeta_accel; ii++)
     {
         SAFEALLOC(d->ns->zeta_accel[ii], gsl_interp_accel_alloc());
     }
@@ -285,20 +322,19 @@ safe_exp_div(double exponent, double divisor, double *out)
 }//}}}
 
 static int
-create_toepl(hmpdf_obj *d)
-// creates Toeplitz matrix nrows=Nsignal, ncols=Nsignal_noisy
+create_noise_kernel(hmpdf_obj *d)
+// creates the discrete Gaussian kernel of length 2*len_kernel+1,
+//     and its Fourier transform if it is too wide for direct convolution
 {//{{{
     STARTFCT
 
-    HMPDFPRINT(2, "\tcreate_toepl\n");
+    HMPDFPRINT(2, "\tcreate_noise_kernel\n");
 
-    SAFEALLOC(d->ns->toepl, malloc(d->n->Nsignal * d->n->Nsignal_noisy
-                                   * sizeof(double)));
-    zero_real(d->n->Nsignal*d->n->Nsignal_noisy, d->ns->toepl);
+    long Nkernel = 2 * d->ns->len_kernel + 1;
+    SAFEALLOC(d->ns->kernel, malloc(Nkernel * sizeof(double)));
     // dimensionless version of the variance
     double var = d->ns->sigmasq
                  / gsl_pow_2(d->n->signalgrid[1] - d->n->signalgrid[0]);
-    // fill the first row
     for (long ii= -d->ns->len_kernel; ii<=d->ns->len_kernel; ii++)
     {
         // we do this carefully to take care of the case
@@ -309,7 +345,7 @@ create_toepl(hmpdf_obj *d)
         {
             if (var < 10.0 * DBL_MIN)
             {
-                d->ns->toepl[d->ns->len_kernel+ii] = 1.0;
+                d->ns->kernel[d->ns->len_kernel+ii] = 1.0;
                 continue;
             }
             else
@@ -319,7 +355,7 @@ create_toepl(hmpdf_obj *d)
         }
         else if (var < 10.0 * DBL_MIN * gsl_pow_2((double)ii))
         {
-            d->ns->toepl[d->ns->len_kernel+ii] = 0.0;
+            d->ns->kernel[d->ns->len_kernel+ii] = 0.0;
             continue;
         }
         else
@@ -328,13 +364,32 @@ create_toepl(hmpdf_obj *d)
         }
         SAFEHMPDF(safe_exp_div(exponent,
                                sqrt(2.0 * M_PI * var),
-                               d->ns->toepl + ii + d->ns->len_kernel));
+                               d->ns->kernel + ii + d->ns->len_kernel));
     }
-    // fill the remaining rows
-    for (long ii=1; ii<d->n->Nsignal; ii++)
+
+    // find the width beyond which the kernel is negligible
+    d->ns->kernel_halfwidth = d->ns->len_kernel;
+    while (d->ns->kernel_halfwidth > 0
+           && d->ns->kernel[d->ns->len_kernel+d->ns->kernel_halfwidth]
+              < NOISE_KERNEL_TOL * d->ns->kernel[d->ns->len_kernel])
+    {
+        --d->ns->kernel_halfwidth;
+    }
+
+    if (2 * d->ns->kernel_halfwidth + 1 > NOISE_DIRECT_MAXWIDTH)
     {
-        memcpy(d->ns->toepl + ii*(d->n->Nsignal_noisy+1), d->ns->toepl,
-               (2*d->ns->len_kernel+1) * sizeof(double));
+        // the full linear convolution has length Nsignal_noisy,
+        //     so a transform of that length does not wrap around
+        long N = d->n->Nsignal_noisy;
+        double *buf;
+        SAFEALLOC(buf, fftw_malloc((N+2) * sizeof(double)));
+        zero_real(N+2, buf);
+        memcpy(buf, d->ns->kernel, Nkernel * sizeof(double));
+        fftw_plan p = fftw_plan_dft_r2c_1d(N, buf, (double complex *)buf,
+                                           FFTW_ESTIMATE);
+        fftw_execute(p);
+        fftw_destroy_plan(p);
+        d->ns->kernel_ft = (double complex *)buf;
     }
 
     ENDFCT
@@ -345,30 +400,31 @@ create_noise_matr_conv(hmpdf_obj *d, int Nbuffers)
 {//{{{
     STARTFCT
 
-    HMPDFCHECK(Nbuffers > d->Ncores,
-               "too many buffers requested.");
-
     SAFEHMPDF(create_noise_zeta_interp(d));
 
     if (d->ns->conv_buffer_real == NULL)
     {
+        d->ns->Nconv_buffers = d->Ncores;
         SAFEALLOC(d->ns->conv_buffer_real,
-                  malloc(d->Ncores * sizeof(double *)));
-        SETARRNULL(d->ns->conv_buffer_real, d->Ncores);
+                  malloc(d->ns->Nconv_buffers * sizeof(double *)));
+        SETARRNULL(d->ns->conv_buffer_real, d->ns->Nconv_buffers);
         SAFEALLOC(d->ns->conv_buffer_comp,
-                  malloc(d->Ncores * sizeof(double complex *)));
+                  malloc(d->ns->Nconv_buffers * sizeof(double complex *)));
     }
 
     if (d->ns->pconv_r2c == NULL)
     {
         SAFEALLOC(d->ns->pconv_r2c,
-                  malloc(d->Ncores * sizeof(fftw_plan *)));
-        SETARRNULL(d->ns->pconv_r2c, d->Ncores);
+                  malloc(d->ns->Nconv_buffers * sizeof(fftw_plan *)));
+        SETARRNULL(d->ns->pconv_r2c, d->ns->Nconv_buffers);
         SAFEALLOC(d->ns->pconv_c2r,
-                  malloc(d->Ncores * sizeof(fftw_plan *)));
-        SETARRNULL(d->ns->pconv_c2r, d->Ncores);
+                  malloc(d->ns->Nconv_buffers * sizeof(fftw_plan *)));
+        SETARRNULL(d->ns->pconv_c2r, d->ns->Nconv_buffers);
     }
 
+    HMPDFCHECK(Nbuffers > d->ns->Nconv_buffers,
+               "too many buffers requested.");
+
     for (int ii=0; ii<Nbuffers; ii++)
     {
         if (d->ns->conv_buffer_real[ii] == NULL)
@@ -404,39 +460,80 @@ create_noise_matr_conv(hmpdf_obj *d, int Nbuffers)
 int
 noise_vect(hmpdf_obj *d, double *in, double *out)
 // assumes len(in) = Nsignal, len(out) = Nsignal_noisy
+// CAUTION: this function is not thread safe in the FFT case (plan creation)
 {//{{{
     STARTFCT
 
-    HMPDFCHECK(d->ns->toepl == NULL, "Toeplitz matrix not computed.");
+    HMPDFCHECK(d->ns->kernel == NULL, "noise kernel not computed.");
+
+    long N = d->n->Nsignal_noisy;
+
+    if (d->ns->kernel_ft == NULL)
+    // narrow kernel, direct convolution
+    {
+        zero_real(N, out);
+        long L = d->ns->len_kernel;
+        long w = d->ns->kernel_halfwidth;
+        for (long ii=0; ii<d->n->Nsignal; ii++)
+        {
+            for (long jj=L-w; jj<=L+w; jj++)
+            {
+                out[ii+jj] += in[ii] * d->ns->kernel[jj];
+            }
+        }
+    }
+    else
+    {
+        double *buf;
+        SAFEALLOC(buf, fftw_malloc((N+2) * sizeof(double)));
+        zero_real(N+2, buf);
+        memcpy(buf, in, d->n->Nsignal * sizeof(double));
+        double complex *buf_comp = (double complex *)buf;
+        fftw_plan pr2c = fftw_plan_dft_r2c_1d(N, buf, buf_comp, FFTW_ESTIMATE);
+        fftw_plan pc2r = fftw_plan_dft_c2r_1d(N, buf_comp, buf, FFTW_ESTIMATE);
+
+        fftw_execute(pr2c);
+        for (long ii=0; ii<N/2+1; ii++)
+        {
+            buf_comp[ii] *= d->ns->kernel_ft[ii] / (double)N;
+        }
+        fftw_execute(pc2r);
+        memcpy(out, buf, N * sizeof(double));
 
-    cblas_dgemv(CblasRowMajor, CblasTrans/*toepl matrix needs to be transposed*/,
-                d->n->Nsignal/*rows*/, d->n->Nsignal_noisy/*cols*/,
-                1.0/*alpha*/, d->ns->toepl/*matrix A*/, d->n->Nsignal_noisy/*lda*/,
-                in/*input vector X*/, 1/*stride of X*/, 0.0/*beta*/,
-                out/*output vector Y*/, 1/*stride of Y*/);
+        fftw_destroy_plan(pr2c);
+        fftw_destroy_plan(pc2r);
+        fftw_free(buf);
+    }
     
     ENDFCT
 }//}}}
 
-static int
-multiply_w_gaussian2d(hmpdf_obj *d, double phi, double complex *A)
-// note : this fct includes the FFT normalization
+int
+noise_zeta(hmpdf_obj *d, double phi, double *zeta)
+// evaluates the pixel-pixel noise correlation function
 {//{{{
     STARTFCT
 
-    // evaluate pixel-pixel noise correlation function
-    double zeta;
     if (phi > 0.5 * d->n->phimax)
     {
-        zeta = 0.0;
+        *zeta = 0.0;
     }
     else
     {
         SAFEGSL(gsl_spline_eval_e(d->ns->zeta_interp, phi,
                                   d->ns->zeta_accel[THIS_THREAD],
-                                  &zeta));
+                                  zeta));
     }
 
+    ENDFCT
+}//}}}
+
+static int
+multiply_w_gaussian2d(hmpdf_obj *d, double zeta, double complex *A)
+// note : this fct includes the FFT normalization
+{//{{{
+    STARTFCT
+
     // multiply with the Fourier space noise kernel
     for (long ii=0; ii<d->n->Nsignal_noisy; ii++)
     // loop over long direction (rows)
@@ -467,9 +564,8 @@ multiply_w_gaussian2d(hmpdf_obj *d, double phi, double complex *A)
 }//}}}
 
 int
-noise_matr(hmpdf_obj *d, double *in, double *out, int is_buffered, double phi)
-// assumes [in] = Nsignal*Nsignal if !is_buffered, else (Nsignal+2)*Nsignal,
-//         [out] = Nsignal_noisy*Nsignal_noisy or NULL
+noise_matr_zeta(hmpdf_obj *d, double *in, double *out, int is_buffered, double zeta)
+// same as noise_matr, but with the noise correlation zeta given directly
 // CAUTION: this function is not thread safe!
 //              (we need too much buffer space for that to make sense)
 //          Need to consider this in any OMP environment it is called from
@@ -499,7 +595,7 @@ noise_matr(hmpdf_obj *d, double *in, double *out, int is_buffered, double phi)
     fftw_execute(*(d->ns->pconv_r2c[THIS_THREAD]));
 
     // apply the filter in Fourier space
-    SAFEHMPDF(multiply_w_gaussian2d(d, phi, d->ns->conv_buffer_comp[THIS_THREAD]));
+    SAFEHMPDF(multiply_w_gaussian2d(d, zeta, d->ns->conv_buffer_comp[THIS_THREAD]));
 
     HMPDFCHECK(d->ns->pconv_c2r[THIS_THREAD] == NULL,
                "trying to use uninitialized plan.");
@@ -524,6 +620,23 @@ noise_matr(hmpdf_obj *d, double *in, double *out, int is_buffered, double phi)
     ENDFCT
 }//}}}
 
+int
+noise_matr(hmpdf_obj *d, double *in, double *out, int is_buffered, double phi)
+// assumes [in] = Nsignal*Nsignal if !is_buffered, else (Nsignal+2)*Nsignal,
+//         [out] = Nsignal_noisy*Nsignal_noisy or NULL
+// CAUTION: this function is not thread safe!
+//              (we need too much buffer space for that to make sense)
+//          Need to consider this in any OMP environment it is called from
+{//{{{
+    STARTFCT
+
+    double zeta;
+    SAFEHMPDF(noise_zeta(d, phi, &zeta));
+    SAFEHMPDF(noise_matr_zeta(d, in, out, is_buffered, zeta));
+
+    ENDFCT
+}//}}}
+
 int
 init_noise(hmpdf_obj *d)
 {//{{{
@@ -537,7 +650,7 @@ init_noise(hmpdf_obj *d)
 
         SAFEHMPDF(create_noise_sigmasq(d));
         SAFEHMPDF(create_noisy_grids(d));
-        SAFEHMPDF(create_toepl(d));
+        SAFEHMPDF(create_noise_kernel(d));
     }
     else
     {
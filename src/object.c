@@ -80,26 +80,59 @@ hmpdf_new(void)
 #undef HMPDFNEW_ALLOC
 
 int
-reset_obj(hmpdf_obj *d)
+reset_stages(hmpdf_obj *d, int *dirty)
+// resets the stages marked as dirty [stage_end],
+//     and the remaining output products which are computed on demand
 {//{{{
     STARTFCT
 
-    SAFEHMPDF(reset_numerics(d));
-    SAFEHMPDF(reset_cosmology(d));
-    SAFEHMPDF(reset_class_interface(d));
-    SAFEHMPDF(reset_power(d));
-    SAFEHMPDF(reset_halo_model(d));
-    SAFEHMPDF(reset_filters(d));
-    SAFEHMPDF(reset_noise(d));
-    SAFEHMPDF(reset_onepoint(d));
+    if (dirty[stage_numerics]) { SAFEHMPDF(reset_numerics(d)); }
+    if (dirty[stage_cosmology]) { SAFEHMPDF(reset_cosmology(d)); }
+    if (dirty[stage_class_interface]) { SAFEHMPDF(reset_class_interface(d)); }
+    if (dirty[stage_power]) { SAFEHMPDF(reset_power(d)); }
+    if (dirty[stage_halo_model]) { SAFEHMPDF(reset_halo_model(d)); }
+    if (dirty[stage_filters]) { SAFEHMPDF(reset_filters(d)); }
+    if (dirty[stage_noise]) { SAFEHMPDF(reset_noise(d)); }
+    if (dirty[stage_onepoint]) { SAFEHMPDF(reset_onepoint(d)); }
     SAFEHMPDF(reset_twopoint(d));
     SAFEHMPDF(reset_powerspectrum(d));
     SAFEHMPDF(reset_covariance(d));
-    SAFEHMPDF(reset_profiles(d));
-    SAFEHMPDF(reset_bcm(d));
+    if (dirty[stage_profiles]) { SAFEHMPDF(reset_profiles(d)); }
+    if (dirty[stage_bcm]) { SAFEHMPDF(reset_bcm(d)); }
     SAFEHMPDF(reset_maps(d));
 
-    SAFEHMPDF(null_data(d));
+    // null only after all resets since some modules free memory
+    //     that is referenced from other modules
+    d->inited = 0;
+    if (dirty[stage_numerics]) { SAFEHMPDF(null_numerics(d)); }
+    if (dirty[stage_class_interface]) { SAFEHMPDF(null_class_interface(d)); }
+    if (dirty[stage_cosmology]) { SAFEHMPDF(null_cosmology(d)); }
+    if (dirty[stage_power]) { SAFEHMPDF(null_power(d)); }
+    if (dirty[stage_halo_model]) { SAFEHMPDF(null_halo_model(d)); }
+    if (dirty[stage_filters]) { SAFEHMPDF(null_filters(d)); }
+    if (dirty[stage_profiles]) { SAFEHMPDF(null_profiles(d)); }
+    if (dirty[stage_bcm]) { SAFEHMPDF(null_bcm(d)); }
+    if (dirty[stage_noise]) { SAFEHMPDF(null_noise(d)); }
+    if (dirty[stage_onepoint]) { SAFEHMPDF(null_onepoint(d)); }
+    SAFEHMPDF(null_twopoint(d));
+    SAFEHMPDF(null_powerspectrum(d));
+    SAFEHMPDF(null_covariance(d));
+    SAFEHMPDF(null_maps(d));
+
+    ENDFCT
+}//}}}
+
+int
+reset_obj(hmpdf_obj *d)
+{//{{{
+    STARTFCT
+
+    int dirty[stage_end];
+    for (int ii=0; ii<stage_end; ii++)
+    {
+        dirty[ii] = 1;
+    }
+    SAFEHMPDF(reset_stages(d, dirty));
 
     ENDFCT
 }//}}}
@@ -3,6 +3,9 @@
 #include <string.h>
 #include <math.h>
 #include <complex.h>
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
 
 #include <fftw3.h>
 
@@ -30,6 +33,10 @@ null_onepoint(hmpdf_obj *d)
     d->op->PDFc = NULL;
     d->op->PDFu_noisy = NULL;
     d->op->PDFc_noisy = NULL;
+    d->op->Nzint_ws = 0;
+    d->op->zint_u = NULL;
+    d->op->zint_c = NULL;
+    d->op->p_zint_r2c = NULL;
 
     ENDFCT
 }//}}}
@@ -45,6 +52,18 @@ reset_onepoint(hmpdf_obj *d)
     if (d->op->PDFc != NULL) { fftw_free(d->op->PDFc); }
     if (d->op->PDFu_noisy != NULL) { free(d->op->PDFu_noisy); }
     if (d->op->PDFc_noisy != NULL) { free(d->op->PDFc_noisy); }
+    for (int ii=0; ii<d->op->Nzint_ws; ii++)
+    {
+        if (d->op->zint_u != NULL && d->op->zint_u[ii] != NULL) { fftw_free(d->op->zint_u[ii]); }
+        if (d->op->zint_c != NULL && d->op->zint_c[ii] != NULL) { fftw_free(d->op->zint_c[ii]); }
+    }
+    if (d->op->zint_u != NULL) { free(d->op->zint_u); }
+    if (d->op->zint_c != NULL) { free(d->op->zint_c); }
+    if (d->op->p_zint_r2c != NULL)
+    {
+        fftw_destroy_plan(*(d->op->p_zint_r2c));
+        free(d->op->p_zint_r2c);
+    }
 
     ENDFCT
 }//}}}
@@ -80,18 +99,16 @@ op_segmentsum(hmpdf_obj *d, int z_index, int M_index, double *au, double *ac)
          segment<d->p->segment_boundaries[z_index][M_index][0];
          segment++)
     {
-        batch_t bt;
-        SAFEHMPDF(inv_profile(d, z_index, M_index, segment, dtsq_of_s, &bt));
-        for (long signalindex=bt.start, ii=0;
-             ii < bt.len;
-             (bt.incr==1) ? signalindex++ : signalindex--, ii++)
+        batch_t *bt = d->p->inv_dtsq[z_index][M_index]+segment;
+        for (long signalindex=bt->start, ii=0;
+             ii < bt->len;
+             signalindex += bt->incr, ii++)
         {
-            au[signalindex] += bt.data[ii] * M_PI * n
+            au[signalindex] += bt->data[ii] * M_PI * n
                                * d->n->Mweights[M_index];
-            ac[signalindex] += bt.data[ii] * M_PI * n * b
+            ac[signalindex] += bt->data[ii] * M_PI * n * b
                                * d->n->Mweights[M_index];
         }
-        delete_batch(&bt);
     }
 
     ENDFCT
@@ -112,40 +129,85 @@ op_Mint(hmpdf_obj *d, int z_index, double *au, double *ac)
     ENDFCT
 }//}}}
 
+static int
+create_zint_ws(hmpdf_obj *d)
+// per-thread FFT buffers for the redshift integral, and a single plan
+//     which is executed on all of them (they have the same alignment)
+{//{{{
+    STARTFCT
+
+    if (d->op->p_zint_r2c != NULL) { return 0; }
+
+    HMPDFPRINT(3, "\t\tcreate_zint_ws\n");
+
+    SAFEALLOC(d->op->zint_u, malloc(d->Ncores * sizeof(double *)));
+    SETARRNULL(d->op->zint_u, d->Ncores);
+    SAFEALLOC(d->op->zint_c, malloc(d->Ncores * sizeof(double *)));
+    SETARRNULL(d->op->zint_c, d->Ncores);
+    d->op->Nzint_ws = d->Ncores;
+    for (int ii=0; ii<d->Ncores; ii++)
+    {
+        SAFEALLOC(d->op->zint_u[ii], fftw_malloc((d->n->Nsignal+2) * sizeof(double)));
+        SAFEALLOC(d->op->zint_c[ii], fftw_malloc((d->n->Nsignal+2) * sizeof(double)));
+    }
+
+    SAFEALLOC(d->op->p_zint_r2c, malloc(sizeof(fftw_plan)));
+    *(d->op->p_zint_r2c) = fftw_plan_dft_r2c_1d(d->n->Nsignal, d->op->zint_u[0],
+                                                (double complex *)d->op->zint_u[0],
+                                                FFTW_MEASURE);
+
+    ENDFCT
+}//}}}
+
 static int
 op_zint(hmpdf_obj *d, double complex *pu_comp, double complex *pc_comp) // p is the exponent in P(lambda)
+// the redshift integrand is filled in parallel, each thread owning its
+//     own FFT buffers.
+// The z-integrand is stored per redshift and summed in a fixed order
+//     afterwards, so the result does not depend on the number of threads.
 {//{{{
     STARTFCT
 
-    double *ac_real;
-    SAFEALLOC(ac_real, fftw_malloc((d->n->Nsignal+2) * sizeof(double)));
-    double complex *ac_comp = (double complex *)ac_real;
-    double *au_real;
-    SAFEALLOC(au_real, fftw_malloc((d->n->Nsignal+2) * sizeof(double)));
-    double complex *au_comp = (double complex *)au_real;
-    fftw_plan plan_u = fftw_plan_dft_r2c_1d(d->n->Nsignal, au_real, au_comp, FFTW_MEASURE);
-    fftw_plan plan_c = fftw_plan_dft_r2c_1d(d->n->Nsignal, ac_real, ac_comp, FFTW_MEASURE);
+    long Ncomp = d->n->Nsignal/2+1;
 
-    // zero the output arrays
-    zero_comp(d->n->Nsignal/2+1, pu_comp);
-    zero_comp(d->n->Nsignal/2+1, pc_comp);
+    SAFEHMPDF(create_zint_ws(d));
+
+    // per-redshift integrands
+    double complex *zu_comp, *zc_comp;
+    SAFEALLOC(zu_comp, malloc(d->n->Nz * Ncomp * sizeof(double complex)));
+    SAFEALLOC(zc_comp, malloc(d->n->Nz * Ncomp * sizeof(double complex)));
 
     // fill the z-integrand
+    #ifdef _OPENMP
+    #   pragma omp parallel for num_threads(d->Ncores) schedule(dynamic)
+    #endif
     for (int z_index=0; z_index<d->n->Nz; z_index++)
     {
+        CONTINUE_IF_ERR
+
+        double *au = d->op->zint_u[THIS_THREAD];
+        double *ac = d->op->zint_c[THIS_THREAD];
+        double complex *au_comp = (double complex *)au;
+        double complex *ac_comp = (double complex *)ac;
+
         // zero the arrays
-        zero_comp(d->n->Nsignal/2+1, au_comp);
-        zero_comp(d->n->Nsignal/2+1, ac_comp);
+        zero_comp(Ncomp, au_comp);
+        zero_comp(Ncomp, ac_comp);
+
+        SAFEHMPDF_NORETURN(op_Mint(d, z_index, au, ac));
+        CONTINUE_IF_ERR
 
-        SAFEHMPDF(op_Mint(d, z_index, au_real, ac_real));
         // perform FFTs real -> double complex
-        fftw_execute(plan_u);
-        fftw_execute(plan_c);
+        fftw_execute_dft_r2c(*(d->op->p_zint_r2c), au, au_comp);
+        fftw_execute_dft_r2c(*(d->op->p_zint_r2c), ac, ac_comp);
         // correct phases
-        SAFEHMPDF(correct_phase1d(d, au_comp, 1));
-        SAFEHMPDF(correct_phase1d(d, ac_comp, 1));
+        SAFEHMPDF_NORETURN(correct_phase1d(d, au_comp, 1));
+        SAFEHMPDF_NORETURN(correct_phase1d(d, ac_comp, 1));
+        CONTINUE_IF_ERR
 
-        for (long ii=0; ii<d->n->Nsignal/2+1; ii++)
+        double complex *zu = zu_comp + z_index * Ncomp;
+        double complex *zc = zc_comp + z_index * Ncomp;
+        for (long ii=0; ii<Ncomp; ii++)
         {
             // subtract the zero modes, square the clustered mass integral
             double complex tempu = au_comp[ii] - au_comp[0];
@@ -159,14 +221,27 @@ op_zint(hmpdf_obj *d, double complex *pu_comp, double complex *pc_comp) // p is
                      / d->c->hubble[z_index];
             tempc += tempu;
 
-            pu_comp[ii] += tempu * d->n->zweights[z_index];
-            pc_comp[ii] += tempc * d->n->zweights[z_index];
+            zu[ii] = tempu * d->n->zweights[z_index];
+            zc[ii] = tempc * d->n->zweights[z_index];
         }
     }
-    fftw_free(au_real);
-    fftw_free(ac_real);
-    fftw_destroy_plan(plan_u);
-    fftw_destroy_plan(plan_c);
+
+    RETURN_IF_ERR
+
+    // reduce in redshift order
+    zero_comp(Ncomp, pu_comp);
+    zero_comp(Ncomp, pc_comp);
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        for (long ii=0; ii<Ncomp; ii++)
+        {
+            pu_comp[ii] += zu_comp[z_index*Ncomp+ii];
+            pc_comp[ii] += zc_comp[z_index*Ncomp+ii];
+        }
+    }
+
+    free(zu_comp);
+    free(zc_comp);
 
     ENDFCT
 }//}}}
@@ -232,6 +307,8 @@ create_op(hmpdf_obj *d)
     if (d->op->created_op) { return 0; }
 
     HMPDFPRINT(2, "\tcreate_op\n");
+
+    SAFEHMPDF(create_inv_profiles(d));
     
     SAFEALLOC(d->op->PDFu, fftw_malloc((d->n->Nsignal + 2) * sizeof(double)));
     SAFEALLOC(d->op->PDFc, fftw_malloc((d->n->Nsignal + 2) * sizeof(double)));
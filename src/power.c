@@ -1,16 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include <class.h>
-
 #include <gsl/gsl_spline.h>
 #include <gsl/gsl_integration.h>
 
 #include "configs.h"
 #include "utils.h"
 #include "object.h"
+#include "class_interface.h"
 #include "cosmology.h"
 #include "numerics.h"
+#include "hankel.h"
 #include "power.h"
 
 #include "hmpdf.h"
@@ -21,6 +21,8 @@ null_power(hmpdf_obj *d)
     STARTFCT
 
     d->pwr->inited_power = 0;
+    d->pwr->Pk_interp = NULL;
+    d->pwr->Pk_accel = NULL;
     d->pwr->ssq = NULL;
     d->pwr->created_corr = 0;
     d->pwr->corr_interp = NULL;
@@ -47,6 +49,18 @@ reset_power(hmpdf_obj *d)
         }
         free(d->pwr->ssq);
     }
+    if (d->pwr->Pk_interp != NULL) { gsl_spline_free(d->pwr->Pk_interp); }
+    if (d->pwr->Pk_accel != NULL)
+    {
+        for (int ii=0; ii<d->pwr->NPk_accel; ii++)
+        {
+            if (d->pwr->Pk_accel[ii] != NULL)
+            {
+                gsl_interp_accel_free(d->pwr->Pk_accel[ii]);
+            }
+        }
+        free(d->pwr->Pk_accel);
+    }
     if (d->pwr->corr_interp != NULL) { gsl_spline_free(d->pwr->corr_interp); }
     if (d->pwr->corr_accel != NULL)
     {
@@ -63,32 +77,64 @@ reset_power(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
+static int
+create_Pk_interp(hmpdf_obj *d)
+// interpolates log P(log k)
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(2, "\tcreate_Pk_interp\n");
+
+    // the table has been filled in the CLASS interface (by one of its backends)
+    double *lnk = d->cls->Pk_lnk;
+    double *lnPk = d->cls->Pk_lnPk;
+    d->pwr->Pk_lnkmin = lnk[0];
+    d->pwr->Pk_lnkmax = lnk[d->cls->NPk-1];
+
+    d->pwr->Pk_lowlnPk = lnPk[0];
+    d->pwr->Pk_lowslope = (lnPk[1] - lnPk[0]) / (lnk[1] - lnk[0]);
+
+    SAFEALLOC(d->pwr->Pk_interp,
+              gsl_spline_alloc(interp1d_type(PKINTERP_TYPE), d->cls->NPk));
+    SAFEGSL(gsl_spline_init(d->pwr->Pk_interp, lnk, lnPk, d->cls->NPk));
+    d->pwr->NPk_accel = d->Ncores;
+    SAFEALLOC(d->pwr->Pk_accel,
+              malloc(d->pwr->NPk_accel * sizeof(gsl_interp_accel *)));
+    SETARRNULL(d->pwr->Pk_accel, d->pwr->NPk_accel);
+    for (int ii=0; ii<d->pwr->NPk_accel; ii++)
+    {
+        SAFEALLOC(d->pwr->Pk_accel[ii], gsl_interp_accel_alloc());
+    }
+
+    ENDFCT
+}//}}}
+
 int
 Pk_linear(hmpdf_obj *d, double k, double *out)
 // k is logk if LOGK is defined
 {//{{{
     STARTFCT
 
-    #ifdef LOGK
-    k = exp(k);
+    #ifndef LOGK
+    k = log(k);
     #endif
 
-    struct background *ba = (struct background *)d->cls->ba;
-    struct primordial *pm = (struct primordial *)d->cls->pm;
-    struct fourier *nl = (struct fourier *)d->cls->nl;
-
-    // check if we are at wavenumbers not covered by CLASS interpolator
-    if (UNLIKELY(log(k) > nl->ln_k[nl->k_size-1]))
+    // check if we are at wavenumbers not covered by the interpolator
+    if (UNLIKELY(k > d->pwr->Pk_lnkmax))
     {
         *out = 0.0;
     }
+    else if (UNLIKELY(k < d->pwr->Pk_lnkmin))
+    {
+        *out = exp(d->pwr->Pk_lowlnPk
+                   + d->pwr->Pk_lowslope * (k - d->pwr->Pk_lnkmin));
+    }
     else
     {
-        SAFECLASS(fourier_pk_at_k_and_z(ba, pm, nl,
-                                        pk_linear, k, 0.0,
-                                        nl->index_pk_total,
-                                        out, NULL),
-                  nl->error_message);
+        SAFEGSL(gsl_spline_eval_e(d->pwr->Pk_interp, k,
+                                  d->pwr->Pk_accel[THIS_THREAD],
+                                  out));
+        *out = exp(*out);
     }
 
     ENDFCT
@@ -136,18 +182,16 @@ power_integral(hmpdf_obj *d, power_integrand_params *p, double *out)
 
     p->status = 0;
 
-    struct fourier *nl = (struct fourier *)d->cls->nl;
-
     gsl_function integrand;
     integrand.function = &power_integrand;
     integrand.params = p;
     double err;
     #ifdef LOGK
     double kmin = log(PKINTEGR_KMIN);
-    double kmax = nl->ln_k[nl->k_size-1];
+    double kmax = d->pwr->Pk_lnkmax;
     #else
     double kmin = PKINTEGR_KMIN;
-    double kmax = exp(nl->ln_k[nl->k_size-1]);
+    double kmax = exp(d->pwr->Pk_lnkmax);
     #endif
 
     gsl_integration_workspace *ws;
@@ -208,6 +252,98 @@ ssq(hmpdf_obj *d, double M, double *ssq, double *dssq)
     ENDFCT
 }//}}}
 
+static inline void
+tophat_W_dW(double x, double *W, double *dW)
+// W(x) and dW/dx, with series expansion for small x
+{//{{{
+    if (x < 1e-2)
+    {
+        double xsq = x * x;
+        *W = 1.0 - xsq/10.0 + xsq*xsq/280.0;
+        *dW = x * (-1.0/5.0 + xsq/70.0);
+    }
+    else
+    {
+        double s = sin(x);
+        double c = cos(x);
+        *W = 3.0 * (s - x*c) / gsl_pow_3(x);
+        *dW = 3.0 * s / gsl_pow_2(x) - 3.0 * (*W) / x;
+    }
+}//}}}
+
+static int
+create_ssq_fast(hmpdf_obj *d)
+// computes sigma^2 and d sigma^2 / dlogM for all masses on a shared log k grid
+{//{{{
+    STARTFCT
+
+    HMPDFPRINT(3, "\t\tusing fixed quadrature\n");
+
+    // prepare the integration grid with Simpson weights folded into the kernel
+    double lnkmin = log(PKINTEGR_KMIN);
+    double lnkmax = d->pwr->Pk_lnkmax;
+    double dlnk = (lnkmax - lnkmin) / (double)(SSQINTEGR_NK - 1);
+    double *k;
+    double *kernel;
+    SAFEALLOC(k,      malloc(SSQINTEGR_NK * sizeof(double)));
+    SAFEALLOC(kernel, malloc(SSQINTEGR_NK * sizeof(double)));
+    for (int ii=0; ii<SSQINTEGR_NK; ii++)
+    {
+        double lnk = lnkmin + (double)ii * dlnk;
+        k[ii] = exp(lnk);
+        #ifdef LOGK
+        SAFEHMPDF(Pk_linear(d, lnk, kernel+ii));
+        #else
+        SAFEHMPDF(Pk_linear(d, k[ii], kernel+ii));
+        #endif
+        double w = (ii == 0 || ii == SSQINTEGR_NK-1) ? 1.0
+                   : (ii % 2) ? 4.0 : 2.0;
+        kernel[ii] *= w * dlnk / 3.0 * gsl_pow_3(k[ii]) / 2.0 / M_PI / M_PI;
+    }
+
+    #ifdef _OPENMP
+    #   pragma omp parallel for num_threads(d->Ncores) schedule(static)
+    #endif
+    for (int M_index=0; M_index<d->n->NM; M_index++)
+    {
+        double R = cbrt(3.0*d->n->Mgrid[M_index]/4.0/M_PI/d->c->rho_m_0);
+        double s = 0.0;
+        double ds = 0.0;
+        for (int ii=0; ii<SSQINTEGR_NK; ii++)
+        {
+            double x = k[ii] * R;
+            double W, dW;
+            tophat_W_dW(x, &W, &dW);
+            s += kernel[ii] * W * W;
+            // d W^2 / dlogM = 2 W dW/dx x / 3
+            ds += kernel[ii] * W * dW * x;
+        }
+        d->pwr->ssq[M_index][0] = s;
+        d->pwr->ssq[M_index][1] = ds * 2.0 / 3.0;
+    }
+
+    free(k);
+    free(kernel);
+
+    #ifdef DEBUG
+    // compare with the adaptive integration at every mass
+    for (int M_index=0; M_index<d->n->NM; M_index++)
+    {
+        double s, ds;
+        SAFEHMPDF(ssq(d, d->n->Mgrid[M_index], &s, &ds));
+        HMPDFCHECK(fabs(d->pwr->ssq[M_index][0]/s - 1.0) > SSQINTEGR_CHECK_TOL
+                   || fabs(d->pwr->ssq[M_index][1]/ds - 1.0) > SSQINTEGR_CHECK_TOL,
+                   "fixed quadrature sigma^2 at M = %.2e deviates from "
+                   "adaptive result by %.2e (derivative %.2e).",
+                   d->n->Mgrid[M_index],
+                   d->pwr->ssq[M_index][0]/s - 1.0,
+                   d->pwr->ssq[M_index][1]/ds - 1.0);
+    }
+    #endif
+
+    ENDFCT
+}//}}}
+
 static int
 create_ssq(hmpdf_obj *d)
 {//{{{
@@ -220,9 +356,20 @@ create_ssq(hmpdf_obj *d)
     for (int M_index=0; M_index<d->n->NM; M_index++)
     {
         SAFEALLOC(d->pwr->ssq[M_index], malloc(2 * sizeof(double)));
-        SAFEHMPDF(ssq(d, d->n->Mgrid[M_index],
-                      d->pwr->ssq[M_index]+0,
-                      d->pwr->ssq[M_index]+1));
+    }
+
+    if (d->pwr->fast_ssq)
+    {
+        SAFEHMPDF(create_ssq_fast(d));
+    }
+    else
+    {
+        for (int M_index=0; M_index<d->n->NM; M_index++)
+        {
+            SAFEHMPDF(ssq(d, d->n->Mgrid[M_index],
+                          d->pwr->ssq[M_index]+0,
+                          d->pwr->ssq[M_index]+1));
+        }
     }
 
     ENDFCT
@@ -275,8 +422,8 @@ create_corr(hmpdf_obj *d)
     HMPDFPRINT(2, "\tcreate_corr_interp\n");
     
     d->pwr->corr_rmax = 1.1 * d->n->phimax * d->c->comoving[d->n->Nz-1];
-    gsl_dht *t;
-    SAFEALLOC(t, gsl_dht_new(CORRINTERP_N, 0, d->pwr->corr_rmax));
+    hankel *t;
+    SAFEHMPDF(new_hankel(CORRINTERP_N, d->pwr->corr_rmax, d->n->fftlog, 1, &t));
     double *Pk;
     double *r;
     double *zeta;
@@ -286,20 +433,20 @@ create_corr(hmpdf_obj *d)
     r[0] = 0.0;
     zeta[0] = d->pwr->autocorr;
 
-    double hankel_norm = gsl_pow_2(gsl_dht_k_sample(t, 0)
-                                   / gsl_dht_x_sample(t, 0));
+    double hankel_norm = gsl_pow_2(hankel_k_sample(t, 0)
+                                   / hankel_x_sample(t, 0));
     for (int ii=0; ii<CORRINTERP_N; ii++)
     {
         #ifdef LOGK
-        double k = log(gsl_dht_k_sample(t, ii));
+        double k = log(hankel_k_sample(t, ii));
         #else
-        double k = gsl_dht_k_sample(t, ii);
+        double k = hankel_k_sample(t, ii);
         #endif
         SAFEHMPDF(Pk_linear(d, k, Pk+ii));
-        r[ii+1] = gsl_dht_x_sample(t, ii);
+        r[ii+1] = hankel_x_sample(t, ii);
     }
-    SAFEGSL(gsl_dht_apply(t, Pk, zeta+1));
-    gsl_dht_free(t);
+    SAFEHMPDF(hankel_apply(t, Pk, zeta+1));
+    delete_hankel(t);
     free(Pk);
 
     // divide by 2\pi and fix Hankel normalization
@@ -355,6 +502,7 @@ init_power(hmpdf_obj *d)
 
     HMPDFPRINT(1, "init_power\n");
 
+    SAFEHMPDF(create_Pk_interp(d));
     SAFEHMPDF(create_ssq(d));
     SAFEHMPDF(create_autocorr(d));
 
@@ -3,7 +3,6 @@
 
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_interp.h>
-#include <gsl/gsl_dht.h>
 #include <gsl/gsl_sf_bessel.h>
 #include <gsl/gsl_sf_result.h>
 
@@ -15,6 +14,7 @@
 #include "power.h"
 #include "profiles.h"
 #include "filter.h"
+#include "hankel.h"
 #include "powerspectrum.h"
 
 #include "hmpdf.h"
@@ -235,8 +235,8 @@ create_Cphi(hmpdf_obj *d)
     HMPDFPRINT(2, "\tcreate_Cphi\n");
     
     SAFEHMPDF(find_Nell(d, &(d->ps->Nell_corr)));
-    gsl_dht *t;
-    SAFEALLOC(t, gsl_dht_new(d->ps->Nell_corr, 0, 2.0 * d->n->phimax));
+    hankel *t;
+    SAFEHMPDF(new_hankel(d->ps->Nell_corr, 2.0 * d->n->phimax, d->n->fftlog, 1, &t));
     
     SAFEALLOC(d->ps->phi, malloc(d->ps->Nell_corr * sizeof(double)));
     double *temp_ell;
@@ -249,25 +249,25 @@ create_Cphi(hmpdf_obj *d)
     
     for (int ii=0; ii<d->ps->Nell_corr; ii++)
     {
-        d->ps->phi[ii] = gsl_dht_x_sample(t, ii);
-        temp_ell[ii] = gsl_dht_k_sample(t, ii);
+        d->ps->phi[ii] = hankel_x_sample(t, ii);
+        temp_ell[ii] = hankel_k_sample(t, ii);
     }
 
-    double hankel_norm = gsl_pow_2(gsl_dht_k_sample(t, 0)
-                                   / gsl_dht_x_sample(t, 0));
+    double hankel_norm = gsl_pow_2(hankel_k_sample(t, 0)
+                                   / hankel_x_sample(t, 0));
 
     // 1halo term
     SAFEHMPDF(hmpdf_get_Cell(d, d->ps->Nell_corr, temp_ell,
                              temp_Cell, hmpdf_onehalo));
-    SAFEGSL(gsl_dht_apply(t, temp_Cell, d->ps->Cphi_1h));
+    SAFEHMPDF(hankel_apply(t, temp_Cell, d->ps->Cphi_1h));
     // 2halo term
     SAFEHMPDF(hmpdf_get_Cell(d, d->ps->Nell_corr, temp_ell,
                              temp_Cell, hmpdf_twohalo));
-    SAFEGSL(gsl_dht_apply(t, temp_Cell, d->ps->Cphi_2h));
+    SAFEHMPDF(hankel_apply(t, temp_Cell, d->ps->Cphi_2h));
     // total
     SAFEHMPDF(hmpdf_get_Cell(d, d->ps->Nell_corr, temp_ell,
                              temp_Cell, hmpdf_total));
-    SAFEGSL(gsl_dht_apply(t, temp_Cell, d->ps->Cphi_tot));
+    SAFEHMPDF(hankel_apply(t, temp_Cell, d->ps->Cphi_tot));
     // normalizetion
     for (int ii=0; ii<d->ps->Nell_corr; ii++)
     {
@@ -278,7 +278,7 @@ create_Cphi(hmpdf_obj *d)
 
     free(temp_ell);
     free(temp_Cell);
-    gsl_dht_free(t);
+    delete_hankel(t);
 
     d->ps->created_Cphi = 1;
 
@@ -11,7 +11,6 @@
 #include <gsl/gsl_sf_result.h>
 #include <gsl/gsl_interp.h>
 #include <gsl/gsl_spline.h>
-#include <gsl/gsl_dht.h>
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_fit.h>
 
@@ -22,6 +21,7 @@
 #include "halo_model.h"
 #include "filter.h"
 #include "bcm.h"
+#include "hankel.h"
 #include "profiles.h"
 
 #include "hmpdf.h"
@@ -39,7 +39,11 @@ null_profiles(hmpdf_obj *d)
     d->p->reci_tgrid = NULL;
     d->p->created_segments = 0;
     d->p->segment_boundaries = NULL;
-    d->p->dht_ws = NULL;
+    d->p->created_inv_profiles = 0;
+    d->p->inv_arena = NULL;
+    d->p->inv_dtsq = NULL;
+    d->p->inv_t = NULL;
+    d->p->hankel_ws = NULL;
     d->p->profiles = NULL;
     d->p->created_conj_profiles = 0;
     d->p->conj_profiles = NULL;
@@ -66,7 +70,7 @@ reset_profiles(hmpdf_obj *d)
     if (d->p->reci_tgrid != NULL) { free(d->p->reci_tgrid); }
     if (d->p->incr_tgrid_accel != NULL)
     {
-        for (int ii=0; ii<d->Ncores; ii++)
+        for (int ii=0; ii<d->p->Nincr_tgrid_accel; ii++)
         {
             if (d->p->incr_tgrid_accel[ii] != NULL)
             {
@@ -148,7 +152,31 @@ reset_profiles(hmpdf_obj *d)
         }
         free(d->p->segment_boundaries);
     }
-    if (d->p->dht_ws != NULL) { gsl_dht_free(d->p->dht_ws); }
+    batch_t ****inv[] = {&d->p->inv_dtsq, &d->p->inv_t};
+    for (int mode=0; mode<2; mode++)
+    {
+        if (*inv[mode] != NULL)
+        {
+            for (int z_index=0; z_index<d->n->Nz; z_index++)
+            {
+                if ((*inv[mode])[z_index] != NULL)
+                {
+                    for (int M_index=0; M_index<d->n->NM; M_index++)
+                    {
+                        // the batch data live in inv_arena
+                        if ((*inv[mode])[z_index][M_index] != NULL)
+                        {
+                            free((*inv[mode])[z_index][M_index]);
+                        }
+                    }
+                    free((*inv[mode])[z_index]);
+                }
+            }
+            free(*inv[mode]);
+        }
+    }
+    if (d->p->inv_arena != NULL) { free(d->p->inv_arena); }
+    if (d->p->hankel_ws != NULL) { delete_hankel(d->p->hankel_ws); }
     if (d->p->tot_profiles_indices != NULL) { free(d->p->tot_profiles_indices); }
 
     ENDFCT
@@ -188,10 +216,11 @@ create_angle_grids(hmpdf_obj *d)
     d->p->incr_tsqgrid[0] = 0.0;
     d->p->incr_tgrid[0] = 0.0;
 
+    d->p->Nincr_tgrid_accel = d->Ncores;
     SAFEALLOC(d->p->incr_tgrid_accel,
-              malloc(d->Ncores * sizeof(gsl_interp_accel *)));
-    SETARRNULL(d->p->incr_tgrid_accel, d->Ncores);
-    for (int ii=0; ii<d->Ncores; ii++)
+              malloc(d->p->Nincr_tgrid_accel * sizeof(gsl_interp_accel *)));
+    SETARRNULL(d->p->incr_tgrid_accel, d->p->Nincr_tgrid_accel);
+    for (int ii=0; ii<d->p->Nincr_tgrid_accel; ii++)
     {
         SAFEALLOC(d->p->incr_tgrid_accel[ii], gsl_interp_accel_alloc());
     }
@@ -302,7 +331,7 @@ kappa_profile(hmpdf_obj *d, int z_index, int M_index,
         double lout = sqrt(Rout*Rout - Rproj*Rproj);
 
         p[ii] -= 2.0 * lout * d->c->rho_m[z_index];
-        p[ii] *= d->c->invScrit[z_index];
+        p[ii] *= d->c->invScrit[d->p->dndz_index*d->n->Nz+z_index];
     }
 
     ENDFCT
@@ -355,7 +384,7 @@ kappabcm_profile(hmpdf_obj *d, int z_index, int M_index,
     SAFEALLOC(cquad_ws, gsl_integration_cquad_workspace_alloc(BATTINTEGR_LIMIT));
 
     double epsabs = BATTINTEGR_EPSABS * (d->n->signalgrid[1]-d->n->signalgrid[0])
-                    / d->c->invScrit[z_index]; // note rescaling of integrals
+                    / d->c->invScrit[d->p->dndz_index*d->n->Nz+z_index]; // note rescaling of integrals
 
     // loop over angles
     for (int ii=1/*start one inside, outermost value=0*/; ii<d->p->Ntheta; ii++)
@@ -383,7 +412,7 @@ kappabcm_profile(hmpdf_obj *d, int z_index, int M_index,
 
         p[ii] *= 2.0; // symmetry
         p[ii] -= 2.0*lout*d->c->rho_m[z_index];
-        p[ii] *= d->c->invScrit[z_index];
+        p[ii] *= d->c->invScrit[d->p->dndz_index*d->n->Nz+z_index];
     }
 
     gsl_integration_workspace_free(integr_ws);
@@ -622,7 +651,7 @@ create_conj_profiles(hmpdf_obj *d)
     HMPDFPRINT(2, "\tcreate_conj_profiles\n");
     
     // prepare the Hankel transform work space
-    SAFEALLOC(d->p->dht_ws, gsl_dht_new(d->p->Ntheta, 0, 1.0));
+    SAFEHMPDF(new_hankel(d->p->Ntheta, 1.0, d->n->fftlog, d->Ncores, &d->p->hankel_ws));
     SAFEALLOC(d->p->conj_profiles, malloc(d->n->Nz * sizeof(double **)));
     SETARRNULL(d->p->conj_profiles, d->n->Nz);
     #ifdef _OPENMP
@@ -647,8 +676,8 @@ create_conj_profiles(hmpdf_obj *d)
                                malloc((d->p->Ntheta+1) * sizeof(double)));
             CONTINUE_IF_ERR
             reverse(d->p->Ntheta, d->p->profiles[z_index][M_index]+1, temp);
-            // dht_ws is const under gsl_dht_apply, so this is thread safe
-            SAFEGSL_NORETURN(gsl_dht_apply(d->p->dht_ws, temp,
+            // hankel_apply is thread safe
+            SAFEHMPDF_NORETURN(hankel_apply(d->p->hankel_ws, temp,
                                            d->p->conj_profiles[z_index][M_index]+1));
             CONTINUE_IF_ERR
             d->p->conj_profiles[z_index][M_index][0]
@@ -714,7 +743,7 @@ create_filtered_profiles(hmpdf_obj *d)
                                              temp, 1, filter_pdf, &z_index));
             CONTINUE_IF_ERR
             // transform back to real space
-            SAFEGSL_NORETURN(gsl_dht_apply(d->p->dht_ws, temp,
+            SAFEHMPDF_NORETURN(hankel_apply(d->p->hankel_ws, temp,
                                            d->p->filtered_profiles[z_index][M_index]+1));
             CONTINUE_IF_ERR
             // reverse the profile
@@ -943,25 +972,18 @@ remove_duplicates(int *N, double *x, double *y, double eps)
     ENDFCT
 }//}}}
 
-void
-delete_batch(batch_t *b)
-{//{{{
-    if (b->data != NULL)
-    {
-        free(b->data);
-    }
-}//}}}
-
 int
 inv_profile(hmpdf_obj *d, int z_index, int M_index, int segment,
-            inv_profile_e mode, batch_t *b)
+            inv_profile_e mode, batch_t *b, double *dest)
 // Depending on mode = { dtsq_of_s , t_of_s },
 // write dtheta^2(signal)/dsignal*dsignal,
 //    or theta(signal)
-// into return value
+// into dest, which must have length b->len from a previous call with dest == NULL.
+// If dest == NULL, only the position and length of the batch are computed.
 {//{{{
     STARTFCT
 
+    long len_expected = (dest == NULL) ? 0 : b->len;
     b->len = 0;
     b->data = NULL;
 
@@ -1006,6 +1028,31 @@ inv_profile(hmpdf_obj *d, int z_index, int M_index, int segment,
     // check if it's too short now
     if (len < min_size)
     {
+        free(temp);
+        free(ordinate);
+        ENDFCT
+    }
+
+    if (dest == NULL)
+    // the batch consists of the signal values in the range of the interpolator
+    {
+        for (long ii = (sgn==1) ? 0 : d->n->Nsignal-1;
+             (sgn==1) ? ii<d->n->Nsignal : ii>=0;
+             (sgn==1) ? ii++ : ii--)
+        {
+            if (d->n->signalgrid[ii] >= temp[0] && d->n->signalgrid[ii] <= temp[len-1])
+            {
+                if (b->len == 0)
+                {
+                    b->start = ii;
+                    b->incr = sgn;
+                }
+                ++b->len;
+            }
+        }
+
+        free(temp);
+        free(ordinate);
         ENDFCT
     }
 
@@ -1015,8 +1062,6 @@ inv_profile(hmpdf_obj *d, int z_index, int M_index, int segment,
 
     // auxiliary variables to keep track of current state
     int inbatch = 0;
-    int len_this_batch = (int)(fabs(temp[len-1]-temp[0])
-                               / (d->n->signalgrid[1]-d->n->signalgrid[0])) + 4;
 
     for (long ii = (sgn==1) ? 0 : d->n->Nsignal-1;
          (sgn==1) ? ii<d->n->Nsignal : ii>=0;
@@ -1048,12 +1093,15 @@ inv_profile(hmpdf_obj *d, int z_index, int M_index, int segment,
                 HMPDFCHECK(b->len > 0, "something is weird with this profile "
                                        "(z = %d, M = %d, segment = %d)",
                                        z_index, M_index, segment);
-                SAFEALLOC(b->data, malloc(len_this_batch * sizeof(double)));
+                b->data = dest;
                 b->start = ii;
                 b->incr = sgn;
                 b->len = 0;
             }
-            b->data[b->len] = val;
+            if (b->len < len_expected)
+            {
+                b->data[b->len] = val;
+            }
             ++b->len;
             inbatch = 1;
         }
@@ -1067,6 +1115,148 @@ inv_profile(hmpdf_obj *d, int z_index, int M_index, int segment,
     free(temp);
     free(ordinate);
 
+    HMPDFCHECK(b->len != len_expected,
+               "batch shorter than expected (z = %d, M = %d, segment = %d)",
+               z_index, M_index, segment);
+
+    ENDFCT
+}//}}}
+
+int
+create_inv_profiles(hmpdf_obj *d)
+// computes the inverted profiles dtsq_of_s and t_of_s for all (z, M, segment)
+//     and stores them in a single contiguous arena.
+//     The batch lengths are found in a first pass, so the arena can be sized
+//     before the inverted profiles are written directly into it.
+// These are shared between the one-point, two-point and covariance computations.
+{//{{{
+    STARTFCT
+
+    if (d->p->created_inv_profiles) { return 0; }
+
+    HMPDFPRINT(2, "\tcreate_inv_profiles\n");
+
+    HMPDFCHECK(!(d->p->created_segments),
+               "segments need to be created before the profiles can be inverted.");
+
+    SAFEALLOC(d->p->inv_dtsq, malloc(d->n->Nz * sizeof(batch_t **)));
+    SETARRNULL(d->p->inv_dtsq, d->n->Nz);
+    SAFEALLOC(d->p->inv_t,    malloc(d->n->Nz * sizeof(batch_t **)));
+    SETARRNULL(d->p->inv_t,    d->n->Nz);
+
+    // find the batch lengths
+    #ifdef _OPENMP
+    #   pragma omp parallel for num_threads(d->Ncores) schedule(dynamic)
+    #endif
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        CONTINUE_IF_ERR
+        SAFEALLOC_NORETURN(d->p->inv_dtsq[z_index], malloc(d->n->NM * sizeof(batch_t *)));
+        SAFEALLOC_NORETURN(d->p->inv_t[z_index],    malloc(d->n->NM * sizeof(batch_t *)));
+        CONTINUE_IF_ERR
+        SETARRNULL(d->p->inv_dtsq[z_index], d->n->NM);
+        SETARRNULL(d->p->inv_t[z_index],    d->n->NM);
+        for (int M_index=0; M_index<d->n->NM; M_index++)
+        {
+            CONTINUE_IF_ERR
+            int Nsegments = d->p->segment_boundaries[z_index][M_index][0];
+            SAFEALLOC_NORETURN(d->p->inv_dtsq[z_index][M_index],
+                               malloc(Nsegments * sizeof(batch_t)));
+            SAFEALLOC_NORETURN(d->p->inv_t[z_index][M_index],
+                               malloc(Nsegments * sizeof(batch_t)));
+            CONTINUE_IF_ERR
+            for (int segment=0; segment<Nsegments; segment++)
+            {
+                SAFEHMPDF_NORETURN(inv_profile(d, z_index, M_index, segment, dtsq_of_s,
+                                               d->p->inv_dtsq[z_index][M_index]+segment,
+                                               NULL));
+                SAFEHMPDF_NORETURN(inv_profile(d, z_index, M_index, segment, t_of_s,
+                                               d->p->inv_t[z_index][M_index]+segment,
+                                               NULL));
+            }
+        }
+    }
+    RETURN_IF_ERR
+
+    // size the arena and assign each batch its place in it
+    size_t arena_len = 0;
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        for (int M_index=0; M_index<d->n->NM; M_index++)
+        {
+            for (int segment=0;
+                 segment<d->p->segment_boundaries[z_index][M_index][0];
+                 segment++)
+            {
+                arena_len += d->p->inv_dtsq[z_index][M_index][segment].len
+                             + d->p->inv_t[z_index][M_index][segment].len;
+            }
+        }
+    }
+    HMPDFPRINT(3, "\t\tinverted profiles occupy %.2f MB\n",
+                  (double)(arena_len * sizeof(double)) / 1024.0 / 1024.0);
+
+    SAFEALLOC(d->p->inv_arena, malloc(GSL_MAX(arena_len, 1) * sizeof(double)));
+    double *ptr = d->p->inv_arena;
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        for (int M_index=0; M_index<d->n->NM; M_index++)
+        {
+            for (int segment=0;
+                 segment<d->p->segment_boundaries[z_index][M_index][0];
+                 segment++)
+            {
+                batch_t *b[] = {d->p->inv_dtsq[z_index][M_index]+segment,
+                                d->p->inv_t[z_index][M_index]+segment};
+                for (int mode=0; mode<2; mode++)
+                {
+                    b[mode]->data = ptr;
+                    ptr += b[mode]->len;
+                }
+            }
+        }
+    }
+
+    // invert into the arena
+    #ifdef _OPENMP
+    #   pragma omp parallel for num_threads(d->Ncores) schedule(dynamic)
+    #endif
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        for (int M_index=0; M_index<d->n->NM; M_index++)
+        {
+            for (int segment=0;
+                 segment<d->p->segment_boundaries[z_index][M_index][0];
+                 segment++)
+            {
+                CONTINUE_IF_ERR
+
+                batch_t *b[] = {d->p->inv_dtsq[z_index][M_index]+segment,
+                                d->p->inv_t[z_index][M_index]+segment};
+                inv_profile_e modes[] = {dtsq_of_s, t_of_s};
+                for (int mode=0; mode<2; mode++)
+                {
+                    if (b[mode]->len > 0)
+                    {
+                        SAFEHMPDF_NORETURN(inv_profile(d, z_index, M_index, segment,
+                                                       modes[mode], b[mode],
+                                                       b[mode]->data));
+                    }
+                }
+                CONTINUE_IF_ERR
+
+                // sanity check
+                HMPDFCHECK_NORETURN(not_monotonic(b[1]->len, b[1]->data, -1),
+                                    "theta values not monotonically decreasing in "
+                                    "z = %d, M = %d, segment = %d",
+                                    z_index, M_index, segment);
+            }
+        }
+    }
+    RETURN_IF_ERR
+
+    d->p->created_inv_profiles = 1;
+
     ENDFCT
 }//}}}
 
@@ -13,6 +13,7 @@
 #include "power.h"
 #include "profiles.h"
 #include "onepoint.h"
+#include "twopoint_kernels.h"
 
 #include "hmpdf.h"
 
@@ -22,8 +23,6 @@ null_twopoint(hmpdf_obj *d)
     STARTFCT
 
     d->tp->created_phi_indep = 0;
-    d->tp->dtsq = NULL;
-    d->tp->t = NULL;
     d->tp->ac = NULL;
     d->tp->au = NULL;
     d->tp->ws = NULL;
@@ -41,54 +40,6 @@ reset_twopoint(hmpdf_obj *d)
 
     HMPDFPRINT(2, "\treset_twopoint\n");
 
-    if (d->tp->dtsq != NULL)
-    {
-        for (int z_index=0; z_index<d->n->Nz; z_index++)
-        {
-            if (d->tp->dtsq[z_index] != NULL)
-            {
-                for (int M_index=0; M_index<d->n->NM; M_index++)
-                {
-                    if (d->tp->dtsq[z_index][M_index] != NULL)
-                    {
-                        for (int segment=0;
-                             segment<d->p->segment_boundaries[z_index][M_index][0];
-                             segment++)
-                        {
-                            delete_batch(d->tp->dtsq[z_index][M_index]+segment);
-                        }
-                        free(d->tp->dtsq[z_index][M_index]);
-                    }
-                }
-                free(d->tp->dtsq[z_index]);
-            }
-        }
-        free(d->tp->dtsq);
-    }
-    if (d->tp->t != NULL)
-    {
-        for (int z_index=0; z_index<d->n->Nz; z_index++)
-        {
-            if (d->tp->t[z_index] != NULL)
-            {
-                for (int M_index=0; M_index<d->n->NM; M_index++)
-                {
-                    if (d->tp->t[z_index][M_index] != NULL)
-                    {
-                        for (int segment=0;
-                             segment<d->p->segment_boundaries[z_index][M_index][0];
-                             segment++)
-                        {
-                            delete_batch(d->tp->t[z_index][M_index]+segment);
-                        }
-                        free(d->tp->t[z_index][M_index]);
-                    }
-                }
-                free(d->tp->t[z_index]);
-            }
-        }
-        free(d->tp->t);
-    }
     if (d->tp->ac != NULL)
     {
         for (int z_index=0; z_index<d->n->Nz; z_index++)
@@ -101,16 +52,7 @@ reset_twopoint(hmpdf_obj *d)
         free(d->tp->ac);
     }
     if (d->tp->au != NULL) { fftw_free(d->tp->au); }
-    if (d->tp->ws != NULL)
-    {
-        fftw_free(d->tp->ws->pdf_real);
-        free(d->tp->ws->bc);
-        fftw_free(d->tp->ws->tempc_real);
-        fftw_destroy_plan(d->tp->ws->pu_r2c);
-        fftw_destroy_plan(d->tp->ws->pc_r2c);
-        fftw_destroy_plan(d->tp->ws->ppdf_c2r);
-        free(d->tp->ws);
-    }
+    if (d->tp->ws != NULL) { delete_tp_ws(d->tp->ws); }
     if (d->tp->pdf != NULL) { free(d->tp->pdf); }
     if (d->tp->pdf_noisy != NULL) { free(d->tp->pdf_noisy); }
 
@@ -146,18 +88,16 @@ correct_phase2d(hmpdf_obj *d, double complex *x, int sgn)
 
 int
 create_phi_indep(hmpdf_obj *d)
-// computes tp->dtsq, tp->t, tp->ac
+// computes tp->au, tp->ac
 {//{{{
     STARTFCT
 
     if (d->tp->created_phi_indep) { return 0; }
 
     HMPDFPRINT(2, "\tcreate_phi_indep\n");
+
+    SAFEHMPDF(create_inv_profiles(d));
     
-    SAFEALLOC(d->tp->dtsq, malloc(d->n->Nz * sizeof(batch_t **)));
-    SETARRNULL(d->tp->dtsq, d->n->Nz);
-    SAFEALLOC(d->tp->t,    malloc(d->n->Nz * sizeof(batch_t **)));
-    SETARRNULL(d->tp->t,    d->n->Nz);
     SAFEALLOC(d->tp->ac,   malloc(d->n->Nz * sizeof(double complex *)));
     SETARRNULL(d->tp->ac,   d->n->Nz);
     SAFEALLOC(d->tp->au,   fftw_malloc((d->n->Nsignal/2+1) * sizeof(double complex)));
@@ -176,56 +116,32 @@ create_phi_indep(hmpdf_obj *d)
 
     for (int z_index=0; z_index<d->n->Nz; z_index++)
     {
-        SAFEALLOC(d->tp->dtsq[z_index], malloc(d->n->NM * sizeof(batch_t *)));
-        SETARRNULL(d->tp->dtsq[z_index], d->n->NM);
-        SAFEALLOC(d->tp->t[z_index],    malloc(d->n->NM * sizeof(batch_t *)));
-        SETARRNULL(d->tp->t[z_index],    d->n->NM);
         SAFEALLOC(d->tp->ac[z_index],   malloc((d->n->Nsignal/2+1) * sizeof(double complex)));
 
         // zero the FFT array
         zero_real(d->n->Nsignal+2, tempc_real);
 
-        // integrate clustered contribution over mass;
-        // and fill the theta(signal) dtheta^2/dsignal grids
+        // integrate clustered contribution over mass
         for (int M_index=0; M_index<d->n->NM; M_index++)
         {
             double n = d->h->hmf[z_index][M_index];
             double b = d->h->bias[z_index][M_index];
 
-            SAFEALLOC(d->tp->dtsq[z_index][M_index],
-                      malloc(d->p->segment_boundaries[z_index][M_index][0]
-                             * sizeof(batch_t)));
-            SAFEALLOC(d->tp->t[z_index][M_index],
-                      malloc(d->p->segment_boundaries[z_index][M_index][0]
-                             * sizeof(batch_t)));
-
             for (int segment=0;
                  segment<d->p->segment_boundaries[z_index][M_index][0];
                  segment++)
             {
-                SAFEHMPDF(inv_profile(d, z_index, M_index, segment,
-                                      dtsq_of_s, d->tp->dtsq[z_index][M_index]+segment));
-                SAFEHMPDF(inv_profile(d, z_index, M_index, segment,
-                                      t_of_s, d->tp->t[z_index][M_index]+segment));
-
-                // sanity check
-                HMPDFCHECK(not_monotonic(d->tp->t[z_index][M_index][segment].len,
-                                         d->tp->t[z_index][M_index][segment].data,
-                                         -1),
-                           "theta values not monotonically decreasing in "
-                           "z = %d, M = %d, segment = %d",
-                           z_index, M_index, segment);
-
-                for (long signalindex=d->tp->t[z_index][M_index][segment].start, ii=0;
-                     ii < d->tp->t[z_index][M_index][segment].len;
-                     signalindex += d->tp->t[z_index][M_index][segment].incr, ii++)
+                batch_t *dtsq = d->p->inv_dtsq[z_index][M_index]+segment;
+                for (long signalindex=dtsq->start, ii=0;
+                     ii < dtsq->len;
+                     signalindex += dtsq->incr, ii++)
                 {
                     au_real[signalindex] += M_PI * n
-                                            * d->tp->dtsq[z_index][M_index][segment].data[ii]
+                                            * dtsq->data[ii]
                                             * d->n->Mweights[M_index] * d->n->zweights[z_index]
                                             * gsl_pow_2(d->c->comoving[z_index]) / d->c->hubble[z_index];
                     tempc_real[signalindex] += M_PI * n * b
-                                               * d->tp->dtsq[z_index][M_index][segment].data[ii]
+                                               * dtsq->data[ii]
                                                * d->n->Mweights[M_index];
                 }
             }
@@ -259,14 +175,6 @@ create_phi_indep(hmpdf_obj *d)
     ENDFCT
 }//}}}
 
-static inline double
-triang_A(double a, double b, double c)
-// inverse triangle area by Heron's formula
-{//{{{
-    double s = 0.5 * (a + b + c);
-    return pow(s * (s-a) * (s-b) * (s-c), -0.5);
-}//}}}
-
 static int
 tp_segmentsum(hmpdf_obj *d, int z_index, int M_index, double phi, twopoint_workspace *ws)
 {//{{{
@@ -276,56 +184,76 @@ tp_segmentsum(hmpdf_obj *d, int z_index, int M_index, double phi, twopoint_works
     double n = d->h->hmf[z_index][M_index];
     double b = d->h->bias[z_index][M_index];
 
+    // the z-dependent prefactor of the unclustered term
+    double zpref = gsl_pow_2(d->c->comoving[z_index])
+                   / d->c->hubble[z_index] * d->n->zweights[z_index];
+
+    batch_t *t = d->p->inv_t[z_index][M_index];
+    batch_t *dtsq = d->p->inv_dtsq[z_index][M_index];
+
     for (int segment1 = 0;
          segment1 < d->p->segment_boundaries[z_index][M_index][0];
          segment1++)
     {
+        if (t[segment1].len == 0) { continue; }
+
         for (int segment2 = 0;
              segment2 < d->p->segment_boundaries[z_index][M_index][0];
              segment2++)
         {
+            if (t[segment2].len == 0) { continue; }
+
+            // no triangle can be formed with any element of these two segments
+            if (phi >= t[segment1].data[0] + t[segment2].data[0]) { continue; }
+
             // loop such that the theta values are always monotonically decreasing
             // so that we know when to break
-            for (long signalindex1 = d->tp->t[z_index][M_index][segment1].start, ii=0;
-                 ii < d->tp->t[z_index][M_index][segment1].len;
-                 signalindex1 += d->tp->t[z_index][M_index][segment1].incr, ii++)
+            for (long signalindex1 = t[segment1].start, ii=0;
+                 ii < t[segment1].len;
+                 signalindex1 += t[segment1].incr, ii++)
             // loop over the direction that is Nsignal long
             {
-                double t1 = d->tp->t[z_index][M_index][segment1].data[ii];
+                double t1 = t[segment1].data[ii];
                 // t1 is monotonically decreasing with ii
 
                 // check if no triangle can be formed anymore, since t1 only decreases
                 if (phi >= t1 + d->p->profiles[z_index][M_index][0]) { break; }
 
-                for (long signalindex2 = d->tp->t[z_index][M_index][segment2].start, jj=0;
-                     (jj < d->tp->t[z_index][M_index][segment2].len)
-                      && (signalindex2 <= signalindex1);
-                     // compute only half of the matrix, because it's symmetric
-                     signalindex2 += d->tp->t[z_index][M_index][segment2].incr, jj++)
-                // loop over the direction that is Nsignal+2 long
+                // compute only half of the matrix, because it's symmetric
+                long len2;
+                if (t[segment2].incr == 1)
+                {
+                    len2 = GSL_MIN(t[segment2].len,
+                                   signalindex1 - t[segment2].start + 1);
+                }
+                else
+                {
+                    len2 = (t[segment2].start > signalindex1) ? 0 : t[segment2].len;
+                }
+                if (len2 <= 0) { continue; }
+
+                // find the band in which triangles can be formed
+                long jlo = tp_band_lo(len2, t[segment2].data, t1, phi);
+                long jhi = tp_band_hi(len2, t[segment2].data, t1, phi);
+                if (jhi <= jlo) { continue; }
+
+                double w = 0.25 * n * dtsq[segment1].data[ii]
+                           * d->n->Mweights[M_index];
+                long offset = signalindex1*(d->n->Nsignal+2)
+                              + t[segment2].start + t[segment2].incr * jlo;
+
+                // add to clustered and unclustered terms
+                if (t[segment2].incr == 1)
+                {
+                    tp_band(jhi-jlo, phi, t1, w * b, w * zpref,
+                            t[segment2].data+jlo, dtsq[segment2].data+jlo,
+                            ws->tempc_real+offset, ws->pdf_real+offset);
+                }
+                else
                 {
-                    double t2 = d->tp->t[z_index][M_index][segment2].data[jj];
-                    // t2 is monotonically decreasing with jj
-
-                    // check if we can form a triangle
-                    if (t1 >= t2 + phi) { break; }    // t2 only decreases
-                    if (t2 >= phi + t1) { continue; } // no triangle possible here, but perhaps later
-                    if (phi >= t1 + t2) { break; }    // t1,t2 only decrease
-
-                    double Delta = triang_A(phi, t1, t2);
-                    double temp = 0.25 * n * Delta
-                                  * d->tp->dtsq[z_index][M_index][segment1].data[ii]
-                                  * d->tp->dtsq[z_index][M_index][segment2].data[jj]
-                                  * d->n->Mweights[M_index];
-
-                    // add to clustered term
-                    ws->tempc_real[signalindex1*(d->n->Nsignal+2)+signalindex2]
-                        += temp * b;
-
-                    // add to unclustered term
-                    ws->pdf_real[signalindex1*(d->n->Nsignal+2)+signalindex2]
-                        += temp * gsl_pow_2(d->c->comoving[z_index])
-                           / d->c->hubble[z_index] * d->n->zweights[z_index];
+                    tp_band_reversed(jhi-jlo, phi, t1, w * b, w * zpref,
+                                     t[segment2].data+jlo, dtsq[segment2].data+jlo,
+                                     ws->tempc_real+offset, ws->pdf_real+offset);
                 }
             }
         }
@@ -413,16 +341,45 @@ symmetrize(hmpdf_obj *d, double *A)
 }//}}}
 
 static int
-tp_zint(hmpdf_obj *d, double phi, twopoint_workspace *ws)
+tp_add_clustered(hmpdf_obj *d, int z_index, double phi,
+                 double complex *b12, twopoint_workspace *ws)
+// adds the clustered contribution at z_index to ws->bc,
+//     b12 is the phase-corrected Fourier transform of the clustered beta matrix
+{//{{{
+    STARTFCT
+
+    // compute the correlation function interpolator
+    double corr_phi_2, corr_phi;
+    SAFEHMPDF(corr(d, z_index, 0.5*phi, &corr_phi_2));
+    SAFEHMPDF(corr(d, z_index, phi, &corr_phi));
+
+    // add to the clustered output
+    for (long ii=0; ii<d->n->Nsignal; ii++)
+    // loop over the long direction
+    {
+        for (long jj=0; jj<d->n->Nsignal/2+1; jj++)
+        // loop over the short direction
+        {
+            double complex clterm;
+            SAFEHMPDF(clustered_term(d, z_index, corr_phi_2, corr_phi,
+                                     ii, jj, b12, &clterm));
+            double complex temp = clterm
+                                  * gsl_pow_4(d->c->comoving[z_index])
+                                  / d->c->hubble[z_index];
+            ws->bc[ii*(d->n->Nsignal/2+1)+jj] += temp * d->n->zweights[z_index];
+        }
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+tp_zint_exact(hmpdf_obj *d, double phi, twopoint_workspace *ws)
 // z-integral of the unclustered terms, without FFT 
 // z-integral of the clustered terms, including FFT (of course)
 {//{{{
     STARTFCT
 
-    // zero the integrals
-    zero_real(d->n->Nsignal*(d->n->Nsignal+2),   ws->pdf_real);
-    zero_comp(d->n->Nsignal*(d->n->Nsignal/2+1), ws->bc);
-
     for (int z_index=0; z_index<d->n->Nz; z_index++)
     {
         // perform mass integration
@@ -436,27 +393,170 @@ tp_zint(hmpdf_obj *d, double phi, twopoint_workspace *ws)
         // correct phases
         SAFEHMPDF(correct_phase2d(d, ws->tempc_comp, 1));
 
-        // compute the correlation function interpolator
-        double corr_phi_2, corr_phi;
-        SAFEHMPDF(corr(d, z_index, 0.5*phi, &corr_phi_2));
-        SAFEHMPDF(corr(d, z_index, phi, &corr_phi));
+        SAFEHMPDF(tp_add_clustered(d, z_index, phi, ws->tempc_comp, ws));
+    }
 
-        // add to the clustered output
-        for (long ii=0; ii<d->n->Nsignal; ii++)
-        // loop over the long direction
+    ENDFCT
+}//}}}
+
+static inline double
+tp_dot(long N, const double *a, const double *b)
+{//{{{
+    double out = 0.0;
+    for (long ii=0; ii<N; ii++)
+    {
+        out += a[ii] * b[ii];
+    }
+    return out;
+}//}}}
+
+static int
+tp_zint_compressed(hmpdf_obj *d, double phi, twopoint_workspace *ws)
+// same as tp_zint_exact, but the clustered beta matrices are projected
+//     onto a basis constructed on the fly by Gram-Schmidt.
+// The matrices are weighted with their prefactors in the z-integral,
+//     w = zweights * comoving^4 / hubble, and a redshift is represented
+//     by its projection as long as the accumulated weighted residuals
+//     stay below zcompr_tol times the accumulated weighted norms (Frobenius),
+//     so redshifts that contribute little are compressed more aggressively.
+// Only the basis matrices are Fourier transformed.
+// Projecting onto r basis matrices costs ~r N^2, so the rank is limited
+//     to log2(N) (and TP_ZCOMPR_MAXRANK) for this to be cheaper
+//     than the N^2 log N FFT it replaces.
+// If the basis would exceed that (or memory runs out),
+//     the remaining redshifts that need a new basis element are treated exactly.
+{//{{{
+    STARTFCT
+
+    long len = d->n->Nsignal * (d->n->Nsignal+2);
+    long lencomp = d->n->Nsignal * (d->n->Nsignal/2+1);
+
+    int maxrank = GSL_MIN(TP_ZCOMPR_MAXRANK, (int)log2((double)(d->n->Nsignal)));
+    double werr = 0.0; // accumulated weighted residuals
+    double wnorm = 0.0; // accumulated weighted norms
+
+    if (ws->zcompr_coeff == NULL)
+    {
+        SAFEALLOC(ws->zcompr_coeff, malloc(d->n->Nz * TP_ZCOMPR_MAXRANK * sizeof(double)));
+        SAFEALLOC(ws->zcompr_deferred, malloc(d->n->Nz * sizeof(int)));
+    }
+    zero_real(d->n->Nz * TP_ZCOMPR_MAXRANK, ws->zcompr_coeff);
+    ws->zcompr_rank = 0;
+
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        double *coeff = ws->zcompr_coeff + z_index*TP_ZCOMPR_MAXRANK;
+
+        // perform mass integration
+        SAFEHMPDF(tp_Mint(d, z_index, phi, ws));
+
+        // symmetrize the clustered beta matrix
+        SAFEHMPDF(symmetrize(d, ws->tempc_real));
+
+        // project onto the existing basis,
+        //     tempc_real holds the residual afterwards
+        double norm = sqrt(tp_dot(len, ws->tempc_real, ws->tempc_real));
+        for (int rr=0; rr<ws->zcompr_rank; rr++)
         {
-            for (long jj=0; jj<d->n->Nsignal/2+1; jj++)
-            // loop over the short direction
+            coeff[rr] = tp_dot(len, ws->tempc_real, ws->zcompr_basis[rr]);
+            for (long ii=0; ii<len; ii++)
             {
-                double complex clterm;
-                SAFEHMPDF(clustered_term(d, z_index, corr_phi_2, corr_phi,
-                                         ii, jj, ws->tempc_comp, &clterm));
-                double complex temp = clterm
-                                      * gsl_pow_4(d->c->comoving[z_index])
-                                      / d->c->hubble[z_index];
-                ws->bc[ii*(d->n->Nsignal/2+1)+jj] += temp * d->n->zweights[z_index];
+                ws->tempc_real[ii] -= coeff[rr] * ws->zcompr_basis[rr][ii];
             }
         }
+        double res = sqrt(tp_dot(len, ws->tempc_real, ws->tempc_real));
+
+        double w = d->n->zweights[z_index] * gsl_pow_4(d->c->comoving[z_index])
+                   / d->c->hubble[z_index];
+        wnorm += w * norm;
+
+        ws->zcompr_deferred[z_index] = 1;
+        if (werr + w * res <= d->tp->zcompr_tol * wnorm)
+        {
+            werr += w * res;
+            continue;
+        }
+
+        // need to extend the basis
+        if (ws->zcompr_rank < maxrank)
+        {
+            if (ws->zcompr_basis[ws->zcompr_rank] == NULL)
+            {
+                // failure to allocate is not a critical error,
+                //     we simply do the remaining redshifts exactly
+                ws->zcompr_basis[ws->zcompr_rank] = fftw_malloc(len * sizeof(double));
+            }
+            if (ws->zcompr_basis[ws->zcompr_rank] != NULL)
+            {
+                for (long ii=0; ii<len; ii++)
+                {
+                    ws->zcompr_basis[ws->zcompr_rank][ii] = ws->tempc_real[ii] / res;
+                }
+                coeff[ws->zcompr_rank] = res;
+                ++ws->zcompr_rank;
+                continue;
+            }
+        }
+
+        // do this redshift exactly: restore the beta matrix from the residual
+        ws->zcompr_deferred[z_index] = 0;
+        for (int rr=0; rr<ws->zcompr_rank; rr++)
+        {
+            for (long ii=0; ii<len; ii++)
+            {
+                ws->tempc_real[ii] += coeff[rr] * ws->zcompr_basis[rr][ii];
+            }
+        }
+        fftw_execute(ws->pc_r2c);
+        SAFEHMPDF(correct_phase2d(d, ws->tempc_comp, 1));
+        SAFEHMPDF(tp_add_clustered(d, z_index, phi, ws->tempc_comp, ws));
+    }
+
+    // transform the basis, including the phase correction
+    for (int rr=0; rr<ws->zcompr_rank; rr++)
+    {
+        fftw_execute_dft_r2c(ws->pc_r2c, ws->zcompr_basis[rr],
+                             (double complex *)(ws->zcompr_basis[rr]));
+        SAFEHMPDF(correct_phase2d(d, (double complex *)(ws->zcompr_basis[rr]), 1));
+    }
+
+    // reconstruct the deferred redshifts in Fourier space
+    for (int z_index=0; z_index<d->n->Nz; z_index++)
+    {
+        if (!(ws->zcompr_deferred[z_index])) { continue; }
+
+        double *coeff = ws->zcompr_coeff + z_index*TP_ZCOMPR_MAXRANK;
+        zero_comp(lencomp, ws->tempc_comp);
+        for (int rr=0; rr<ws->zcompr_rank; rr++)
+        {
+            double complex *basis_comp = (double complex *)(ws->zcompr_basis[rr]);
+            for (long ii=0; ii<lencomp; ii++)
+            {
+                ws->tempc_comp[ii] += coeff[rr] * basis_comp[ii];
+            }
+        }
+        SAFEHMPDF(tp_add_clustered(d, z_index, phi, ws->tempc_comp, ws));
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+tp_zint(hmpdf_obj *d, double phi, twopoint_workspace *ws)
+{//{{{
+    STARTFCT
+
+    // zero the integrals
+    zero_real(d->n->Nsignal*(d->n->Nsignal+2),   ws->pdf_real);
+    zero_comp(d->n->Nsignal*(d->n->Nsignal/2+1), ws->bc);
+
+    if (d->tp->zcompr_tol > 0.0)
+    {
+        SAFEHMPDF(tp_zint_compressed(d, phi, ws));
+    }
+    else
+    {
+        SAFEHMPDF(tp_zint_exact(d, phi, ws));
     }
 
     ENDFCT
@@ -554,6 +654,12 @@ new_tp_ws(long N, twopoint_workspace **out)
     ws->bc = NULL;
     ws->tempc_real = NULL;
 
+    // these are allocated lazily if required
+    ws->zcompr_rank = 0;
+    ws->zcompr_coeff = NULL;
+    ws->zcompr_deferred = NULL;
+    SETARRNULL(ws->zcompr_basis, TP_ZCOMPR_MAXRANK);
+
     // do the allocs first so we don't have to worry
     // about whether fftw_plans have already been computed and need
     // to be destroyed if an alloc fails
@@ -577,6 +683,24 @@ new_tp_ws(long N, twopoint_workspace **out)
 
 #undef NEWTPWS_SAFEALLOC
 
+void
+delete_tp_ws(twopoint_workspace *ws)
+{//{{{
+    fftw_free(ws->pdf_real);
+    free(ws->bc);
+    fftw_free(ws->tempc_real);
+    fftw_destroy_plan(ws->pu_r2c);
+    fftw_destroy_plan(ws->pc_r2c);
+    fftw_destroy_plan(ws->ppdf_c2r);
+    for (int rr=0; rr<TP_ZCOMPR_MAXRANK; rr++)
+    {
+        if (ws->zcompr_basis[rr] != NULL) { fftw_free(ws->zcompr_basis[rr]); }
+    }
+    if (ws->zcompr_coeff != NULL) { free(ws->zcompr_coeff); }
+    if (ws->zcompr_deferred != NULL) { free(ws->zcompr_deferred); }
+    free(ws);
+}//}}}
+
 static int
 prepare_tp(hmpdf_obj *d, double phi)
 {//{{{
@@ -604,6 +728,11 @@ prepare_tp(hmpdf_obj *d, double phi)
     // convert from arcmin to radians
     phi *= RADPERARCMIN;
     SAFEHMPDF(create_tp(d, phi, d->tp->ws));
+    if (d->tp->zcompr_tol > 0.0)
+    {
+        HMPDFPRINT(2, "\t\tclustered term compressed to rank %d (from %d redshifts)\n",
+                      d->tp->ws->zcompr_rank, d->n->Nz);
+    }
     
     // copy PDF into contiguous array (tp->pdf_real has padding from the FFTs)
     if (d->tp->pdf == NULL)
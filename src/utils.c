@@ -177,6 +177,36 @@ zero_comp(long N, double complex *x)
     }
 }//}}}
 
+uint64_t
+hash_bytes(uint64_t h, size_t len, const void *data)
+// FNV-1a, start with h = HASH_INIT
+{//{{{
+    const unsigned char *c = (const unsigned char *)data;
+    for (size_t ii=0; ii<len; ii++)
+    {
+        h ^= (uint64_t)c[ii];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}//}}}
+
+uint64_t
+hash_doubles(uint64_t h, long N, const double *x)
+// the mantissae are rounded to HASH_DBL_BITS bits before hashing,
+//     so round-off level differences (e.g. from different FFTW plans)
+//     do not change the hash
+{//{{{
+    for (long ii=0; ii<N; ii++)
+    {
+        int e;
+        double m = frexp(x[ii], &e);
+        int64_t q = (int64_t)round(ldexp(m, HASH_DBL_BITS));
+        h = hash_bytes(h, sizeof(int64_t), &q);
+        h = hash_bytes(h, sizeof(int), &e);
+    }
+    return h;
+}//}}}
+
 #ifdef GNUPLOT
 struct
 gnuplot_s
@@ -503,6 +533,19 @@ new_interp1d(int N, double *x, double *y, double ylo, double yhi,
     ENDFCT
 }//}}}
 
+int
+interp1d_reinit(interp1d *interp, double ylo, double yhi)
+// after the data pointed to by interp->y has been changed
+{//{{{
+    STARTFCT
+
+    interp->ylo = ylo;
+    interp->yhi = yhi;
+    SAFEGSL(gsl_interp_init(interp->i, interp->x, interp->y, interp->N));
+
+    ENDFCT
+}//}}}
+
 void
 delete_interp1d(interp1d *interp)
 {//{{{
@@ -738,12 +781,139 @@ bin_1d(int N, double *x, double *y,
     ENDFCT
 }//}}}
 
+static inline double
+hat_cumint(double t)
+// integral of the unit hat function max(0, 1-|s|) from -infinity to t
+{//{{{
+    if (t <= -1.0)
+    {
+        return 0.0;
+    }
+    else if (t <= 0.0)
+    {
+        return 0.5 * gsl_pow_2(1.0 + t);
+    }
+    else if (t <= 1.0)
+    {
+        return 1.0 - 0.5 * gsl_pow_2(1.0 - t);
+    }
+    else
+    {
+        return 1.0;
+    }
+}//}}}
+
+static int
+bin_weights_linear(int N, double *x, int Nbins, double *binedges,
+                   int *start, int *len, double **w)
+// exact integrals of the linear interpolation basis functions over the bins,
+//     clipped to the range of x and in units of the grid spacing.
+//     w[ii][kk] is the weight of grid point start[ii]+kk in bin ii
+{//{{{
+    STARTFCT
+
+    double dx = x[1] - x[0];
+
+    for (int ii=0; ii<Nbins; ii++)
+    {
+        double lo = GSL_MAX(binedges[ii], x[0]);
+        double hi = GSL_MIN(binedges[ii+1], x[N-1]);
+        if (hi <= lo)
+        {
+            start[ii] = 0;
+            len[ii] = 0;
+            w[ii] = NULL;
+            continue;
+        }
+        start[ii] = GSL_MAX(0, (int)floor((lo-x[0])/dx));
+        int end = GSL_MIN(N-1, (int)ceil((hi-x[0])/dx)); // inclusive
+        len[ii] = end - start[ii] + 1;
+        SAFEALLOC(w[ii], malloc(len[ii] * sizeof(double)));
+        for (int kk=0; kk<len[ii]; kk++)
+        {
+            double xa = x[start[ii]+kk];
+            w[ii][kk] = hat_cumint((hi-xa)/dx) - hat_cumint((lo-xa)/dx);
+        }
+    }
+
+    ENDFCT
+}//}}}
+
+static int
+bin_2d_bilinear(int N, double *x, double *z,
+                int Nbins, double *binedges, double *out)
+// exact integrals of the bilinear interpolant over the bin pairs.
+// The interpolant is a sum of products of 1D hat functions,
+//     so the binning is a projection W z W^T with the sparse matrix of
+//     hat function integrals W [ Nbins, N ], which costs O(N^2).
+{//{{{
+    STARTFCT
+
+    int *start, *len;
+    double **w;
+    SAFEALLOC(start, malloc(Nbins * sizeof(int)));
+    SAFEALLOC(len,   malloc(Nbins * sizeof(int)));
+    SAFEALLOC(w,     malloc(Nbins * sizeof(double *)));
+    SAFEHMPDF(bin_weights_linear(N, x, Nbins, binedges, start, len, w));
+
+    // z is indexed [y, x], first project the y-direction
+    double *temp;
+    SAFEALLOC(temp, malloc(Nbins * N * sizeof(double)));
+    zero_real(Nbins * N, temp);
+    for (int jj=0; jj<Nbins; jj++)
+    {
+        for (int kk=0; kk<len[jj]; kk++)
+        {
+            double *zrow = z + (start[jj]+kk) * N;
+            double *trow = temp + jj * N;
+            for (int aa=0; aa<N; aa++)
+            {
+                trow[aa] += w[jj][kk] * zrow[aa];
+            }
+        }
+    }
+
+    // then the x-direction
+    // (the weights are in units of the grid spacing, so no further normalization)
+    for (int ii=0; ii<Nbins; ii++)
+    {
+        for (int jj=0; jj<Nbins; jj++)
+        {
+            double res = 0.0;
+            for (int kk=0; kk<len[ii]; kk++)
+            {
+                res += w[ii][kk] * temp[jj*N+start[ii]+kk];
+            }
+            out[ii*Nbins+jj] = res;
+        }
+    }
+
+    for (int ii=0; ii<Nbins; ii++)
+    {
+        if (w[ii] != NULL) { free(w[ii]); }
+    }
+    free(w);
+    free(start);
+    free(len);
+    free(temp);
+
+    ENDFCT
+}//}}}
+
 int
 bin_2d(int N, double *x, double *z, int Nsample,
        int Nbins, double *binedges, double *out, interp2d_mode m)
+// Nsample is only used for bicubic interpolation,
+//     the bilinear case is integrated exactly
 {//{{{
     STARTFCT
 
+    if (m == interp2d_bilinear)
+    {
+        SAFEHMPDF(bin_2d_bilinear(N, x, z, Nbins, binedges, out));
+        return 0;
+    }
+
     interp2d *interp;
     SAFEHMPDF(new_interp2d(N, x, z, 0.0, 0.0, m, NULL, &interp));
     gsl_integration_glfixed_table *t;